@@ -1,7 +1,30 @@
 #include "gtest/gtest.h"
 #include "fluid.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
-#include "fluid.cpp"
+#include "ensemble_runner.h"
+#include "distributed_fluid.h"
+#include "scene.h"
+#include "checkpoint.h"
+#include "scene_file.h"
+#include "frame_recorder.h"
+#include "shm_frame_ring.h"
+#include "input_log.h"
+#include "obstacle_sdf.h"
+#include "obstacle_set.h"
+#include "colour_map.h"
+#include "field_stats.h"
+#include "quality_governor.h"
+#include "image_sequence.h"
+#include "flow_lines.h"
+#include "stage_timers.h"
+#include "trace_events.h"
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
 
 const float density{1.5};
 const size_t numX{1};
@@ -230,3 +253,1217 @@ TEST(Fluid, GivenInitialMVector_WhenCalculatingSmokeForAdvectionAcrossEntireGrid
     fluid.advect_smoke(0.1);
     ASSERT_EQ(fluid.m, expected);
 }
+
+Fluid Create_Tank_Fluid_Instance()
+{
+    Fluid fluid(1000.0, 40, 20, 0.025);
+    size_t n = fluid.numY;
+    for (int i{0}; i < fluid.numX; ++i)
+    {
+        for (int j{0}; j < fluid.numY; ++j)
+        {
+            bool wall = i == 0 || j == 0 || j == fluid.numY - 1 || (std::abs(i - 12) < 3 && std::abs(j - 10) < 3);
+            fluid.s[i * n + j] = wall ? 0.0 : 1.0;
+            if (i == 1)
+            {
+                fluid.u[i * n + j] = 2.0;
+            }
+        }
+    }
+    for (int j{9}; j < 13; ++j)
+    {
+        fluid.m[j] = 0.0;
+    }
+    return fluid;
+}
+
+TEST(Fluid, GivenATankScene_WhenSimulatingWithTheTaskScheduler_ExpectIdenticalFieldsToTheSerialStep)
+{
+    Fluid serial = Create_Tank_Fluid_Instance();
+    Fluid tasked = Create_Tank_Fluid_Instance();
+    TaskScheduler scheduler(4);
+    tasked.scheduler = &scheduler;
+    tasked.rowsPerTask = 5;
+
+    for (int step{0}; step < 10; ++step)
+    {
+        serial.simulate(1.0 / 60.0, 0.0, 40);
+        tasked.simulate(1.0 / 60.0, 0.0, 40);
+    }
+
+    ASSERT_EQ(serial.u, tasked.u);
+    ASSERT_EQ(serial.v, tasked.v);
+    ASSERT_EQ(serial.p, tasked.p);
+    ASSERT_EQ(serial.m, tasked.m);
+}
+
+TEST(Ensemble, GivenASweepSpecWithTwoListedKeys_WhenParsing_ExpectTheCartesianProductOfRuns)
+{
+    std::stringstream spec("# sweep\nscene = tank, windtunnel\noverRelaxation = 1.0, 1.5, 1.9\nsteps = 5\n");
+    std::vector<SweepRun> runs;
+    std::string error;
+
+    ASSERT_TRUE(parse_sweep_spec(spec, runs, error));
+    ASSERT_EQ(runs.size(), 6);
+    EXPECT_EQ(runs[0].sceneNr, 0);
+    EXPECT_EQ(runs[5].sceneNr, 1);
+    EXPECT_FLOAT_EQ(runs[4].overRelaxation, 1.5);
+    EXPECT_EQ(runs[3].steps, 5);
+}
+
+TEST(Ensemble, GivenASweepSpecWithAnUnknownShape_WhenParsing_ExpectAnErrorNamingTheLine)
+{
+    std::stringstream spec("shape = circle, hexagon\n");
+    std::vector<SweepRun> runs;
+    std::string error;
+
+    ASSERT_FALSE(parse_sweep_spec(spec, runs, error));
+    EXPECT_NE(error.find("line 1"), std::string::npos);
+}
+
+TEST(Ensemble, GivenMalformedOrOutOfRangeNumbers_WhenParsing_ExpectAnErrorNamingTheLine)
+{
+    const char* specs[]{"resolution = 40abc\n", "numIters = 20.5\n", "\nresolution = 0\n", "steps = -5\n",
+                        "numIters = 1e12\n", "overRelaxation = 1.5x\n"};
+    const char* lines[]{"line 1", "line 1", "line 2", "line 1", "line 1", "line 1"};
+    for (int k{0}; k < 6; ++k)
+    {
+        std::stringstream spec(specs[k]);
+        std::vector<SweepRun> runs;
+        std::string error;
+        EXPECT_FALSE(parse_sweep_spec(spec, runs, error)) << specs[k];
+        EXPECT_NE(error.find(lines[k]), std::string::npos) << error;
+    }
+
+    std::stringstream spec("resolution = 40, 60.0\nsteps = 1\n");
+    std::vector<SweepRun> runs;
+    std::string error;
+    ASSERT_TRUE(parse_sweep_spec(spec, runs, error)) << error;
+    EXPECT_EQ(runs[1].resolution, 60);
+}
+
+TEST(Ensemble, GivenRunsOfDifferentCost_WhenRunningOnOneWorker_ExpectTheLongestBatchFirst)
+{
+    std::stringstream spec("resolution = 4, 12, 8, 16\nsteps = 1\nnumIters = 1\n");
+    std::vector<SweepRun> runs;
+    std::string error;
+    ASSERT_TRUE(parse_sweep_spec(spec, runs, error)) << error;
+
+    TaskScheduler scheduler(1);
+    std::vector<RunSummary> summaries = run_ensemble(runs, scheduler, 1);
+    ASSERT_EQ(summaries.size(), 4u);
+    EXPECT_EQ(summaries[3].startOrder, 0u);
+    EXPECT_EQ(summaries[1].startOrder, 1u);
+    EXPECT_EQ(summaries[2].startOrder, 2u);
+    EXPECT_EQ(summaries[0].startOrder, 3u);
+}
+
+void Init_Tank_Column(Fluid& f, int globalI, int i)
+{
+    Fluid global = Create_Tank_Fluid_Instance();
+    std::copy(global.s.begin() + globalI * f.numY, global.s.begin() + (globalI + 1) * f.numY, f.s.begin() + i * f.numY);
+    std::copy(global.u.begin() + globalI * f.numY, global.u.begin() + (globalI + 1) * f.numY, f.u.begin() + i * f.numY);
+    std::copy(global.m.begin() + globalI * f.numY, global.m.begin() + (globalI + 1) * f.numY, f.m.begin() + i * f.numY);
+}
+
+TEST(Distributed, GivenASingleRank_WhenSimulating_ExpectIdenticalFieldsToTheSerialStep)
+{
+    Fluid serial = Create_Tank_Fluid_Instance();
+    SharedMemoryTransport::Region* region = SharedMemoryTransport::create_region(1, 1024);
+    SharedMemoryTransport transport(region, 0);
+    DistributedFluid distributed(transport, 1000.0, 40, 20, 0.025, 4);
+    distributed.initialise(Init_Tank_Column);
+
+    for (int step{0}; step < 5; ++step)
+    {
+        serial.simulate(1.0 / 60.0, 0.0, 40);
+        distributed.simulate(1.0 / 60.0, 0.0, 40);
+    }
+
+    ASSERT_EQ(serial.u, distributed.local.u);
+    ASSERT_EQ(serial.m, distributed.local.m);
+    SharedMemoryTransport::destroy_region(region);
+}
+
+TEST(Distributed, GivenTwoRanksOverSharedMemory_WhenSimulating_ExpectOwnedColumnsToTrackTheSerialStep)
+{
+    Fluid serial = Create_Tank_Fluid_Instance();
+    SharedMemoryTransport::Region* region = SharedMemoryTransport::create_region(2, 22 * 4 * sizeof(float));
+    std::vector<float> maxError(2, 0.0);
+
+    for (int step{0}; step < 5; ++step)
+    {
+        serial.simulate(1.0 / 60.0, 0.0, 40);
+    }
+
+    std::vector<std::thread> ranks;
+    for (int rank{0}; rank < 2; ++rank)
+    {
+        ranks.emplace_back([&, rank] {
+            SharedMemoryTransport transport(region, rank);
+            DistributedFluid distributed(transport, 1000.0, 40, 20, 0.025, 4);
+            distributed.initialise(Init_Tank_Column);
+            for (int step{0}; step < 5; ++step)
+            {
+                EXPECT_TRUE(distributed.simulate(1.0 / 60.0, 0.0, 40));
+            }
+
+            size_t n = serial.numY;
+            for (int i{distributed.ownedBegin}; i < distributed.ownedEnd; ++i)
+            {
+                for (size_t j{0}; j < n; ++j)
+                {
+                    float error = std::abs(serial.m[i * n + j] - distributed.local.m[(i - distributed.firstColumn) * n + j]);
+                    maxError[rank] = std::max(maxError[rank], error);
+                }
+            }
+        });
+    }
+    for (std::thread& rank : ranks)
+    {
+        rank.join();
+    }
+
+    EXPECT_LT(maxError[0], 0.05);
+    EXPECT_LT(maxError[1], 0.05);
+    SharedMemoryTransport::destroy_region(region);
+}
+
+TEST(Distributed, GivenMailboxesTooSmallForAMessage_WhenSending_ExpectFailureInsteadOfAHang)
+{
+    EXPECT_EQ(distributed_halo_width(0, 2, 82), 1);
+    EXPECT_EQ(distributed_halo_width(100, 2, 82), 41);
+
+    SharedMemoryTransport::Region* empty = SharedMemoryTransport::create_region(2, 0);
+    SharedMemoryTransport noCapacity(empty, 0);
+    std::vector<float> column(22, 1.0f);
+    EXPECT_FALSE(noCapacity.exchange(nullptr, nullptr, column.data(), column.data(), column.size() * sizeof(float)));
+    SharedMemoryTransport::destroy_region(empty);
+
+    SharedMemoryTransport::Region* region = SharedMemoryTransport::create_region(2, 8 * sizeof(float));
+    SharedMemoryTransport transport(region, 0);
+    EXPECT_FALSE(transport.send(1, column.data(), column.size() * sizeof(float)));
+    SharedMemoryTransport::destroy_region(region);
+}
+
+TEST(Fluid, GivenATankSceneOnAScheduler_WhenDistributingPages_ExpectFieldContentsToBePreserved)
+{
+    Fluid fluid = Create_Tank_Fluid_Instance();
+    Fluid expected = Create_Tank_Fluid_Instance();
+    TaskScheduler scheduler(3);
+    fluid.scheduler = &scheduler;
+    fluid.rowsPerTask = 4;
+
+    fluid.distribute_pages();
+
+    ASSERT_EQ(fluid.u, expected.u);
+    ASSERT_EQ(fluid.s, expected.s);
+    ASSERT_EQ(fluid.m, expected.m);
+    EXPECT_NE(fluid.placement_report().find("tempM: "), std::string::npos);
+}
+
+TEST(Scene, GivenTheWindTunnelScene_WhenSettingItUp_ExpectInflowWallsAndTheObstacleAtTheCentre)
+{
+    SimulationParameters params;
+    params.sceneNr = 1;
+    setup_scene(params);
+    Fluid* f = params.fluid;
+    size_t n = f->numY;
+
+    EXPECT_EQ(f->numX, 202);
+    EXPECT_FLOAT_EQ(params.gravity, 0.0);
+    EXPECT_FLOAT_EQ(f->u[1 * n + 50], 2.0);
+    EXPECT_FLOAT_EQ(f->s[0 * n + 50], 0.0);
+    EXPECT_FLOAT_EQ(f->s[100 * n + 50], 0.0);
+    EXPECT_FLOAT_EQ(f->s[150 * n + 50], 1.0);
+    delete params.fluid;
+}
+
+TEST(Checkpoint, GivenASimulatedScene_WhenWritingAndRestoring_ExpectIdenticalStateAndContinuation)
+{
+    SimulationParameters params;
+    params.sceneNr = 1;
+    params.resolution = 40;
+    setup_scene(params);
+    for (int step{0}; step < 5; ++step)
+    {
+        simulate_step(params);
+    }
+
+    std::string path = ::testing::TempDir() + "fluid_checkpoint_test.ckpt";
+    std::string error;
+    ASSERT_TRUE(write_checkpoint(path, params, error)) << error;
+
+    CheckpointView view;
+    ASSERT_TRUE(view.open(path, error)) << error;
+    EXPECT_EQ(view.header().numX, params.fluid->numX);
+    EXPECT_EQ(view.header().frameNr, 5);
+    EXPECT_EQ(view.header().fieldOffset[CHECKPOINT_U] % checkpointAlignment, 0u);
+    EXPECT_FLOAT_EQ(view.field(CHECKPOINT_M)[params.fluid->numCells / 2], params.fluid->m[params.fluid->numCells / 2]);
+    view.close();
+
+    SimulationParameters restored;
+    ASSERT_TRUE(restore_checkpoint(path, restored, nullptr, error)) << error;
+    EXPECT_EQ(restored.frameNr, 5);
+    EXPECT_EQ(restored.fluid->u, params.fluid->u);
+    EXPECT_EQ(restored.fluid->s, params.fluid->s);
+    EXPECT_EQ(restored.fluid->m, params.fluid->m);
+
+    simulate_step(params);
+    simulate_step(restored);
+    EXPECT_EQ(restored.fluid->m, params.fluid->m);
+    EXPECT_EQ(restored.fluid->v, params.fluid->v);
+
+    std::remove(path.c_str());
+    delete params.fluid;
+    delete restored.fluid;
+}
+
+TEST(Checkpoint, GivenASceneFileWithStaticObstacles_WhenDraggingAfterARestore_ExpectTheSameStateAsWithoutTheRestore)
+{
+    std::string error;
+    std::string path = ::testing::TempDir() + "fluid_checkpoint_scene_test.ckpt";
+    for (const char* scene : {"obstacle_course.scene", "airfoil.scene"})
+    {
+        SimulationParameters params;
+        params.resolution = 60;
+        ASSERT_TRUE(load_scene_file(std::string(FLUID_SCENE_DIR) + "/" + scene, params, nullptr, "", error)) << error;
+        for (int step{0}; step < 3; ++step)
+        {
+            simulate_step(params);
+        }
+        ASSERT_TRUE(write_checkpoint(path, params, error)) << error;
+
+        SimulationParameters restored;
+        ASSERT_TRUE(restore_checkpoint(path, restored, nullptr, error)) << error;
+        EXPECT_EQ(restored.baseSolid, params.baseSolid) << scene;
+        EXPECT_EQ(restored.customShapes.size(), params.customShapes.size()) << scene;
+        EXPECT_EQ(restored.smoothObstacles, params.smoothObstacles) << scene;
+
+        // The drag redraws from baseSolid, so the static obstacles must survive it.
+        for (SimulationParameters* run : {&params, &restored})
+        {
+            set_obstacle(*run, run->obstacleX - 0.3f, run->obstacleY + 0.1f, false);
+            simulate_step(*run);
+        }
+        EXPECT_EQ(restored.fluid->s, params.fluid->s) << scene;
+        EXPECT_EQ(restored.fluid->u, params.fluid->u) << scene;
+        EXPECT_EQ(restored.fluid->p, params.fluid->p) << scene;
+        delete params.fluid;
+        delete restored.fluid;
+    }
+    std::remove(path.c_str());
+}
+
+TEST(Checkpoint, GivenAScheduler_WhenRestoring_ExpectTheSameFieldsAsWithoutOne)
+{
+    SimulationParameters params;
+    params.sceneNr = 1;
+    params.resolution = 60;
+    setup_scene(params);
+    for (int step{0}; step < 3; ++step)
+    {
+        simulate_step(params);
+    }
+
+    std::string path = ::testing::TempDir() + "fluid_checkpoint_scheduler_test.ckpt";
+    std::string error;
+    ASSERT_TRUE(write_checkpoint(path, params, error)) << error;
+
+    TaskScheduler scheduler(3);
+    SimulationParameters restored;
+    ASSERT_TRUE(restore_checkpoint(path, restored, &scheduler, error)) << error;
+    EXPECT_EQ(restored.fluid->scheduler, &scheduler);
+    EXPECT_EQ(restored.fluid->u, params.fluid->u);
+    EXPECT_EQ(restored.fluid->v, params.fluid->v);
+    EXPECT_EQ(restored.fluid->p, params.fluid->p);
+    EXPECT_EQ(restored.fluid->s, params.fluid->s);
+    EXPECT_EQ(restored.fluid->m, params.fluid->m);
+
+    std::remove(path.c_str());
+    delete params.fluid;
+    delete restored.fluid;
+}
+
+TEST(Checkpoint, GivenAFileThatIsNotACheckpoint_WhenOpening_ExpectAnError)
+{
+    std::string path = ::testing::TempDir() + "fluid_not_a_checkpoint.ckpt";
+    std::ofstream(path) << std::string(4096, 'x');
+
+    CheckpointView view;
+    std::string error;
+    EXPECT_FALSE(view.open(path, error));
+    EXPECT_NE(error.find("not a checkpoint"), std::string::npos);
+    std::remove(path.c_str());
+}
+
+TEST(FrameRecorder, GivenRecordedTankFrames_WhenReadingTheStreamBack_ExpectFieldsWithinQuantisationError)
+{
+    Fluid fluid = Create_Tank_Fluid_Instance();
+    std::string path = ::testing::TempDir() + "fluid_frames_test.frames";
+    std::string error;
+
+    std::vector<std::vector<float>> expectedM;
+    std::vector<std::vector<float>> expectedU;
+    {
+        FrameRecorder recorder(64);
+        ASSERT_TRUE(recorder.open(path, 2, error)) << error;
+        for (int frameNr{1}; frameNr <= 40; ++frameNr)
+        {
+            fluid.simulate(1.0 / 120.0, 0.0, 20);
+            if (recorder.record(fluid, frameNr))
+            {
+                expectedM.push_back(fluid.m);
+                expectedU.push_back(fluid.u);
+            }
+        }
+        recorder.close();
+        EXPECT_EQ(recorder.frames_written(), 20u);
+        EXPECT_EQ(recorder.frames_dropped(), 0u);
+        EXPECT_LT(recorder.bytes_written(), 20u * 4 * fluid.numCells * sizeof(float) / 2);
+    }
+
+    FrameReader reader;
+    ASSERT_TRUE(reader.open(path, error)) << error;
+    FrameChunkHeader header;
+    std::vector<float> fields[frameNumFields];
+    size_t frame{0};
+    while (reader.next(header, fields, error))
+    {
+        ASSERT_LT(frame, expectedM.size());
+        EXPECT_EQ(header.frameNr, static_cast<int>(2 * (frame + 1)));
+        // A value leaving the key frame's range may force a key frame early.
+        if (frame % frameKeyInterval == 0)
+        {
+            EXPECT_NE(header.keyFrame, 0u);
+        }
+        for (int c{0}; c < fluid.numCells; ++c)
+        {
+            float mTolerance = (header.maxValue[FRAME_M] - header.minValue[FRAME_M]) / 65535.0f + 1e-6f;
+            float uTolerance = (header.maxValue[FRAME_U] - header.minValue[FRAME_U]) / 65535.0f + 1e-6f;
+            ASSERT_NEAR(fields[FRAME_M][c], expectedM[frame][c], mTolerance);
+            ASSERT_NEAR(fields[FRAME_U][c], expectedU[frame][c], uTolerance);
+        }
+        frame++;
+    }
+    EXPECT_TRUE(error.empty()) << error;
+    EXPECT_EQ(frame, expectedM.size());
+    std::remove(path.c_str());
+}
+
+TEST(ShmFrameRing, GivenPublishedFrames_WhenReadingTheLatest_ExpectTheNewestFrameInPlaceUntilTheRingWraps)
+{
+    Fluid fluid = Create_Tank_Fluid_Instance();
+    std::string name = "/fluid_frames_test_" + std::to_string(getpid());
+    std::string error;
+
+    ShmFramePublisher publisher;
+    ASSERT_TRUE(publisher.open(name, fluid.numCells, 2, error)) << error;
+    ShmFrameReader reader;
+    ASSERT_TRUE(reader.open(name, error)) << error;
+
+    ShmFrameView view;
+    EXPECT_FALSE(reader.acquire_latest(view));
+
+    ASSERT_TRUE(publisher.publish(fluid, 7));
+    fluid.simulate(1.0 / 120.0, 0.0, 20);
+    ASSERT_TRUE(publisher.publish(fluid, 8));
+    ASSERT_TRUE(reader.acquire_latest(view));
+    EXPECT_EQ(view.frameNr, 8);
+    EXPECT_EQ(view.numX, fluid.numX);
+    EXPECT_EQ(reader.published(), 2u);
+    for (int c{0}; c < fluid.numCells; ++c)
+    {
+        ASSERT_EQ(view.fields[SHM_M][c], fluid.m[c]);
+        ASSERT_EQ(view.fields[SHM_U][c], fluid.u[c]);
+    }
+    EXPECT_TRUE(reader.still_valid(view));
+
+    // Two more frames reuse the slot behind view.
+    publisher.publish(fluid, 9);
+    publisher.publish(fluid, 10);
+    EXPECT_FALSE(reader.still_valid(view));
+
+    Fluid larger(1000.0, 80, 20, 0.025);
+    EXPECT_FALSE(publisher.publish(larger, 11));
+
+    publisher.close();
+    EXPECT_TRUE(reader.publisher_closed());
+}
+
+TEST(SceneFile, GivenTheShippedWindTunnelScene_WhenLoading_ExpectTheSameFieldsAsTheBuiltInScene)
+{
+    SimulationParameters builtIn;
+    builtIn.sceneNr = 1;
+    setup_scene(builtIn);
+
+    SimulationParameters loaded;
+    std::string error;
+    ASSERT_TRUE(load_scene_file(std::string(FLUID_SCENE_DIR) + "/windtunnel.scene", loaded, nullptr, "", error)) << error;
+
+    EXPECT_EQ(loaded.fluid->numX, builtIn.fluid->numX);
+    EXPECT_EQ(loaded.fluid->numY, builtIn.fluid->numY);
+    EXPECT_EQ(loaded.fluid->s, builtIn.fluid->s);
+    EXPECT_EQ(loaded.fluid->u, builtIn.fluid->u);
+    EXPECT_EQ(loaded.fluid->m, builtIn.fluid->m);
+    EXPECT_EQ(loaded.gravity, builtIn.gravity);
+    EXPECT_EQ(loaded.dt, builtIn.dt);
+    EXPECT_EQ(loaded.showSmoke, builtIn.showSmoke);
+    delete builtIn.fluid;
+    delete loaded.fluid;
+}
+
+TEST(SceneFile, GivenACachedScene_WhenLoadingAgain_ExpectTheCacheToBeUsedAndStaticObstaclesToSurviveDragging)
+{
+    std::string cacheDir = ::testing::TempDir() + "fluid_scene_cache_" + std::to_string(getpid());
+    std::string path = std::string(FLUID_SCENE_DIR) + "/obstacle_course.scene";
+    std::string error;
+    bool fromCache{true};
+
+    SimulationParameters first;
+    first.resolution = 60;
+    ASSERT_TRUE(load_scene_file(path, first, nullptr, cacheDir, error, &fromCache)) << error;
+    EXPECT_FALSE(fromCache);
+
+    SimulationParameters second;
+    second.resolution = 60;
+    ASSERT_TRUE(load_scene_file(path, second, nullptr, cacheDir, error, &fromCache)) << error;
+    EXPECT_TRUE(fromCache);
+    EXPECT_EQ(second.fluid->s, first.fluid->s);
+    EXPECT_EQ(second.fluid->m, first.fluid->m);
+
+    // The fixed square at (0.4, 0.3) stays solid when the oval is dragged over it and away.
+    Fluid* f = second.fluid;
+    size_t n = f->numY;
+    int i = static_cast<int>(0.4 / f->h);
+    int j = static_cast<int>(0.3 / f->h);
+    EXPECT_FLOAT_EQ(f->s[i * n + j], 0.0);
+    set_obstacle(second, 0.4, 0.3, false);
+    set_obstacle(second, 1.5, 0.5, false);
+    EXPECT_FLOAT_EQ(f->s[i * n + j], 0.0);
+    EXPECT_FLOAT_EQ(f->s[static_cast<int>(0.6 / f->h) * n + j], 1.0);
+
+    delete first.fluid;
+    delete second.fluid;
+}
+
+TEST(SceneFile, GivenAnInflowOnTheTopBoundary_WhenParsing_ExpectAnErrorNamingTheLine)
+{
+    std::stringstream text("[scene]\nkind = windtunnel\n\n[boundary]\ntop = inflow\n");
+    SceneDescription scene;
+    std::string error;
+
+    EXPECT_FALSE(parse_scene_description(text, scene, error));
+    EXPECT_NE(error.find("line 5"), std::string::npos);
+}
+
+TEST(InputLog, GivenARecordedSession_WhenReplayingOnMoreThreads_ExpectTheRecordedEndHash)
+{
+    std::string path = ::testing::TempDir() + "fluid_input_log_test.log";
+    std::string error;
+
+    SimulationParameters params;
+    params.resolution = 30;
+    setup_scene(params);
+    InputRecorder recorder;
+    ASSERT_TRUE(recorder.open(path, params, error)) << error;
+
+    for (int step{0}; step < 30; ++step)
+    {
+        if (step == 10)
+        {
+            params.shape = 2;
+            recorder.record_shape(params);
+        }
+        if (step % 3 == 0)
+        {
+            float x = 0.6f + 0.0137f * step;
+            recorder.record_obstacle(params, x, 0.45f, false);
+            set_obstacle(params, x, 0.45f, false);
+        }
+        if (step == 20)
+        {
+            params.sceneNr = 2;
+            setup_scene(params);
+            recorder.record_scene(params);
+        }
+        simulate_step(params);
+    }
+    uint64_t recordedHash = state_hash(*params.fluid);
+    recorder.close(params);
+
+    InputReplay replay;
+    ASSERT_TRUE(replay.load(path, error)) << error;
+    ASSERT_TRUE(replay.has_expected_hash());
+    EXPECT_EQ(replay.expected_hash(), recordedHash);
+
+    TaskScheduler scheduler(2);
+    SimulationParameters replayed;
+    int steps{0};
+    replay.apply_due(replayed, &scheduler, error);
+    while (!replay.finished())
+    {
+        simulate_step(replayed);
+        steps++;
+        replay.apply_due(replayed, &scheduler, error);
+    }
+    EXPECT_TRUE(error.empty()) << error;
+    EXPECT_EQ(steps, 30);
+    EXPECT_EQ(replayed.sceneNr, 2);
+    EXPECT_EQ(state_hash(*replayed.fluid), recordedHash);
+
+    std::remove(path.c_str());
+    delete params.fluid;
+    delete replayed.fluid;
+}
+
+TEST(InputLog, GivenALogStartingWithALaterRestart_WhenReplaying_ExpectTheCheckpointToBeRestoredFirst)
+{
+    std::string checkpointPath = ::testing::TempDir() + "fluid_input_log_restart.ckpt";
+    std::string logPath = ::testing::TempDir() + "fluid_input_log_restart.log";
+    std::string error;
+
+    SimulationParameters params;
+    params.resolution = 30;
+    setup_scene(params);
+    for (int step{0}; step < 5; ++step)
+    {
+        simulate_step(params);
+    }
+    ASSERT_EQ(params.frameNr, 5);
+    ASSERT_TRUE(write_checkpoint(checkpointPath, params, error)) << error;
+    for (int step{0}; step < 4; ++step)
+    {
+        simulate_step(params);
+        if (params.frameNr == 7)
+        {
+            set_obstacle(params, 0.8f, 0.5f, false);
+        }
+    }
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(state_hash(*params.fluid)));
+    std::ofstream(logPath) << "5 0 restart " << checkpointPath << "\n7 0 obstacle 0.8 0.5 0\n9 0 end " << hash << "\n";
+
+    InputReplay replay;
+    ASSERT_TRUE(replay.load(logPath, error)) << error;
+    SimulationParameters replayed;
+    int steps{0};
+    replay.apply_due(replayed, nullptr, error);
+    ASSERT_NE(replayed.fluid, nullptr) << error;
+    EXPECT_EQ(replayed.frameNr, 5);
+    while (!replay.finished())
+    {
+        simulate_step(replayed);
+        steps++;
+        replay.apply_due(replayed, nullptr, error);
+    }
+    EXPECT_TRUE(error.empty()) << error;
+    EXPECT_EQ(steps, 4);
+    EXPECT_EQ(state_hash(*replayed.fluid), replay.expected_hash());
+
+    std::remove(checkpointPath.c_str());
+    std::remove(logPath.c_str());
+    delete params.fluid;
+    delete replayed.fluid;
+}
+
+TEST(Scene, GivenAnOverrelaxationSetting_WhenStepping_ExpectTheSolverToUseIt)
+{
+    SimulationParameters relaxed;
+    relaxed.resolution = 30;
+    setup_scene(relaxed);
+    SimulationParameters plain;
+    plain.resolution = 30;
+    setup_scene(plain);
+    plain.overRelaxation = 1.0;
+
+    simulate_step(relaxed);
+    simulate_step(plain);
+    EXPECT_FLOAT_EQ(relaxed.fluid->overRelaxation, 1.9f);
+    EXPECT_FLOAT_EQ(plain.fluid->overRelaxation, 1.0f);
+    EXPECT_NE(relaxed.fluid->p, plain.fluid->p);
+
+    delete relaxed.fluid;
+    delete plain.fluid;
+}
+
+TEST(Scene, GivenObstacleDrags_WhenRedrawingOnlyTheDirtyBox_ExpectTheSameFieldsAsAFullRedraw)
+{
+    SimulationParameters dirty;
+    dirty.resolution = 60;
+    setup_scene(dirty);
+    SimulationParameters full;
+    full.resolution = 60;
+    setup_scene(full);
+
+    const float path[][2]{{0.9f, 0.5f}, {0.95f, 0.47f}, {1.3f, 0.3f}, {1.31f, 0.31f}, {0.2f, 0.8f}, {1.9f, 0.1f}};
+    for (int k{0}; k < 6; ++k)
+    {
+        dirty.shape = k % 4;
+        full.shape = k % 4;
+        set_obstacle(dirty, path[k][0], path[k][1], false);
+        full.obstacleBoxValid = false;
+        set_obstacle(full, path[k][0], path[k][1], false);
+        simulate_step(dirty);
+        simulate_step(full);
+
+        ASSERT_EQ(dirty.fluid->s, full.fluid->s) << "after move " << k;
+        ASSERT_EQ(dirty.fluid->u, full.fluid->u) << "after move " << k;
+        ASSERT_EQ(dirty.fluid->m, full.fluid->m) << "after move " << k;
+    }
+    delete dirty.fluid;
+    delete full.fluid;
+}
+
+TEST(ObstacleSdf, GivenAPrecomputedPolygon_WhenSampling_ExpectTheAnalyticDistanceWithinAGridStep)
+{
+    ShapeSdf triangle = ShapeSdf::polygon({0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 1.0f});
+    ShapeSdf grid = triangle.precomputed(64);
+
+    EXPECT_LT(triangle.distance(0.7f, 0.0f), 0.0f);
+    EXPECT_GT(triangle.distance(-0.2f, 0.0f), 0.0f);
+    EXPECT_NEAR(triangle.distance(1.5f, 0.0f), 0.5f, 1e-5);
+    for (float x{-1.0f}; x < 1.0f; x += 0.13f)
+    {
+        for (float y{-1.0f}; y < 1.0f; y += 0.11f)
+        {
+            EXPECT_NEAR(grid.distance(x, y), triangle.distance(x, y), 0.04f) << x << ", " << y;
+        }
+    }
+}
+
+TEST(ObstacleSdf, GivenASmoothCircle_WhenStamping_ExpectFractionalSAtTheBoundaryAndTheRightArea)
+{
+    SimulationParameters params;
+    params.resolution = 80;
+    params.smoothObstacles = true;
+    params.obstacleRadius = 0.2;
+    setup_scene(params);
+    set_obstacle(params, 1.0, 0.5, true);
+
+    Fluid* f = params.fluid;
+    double area{0.0};
+    int partial{0};
+    for (int i{static_cast<int>(0.7 / f->h)}; i < static_cast<int>(1.3 / f->h); ++i)
+    {
+        for (int j{static_cast<int>(0.2 / f->h)}; j < static_cast<int>(0.8 / f->h); ++j)
+        {
+            float s = f->s[i * f->numY + j];
+            area += (1.0 - s) * f->h * f->h;
+            partial += s > 0.0f && s < 1.0f ? 1 : 0;
+        }
+    }
+    EXPECT_GT(partial, 0);
+    EXPECT_NEAR(area, M_PI * 0.2 * 0.2, 0.02 * M_PI * 0.2 * 0.2);
+
+    // Moving it leaves no solid cells behind.
+    set_obstacle(params, 1.4, 0.5, false);
+    EXPECT_FLOAT_EQ(f->s[static_cast<int>(1.0 / f->h) * f->numY + static_cast<int>(0.5 / f->h)], 1.0);
+    delete params.fluid;
+}
+
+TEST(SceneFile, GivenAPolygonObstacle_WhenBuilding_ExpectItsInteriorSolid)
+{
+    std::stringstream text("[scene]\nkind = windtunnel\nresolution = 50\n\n"
+                           "[obstacle]\nshape = polygon\nx = 1.0\ny = 0.5\nradius = 0.2\nvertices = -1 -1, 1 -1, 0 1\n");
+    SceneDescription scene;
+    std::string error;
+    ASSERT_TRUE(parse_scene_description(text, scene, error)) << error;
+
+    SimulationParameters params;
+    build_scene(scene, params);
+    Fluid* f = params.fluid;
+    size_t n = f->numY;
+    EXPECT_FLOAT_EQ(f->s[static_cast<int>(1.0 / f->h) * n + static_cast<int>(0.45 / f->h)], 0.0);
+    EXPECT_FLOAT_EQ(f->s[static_cast<int>(1.15 / f->h) * n + static_cast<int>(0.65 / f->h)], 1.0);
+    delete params.fluid;
+
+    std::stringstream missing("[obstacle]\nshape = polygon\n");
+    EXPECT_FALSE(parse_scene_description(missing, scene, error));
+}
+
+TEST(ObstacleSet, GivenManyMovingObstacles_WhenUpdating_ExpectTheSameMaskAsStampingThemAllAfresh)
+{
+    SimulationParameters params;
+    params.resolution = 60;
+    setup_scene(params);
+    int circle = params.obstacles.add_shape(ShapeSdf::circle());
+    int square = params.obstacles.add_shape(builtin_shape_sdf(1));
+    for (int k{0}; k < 24; ++k)
+    {
+        params.obstacles.add(k % 3 == 0 ? square : circle, 0.2f + 0.07f * k, 0.3f + 0.02f * (k % 5), 0.03f);
+    }
+    update_obstacles(params);
+
+    for (int step{0}; step < 5; ++step)
+    {
+        // Only a few move each step; some overlap their neighbours and the draggable obstacle.
+        for (int k{step}; k < 24; k += 6)
+        {
+            const MovingObstacle& obstacle = params.obstacles.obstacle(k);
+            params.obstacles.move(k, obstacle.x + 0.02f, obstacle.y + 0.03f, params.dt);
+        }
+        update_obstacles(params);
+        EXPECT_LT(params.obstacles.last_redrawn_cells(), params.fluid->numCells / 4);
+
+        SimulationParameters fresh;
+        fresh.resolution = 60;
+        setup_scene(fresh);
+        fresh.obstacles.add_shape(ShapeSdf::circle());
+        fresh.obstacles.add_shape(builtin_shape_sdf(1));
+        for (int k{0}; k < 24; ++k)
+        {
+            const MovingObstacle& obstacle = params.obstacles.obstacle(k);
+            fresh.obstacles.add(obstacle.shape, obstacle.x, obstacle.y, obstacle.radius);
+        }
+        update_obstacles(fresh);
+        ASSERT_EQ(params.fluid->s, fresh.fluid->s) << "after step " << step;
+        delete fresh.fluid;
+    }
+
+    // Moved obstacles carry their velocity onto the faces they cover.
+    const MovingObstacle& moved = params.obstacles.obstacle(4);
+    size_t n = params.fluid->numY;
+    int i = static_cast<int>(moved.x / params.fluid->h);
+    int j = static_cast<int>(moved.y / params.fluid->h);
+    EXPECT_NEAR(params.fluid->u[i * n + j], 0.02 / params.dt, 1e-4);
+    EXPECT_NEAR(params.fluid->v[i * n + j], 0.03 / params.dt, 1e-4);
+    delete params.fluid;
+}
+
+TEST(ColourMap, GivenValuesAcrossTheRange_WhenLookingUpTheLut_ExpectTheAnalyticScientificColours)
+{
+    const ColourMap& map = sci_colour_map();
+    auto bytes = [](Rgba8 pixel) { return std::vector<int>{static_cast<int>(pixel & 0xff), static_cast<int>((pixel >> 8) & 0xff), static_cast<int>((pixel >> 16) & 0xff), static_cast<int>(pixel >> 24)}; };
+
+    EXPECT_EQ(bytes(map.colour(-5.0f, 0.0f, 1.0f)), (std::vector<int>{0, 0, 255, 255}));
+    EXPECT_EQ(bytes(map.colour(5.0f, 0.0f, 1.0f)), (std::vector<int>{255, 0, 0, 255}));
+    EXPECT_EQ(bytes(map.colour(0.5f, 0.0f, 1.0f)), (std::vector<int>{0, 255, 0, 255}));
+    EXPECT_EQ(bytes(map.colour(3.0f, 3.0f, 3.0f)), (std::vector<int>{0, 255, 0, 255}));
+
+    // Cyan at a quarter, yellow at three quarters, within one LUT step.
+    std::vector<int> cyan = bytes(map.colour(25.0f, 0.0f, 100.0f));
+    EXPECT_EQ(cyan[0], 0);
+    EXPECT_EQ(cyan[1], 255);
+    EXPECT_NEAR(cyan[2], 255, 1);
+    std::vector<int> yellow = bytes(map.colour(75.0f, 0.0f, 100.0f));
+    EXPECT_NEAR(yellow[0], 255, 1);
+    EXPECT_NEAR(yellow[1], 255, 1);
+    EXPECT_EQ(yellow[2], 0);
+}
+
+TEST(ColourMap, GivenATankScene_WhenColouringSmoke_ExpectGreyPixelsInFieldOrder)
+{
+    SimulationParameters params;
+    params.resolution = 20;
+    setup_scene(params);
+    Fluid* f = params.fluid;
+    for (int k{0}; k < f->numCells; ++k)
+    {
+        f->m[k] = (k % 7) / 6.0f;
+    }
+
+    std::vector<Rgba8> rgba;
+    ColourOptions options;
+    colour_fluid(*f, options, rgba);
+    ASSERT_EQ(rgba.size(), static_cast<size_t>(f->numCells));
+    for (int k{0}; k < f->numCells; k += 13)
+    {
+        uint8_t grey = static_cast<uint8_t>(255.0f * f->m[k]);
+        EXPECT_EQ(rgba[k], pack_rgba8(grey, grey, grey)) << k;
+    }
+
+    options.showSmoke = false;
+    colour_fluid(*f, options, rgba);
+    EXPECT_EQ(rgba[0], pack_rgba8(0, 0, 0));
+    EXPECT_EQ(rgba[5 * f->numY + 5], pack_rgba8(255, 255, 255));
+    delete f;
+}
+
+TEST(FieldStats, GivenSerialAndTaskedSteps_WhenReadingTheStepStatistics_ExpectAFullRescanOfTheFields)
+{
+    Fluid serial = Create_Tank_Fluid_Instance();
+    Fluid tasked = Create_Tank_Fluid_Instance();
+    TaskScheduler scheduler(4);
+    tasked.scheduler = &scheduler;
+    tasked.rowsPerTask = 5;
+    EXPECT_FALSE(serial.field_stats().valid);
+
+    for (int step{0}; step < 5; ++step)
+    {
+        serial.simulate(1.0 / 60.0, -9.81, 40);
+        tasked.simulate(1.0 / 60.0, -9.81, 40);
+    }
+
+    for (const Fluid* f : {&serial, &tasked})
+    {
+        const FieldStats& stats = f->field_stats();
+        ASSERT_TRUE(stats.valid);
+        EXPECT_EQ(stats.p.min, *std::min_element(f->p.begin(), f->p.end()));
+        EXPECT_EQ(stats.p.max, *std::max_element(f->p.begin(), f->p.end()));
+        EXPECT_EQ(stats.u.max, *std::max_element(f->u.begin(), f->u.end()));
+        EXPECT_EQ(stats.v.min, *std::min_element(f->v.begin(), f->v.end()));
+
+        double smoke{0.0};
+        float maxSpeed{0.0f};
+        size_t n = f->numY;
+        for (int i{0}; i < f->numX; ++i)
+        {
+            for (int j{0}; j < f->numY; ++j)
+            {
+                smoke += f->m[i * n + j];
+                if (i + 1 < f->numX && j + 1 < f->numY)
+                {
+                    maxSpeed = std::max(maxSpeed, std::hypot(0.5f * (f->u[i * n + j] + f->u[(i + 1) * n + j]), 0.5f * (f->v[i * n + j] + f->v[i * n + j + 1])));
+                }
+            }
+        }
+        EXPECT_NEAR(stats.m.sum, smoke, 1e-6 * smoke);
+        EXPECT_NEAR(stats.maxSpeed, maxSpeed, 1e-5 * maxSpeed);
+        EXPECT_GT(stats.maxDivergence, 0.0f);
+    }
+    EXPECT_EQ(serial.field_stats().maxDivergence, tasked.field_stats().maxDivergence);
+}
+
+TEST(FluidOutputs, GivenNoSubscribers_WhenSimulating_ExpectTheSameVelocitiesWithoutPressureOrSmoke)
+{
+    SimulationParameters full;
+    full.resolution = 40;
+    setup_scene(full);
+    SimulationParameters lean;
+    lean.resolution = 40;
+    lean.outputs.demandDriven = true;
+    setup_scene(lean);
+    std::vector<float> initialM = lean.fluid->m;
+
+    for (int step{0}; step < 10; ++step)
+    {
+        simulate_step(full);
+        simulate_step(lean);
+    }
+    EXPECT_EQ(lean.fluid->u, full.fluid->u);
+    EXPECT_EQ(lean.fluid->v, full.fluid->v);
+    EXPECT_EQ(lean.fluid->m, initialM);
+    EXPECT_EQ(*std::max_element(lean.fluid->p.begin(), lean.fluid->p.end()), 0.0f);
+    EXPECT_FALSE(lean.fluid->field_stats().valid);
+    EXPECT_TRUE(lean.fluid->vorticity.empty());
+
+    // A subscriber turns an output back on from the next step; dropping it turns it off again.
+    lean.outputs.subscribe(OUTPUT_PRESSURE | OUTPUT_VORTICITY);
+    simulate_step(full);
+    simulate_step(lean);
+    EXPECT_EQ(lean.fluid->p, full.fluid->p);
+    EXPECT_EQ(lean.fluid->vorticity, full.fluid->vorticity);
+    lean.outputs.unsubscribe(OUTPUT_PRESSURE | OUTPUT_VORTICITY);
+    EXPECT_EQ(lean.outputs.active(), 0u);
+
+    // The view's pressure subscription: the colour range comes from the stats.
+    lean.outputs.subscribe(OUTPUT_PRESSURE | OUTPUT_STATS);
+    simulate_step(lean);
+    ASSERT_TRUE(lean.fluid->field_stats().valid);
+    EXPECT_EQ(lean.fluid->field_stats().p.min, *std::min_element(lean.fluid->p.begin(), lean.fluid->p.end()));
+    EXPECT_EQ(lean.fluid->field_stats().p.max, *std::max_element(lean.fluid->p.begin(), lean.fluid->p.end()));
+    lean.outputs.unsubscribe(OUTPUT_PRESSURE | OUTPUT_STATS);
+
+    delete full.fluid;
+    delete lean.fluid;
+}
+
+TEST(FluidOutputs, GivenVorticityOnTheTaskScheduler_WhenSimulating_ExpectTheSerialCornerVorticity)
+{
+    Fluid serial = Create_Tank_Fluid_Instance();
+    Fluid tasked = Create_Tank_Fluid_Instance();
+    TaskScheduler scheduler(4);
+    tasked.scheduler = &scheduler;
+    tasked.rowsPerTask = 5;
+    serial.outputs = OUTPUT_VORTICITY;
+    tasked.outputs = OUTPUT_VORTICITY;
+
+    for (int step{0}; step < 5; ++step)
+    {
+        serial.simulate(1.0 / 60.0, -9.81, 40);
+        tasked.simulate(1.0 / 60.0, -9.81, 40);
+    }
+    ASSERT_EQ(serial.u, tasked.u);
+    ASSERT_EQ(serial.vorticity, tasked.vorticity);
+
+    size_t n = serial.numY;
+    int i{6};
+    int j{7};
+    float expected = (serial.v[i * n + j] - serial.v[(i - 1) * n + j] - serial.u[i * n + j] + serial.u[i * n + j - 1]) / serial.h;
+    EXPECT_FLOAT_EQ(serial.vorticity[i * n + j], expected);
+}
+
+TEST(QualityGovernor, GivenStepsOverAndUnderTheTarget_WhenObserving_ExpectIterationsAndResolutionToFollow)
+{
+    QualitySettings settings;
+    settings.targetStepMs = 10.0;
+    settings.window = 5;
+    QualityGovernor governor(settings);
+    SimulationParameters params;
+    params.numIters = 40;
+
+    // Twice the target: iterations halve once a window is full.
+    for (int step{0}; step < 4; ++step)
+    {
+        EXPECT_FALSE(governor.observe(20.0, params));
+    }
+    ASSERT_TRUE(governor.observe(20.0, params));
+    EXPECT_EQ(params.numIters, 20);
+    EXPECT_EQ(governor.last_decision().from, 40);
+    EXPECT_EQ(governor.last_decision().kind, QualityDecision::ITERATIONS);
+
+    // Inside the dead band nothing changes.
+    for (int step{0}; step < 5; ++step)
+    {
+        EXPECT_FALSE(governor.observe(10.5, params));
+    }
+    EXPECT_EQ(params.numIters, 20);
+    EXPECT_EQ(governor.next_resolution(100, 0), 100);
+
+    // Headroom grows them by a quarter per window, up to the limit.
+    for (int step{0}; step < 5; ++step)
+    {
+        governor.observe(2.0, params);
+    }
+    EXPECT_EQ(params.numIters, 25);
+
+    // Still far over budget at the minimum: shrink the next grid instead.
+    for (int step{0}; step < 20; ++step)
+    {
+        governor.observe(40.0, params);
+    }
+    EXPECT_EQ(params.numIters, settings.minIters);
+    EXPECT_EQ(governor.next_resolution(100, 0), 50);
+    EXPECT_EQ(governor.last_decision().kind, QualityDecision::RESOLUTION);
+    governor.reset();
+    EXPECT_EQ(governor.next_resolution(50, 0), 50);
+}
+
+TEST(ImageSequence, GivenGridFrames_WhenExportingOnEncoderThreads_ExpectNumberedTopDownPpmFiles)
+{
+    Fluid f = Create_Tank_Fluid_Instance();
+    size_t n = f.numY;
+    f.m.assign(f.numCells, 0.0f);
+    f.m[1 * n + (n - 1)] = 1.0f; // top of the second column
+    ColourOptions options;
+
+    std::string prefix = ::testing::TempDir() + "image_sequence_";
+    std::string error;
+    ImageSequenceWriter writer(3, 2);
+    ASSERT_TRUE(writer.open(prefix, "ppm", write_ppm, error)) << error;
+    for (int frameNr{0}; frameNr < 6; ++frameNr)
+    {
+        ImageFrame* frame = writer.acquire();
+        grid_image(f, options, frameNr, *frame);
+        writer.submit(frame);
+    }
+    ASSERT_TRUE(writer.close(error)) << error;
+    EXPECT_EQ(writer.frames_written(), 6u);
+
+    FILE* file = std::fopen(writer.path_for(5).c_str(), "rb");
+    ASSERT_NE(file, nullptr);
+    int width{0};
+    int height{0};
+    ASSERT_EQ(std::fscanf(file, "P6 %d %d 255", &width, &height), 2);
+    std::fgetc(file);
+    std::vector<uint8_t> rgb(3 * width * height);
+    ASSERT_EQ(std::fread(rgb.data(), 1, rgb.size(), file), rgb.size());
+    std::fclose(file);
+    EXPECT_EQ(width, f.numX);
+    EXPECT_EQ(height, f.numY);
+    EXPECT_EQ(rgb[3 * 1], 255);         // row 0 is the top of the tank
+    EXPECT_EQ(rgb[3 * 0], 0);
+    EXPECT_EQ(rgb[3 * (width + 1)], 0); // one row further down
+
+    for (int frameNr{0}; frameNr < 6; ++frameNr)
+    {
+        std::remove(writer.path_for(frameNr).c_str());
+    }
+}
+
+TEST(FlowLines, GivenAUniformStream_WhenTracingInParallel_ExpectHorizontalLinesAndBoundedSeeds)
+{
+    Fluid f(1000.0, 40, 20, 0.025);
+    size_t n = f.numY;
+    for (int i{0}; i < f.numX; ++i)
+    {
+        for (int j{0}; j < f.numY; ++j)
+        {
+            bool wall = i == 0 || j == 0 || i == f.numX - 1 || j == f.numY - 1;
+            f.s[i * n + j] = wall ? 0.0f : 1.0f;
+            f.u[i * n + j] = 1.0f;
+            f.v[i * n + j] = 0.0f;
+        }
+    }
+
+    FlowLineSettings settings;
+    settings.arrows = true;
+    FlowLines serial;
+    FlowLines tasked;
+    TaskScheduler scheduler(4);
+    serial.trace(f, nullptr, 10.0f, settings);
+    tasked.trace(f, &scheduler, 10.0f, settings);
+    ASSERT_EQ(serial.vertices(), tasked.vertices());
+    int seeds = (f.numX - 2) / 2 * ((f.numY - 2) / 2); // 20 pixels apart, 10 per cell
+    EXPECT_EQ(serial.num_seeds(), seeds);
+
+    const std::vector<float>& lines = serial.vertices();
+    ASSERT_FALSE(lines.empty());
+    for (size_t k{0}; k < lines.size(); k += 4)
+    {
+        EXPECT_GE(lines[k], -0.5f);
+        EXPECT_LE(lines[k + 2], 0.5f);
+    }
+    // The streamlines come first: every segment of them is horizontal.
+    for (size_t k{0}; k < lines.size() - serial.num_seeds() * 12; k += 4)
+    {
+        ASSERT_FLOAT_EQ(lines[k + 1], lines[k + 3]);
+    }
+
+    // Smaller cells on screen thin the seeds out; maxSeeds caps them.
+    serial.trace(f, nullptr, 2.0f, settings);
+    EXPECT_LT(serial.num_seeds(), seeds);
+    settings.maxSeeds = 100;
+    tasked.trace(f, &scheduler, 40.0f, settings);
+    EXPECT_LE(tasked.num_seeds(), 100);
+    EXPECT_GT(tasked.num_seeds(), 50);
+}
+
+TEST(StageTimers, GivenKnownDurations_WhenTakingPercentiles_ExpectTheBucketsHoldingThemAndAWindowThatRolls)
+{
+    StageHistogram h;
+    for (int k{1}; k <= 100; ++k)
+    {
+        h.add(k * 1000u); // 1 to 100 us
+    }
+    EXPECT_EQ(h.count(), 100);
+    EXPECT_NEAR(h.mean_us(), 50.5, 1e-9);
+    // Buckets are a quarter octave wide, so a percentile is within 25 % above.
+    EXPECT_GE(h.percentile_us(0.5), 50.0);
+    EXPECT_LE(h.percentile_us(0.5), 50.0 * 1.25);
+    EXPECT_GE(h.percentile_us(0.99), 99.0);
+    EXPECT_LE(h.percentile_us(0.99), 99.0 * 1.25);
+    EXPECT_DOUBLE_EQ(h.max_us(), 100.0);
+
+    for (int k{0}; k < StageHistogram::windowSize; ++k)
+    {
+        h.add(2000u);
+    }
+    EXPECT_EQ(h.count(), StageHistogram::windowSize);
+    EXPECT_DOUBLE_EQ(h.max_us(), 2.0);
+    EXPECT_LE(h.percentile_us(0.99), 2.5);
+
+    if (!stageTimersEnabled)
+    {
+        return;
+    }
+    // A tasked step records one sample per stage, like the serial one.
+    stage_timers().clear();
+    Fluid tasked = Create_Tank_Fluid_Instance();
+    TaskScheduler scheduler(4);
+    tasked.scheduler = &scheduler;
+    tasked.rowsPerTask = 5;
+    Fluid serial = Create_Tank_Fluid_Instance();
+    for (int step{0}; step < 3; ++step)
+    {
+        tasked.simulate(1.0 / 60.0, -9.81, 10);
+        serial.simulate(1.0 / 60.0, -9.81, 10);
+    }
+    for (TimedStage stage : {STAGE_INTEGRATE, STAGE_SOLVE, STAGE_EXTRAPOLATE, STAGE_ADVECT_VEL, STAGE_OUTPUTS})
+    {
+        EXPECT_EQ(stage_timers().histogram(stage).count(), 6) << stage_name(stage);
+    }
+    std::ostringstream csv;
+    stage_timers().write_csv(csv);
+    EXPECT_EQ(csv.str().rfind("stage,samples,mean_us,p50_us,p90_us,p99_us,max_us\nintegrate,6,", 0), 0u);
+}
+
+TEST(TraceEvents, GivenATracedTaskedStep_WhenStopping_ExpectChromeTraceJsonWithEveryStageAndNamedWorkers)
+{
+    std::string path = ::testing::TempDir() + "fluid_trace_test.json";
+    std::string error;
+    TaskScheduler scheduler(3);
+    ASSERT_TRUE(trace_recorder().start(path, error)) << error;
+    {
+        ScopedTraceEvent event("test_scope");
+        Fluid f = Create_Tank_Fluid_Instance();
+        f.scheduler = &scheduler;
+        f.rowsPerTask = 5;
+        f.simulate(1.0 / 60.0, -9.81, 10);
+    }
+    trace_recorder().stop();
+    EXPECT_FALSE(trace_recorder().active());
+    EXPECT_EQ(trace_recorder().events_dropped(), 0u);
+
+    std::ifstream in(path);
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(json.rfind("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", 0), 0u);
+    EXPECT_NE(json.find("\n]}\n"), std::string::npos);
+    EXPECT_NE(json.find("\"name\": \"test_scope\", \"ph\": \"X\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\": {\"name\": \"solver worker 1\"}"), std::string::npos);
+    if (stageTimersEnabled)
+    {
+        for (const char* stage : {"integrate", "solve", "extrapolate", "advect_vel", "outputs"})
+        {
+            EXPECT_NE(json.find("\"name\": \"" + std::string(stage) + "\""), std::string::npos) << stage;
+        }
+    }
+    std::remove(path.c_str());
+}
+
+TEST(PerfCounters, GivenCountersOrNone_WhenProfilingATaskedStep_ExpectPerStageDeltasOrAReasonAndNoCounts)
+{
+    StageCounts c;
+    c.ns = 1000;
+    c.values[PERF_CYCLES] = 2000.0;
+    c.values[PERF_INSTRUCTIONS] = 3000.0;
+    c.values[PERF_BRANCHES] = 400.0;
+    c.values[PERF_BRANCH_MISSES] = 20.0;
+    c.values[PERF_CACHE_REFERENCES] = 50.0;
+    c.values[PERF_CACHE_MISSES] = 10.0;
+    EXPECT_DOUBLE_EQ(c.ipc(), 1.5);
+    EXPECT_DOUBLE_EQ(c.branch_miss_rate(), 0.05);
+    EXPECT_DOUBLE_EQ(c.cache_miss_rate(), 0.2);
+    EXPECT_DOUBLE_EQ(c.gb_per_s(), 0.64);
+    EXPECT_DOUBLE_EQ(StageCounts{}.ipc(), 0.0);
+
+    if (!stageTimersEnabled)
+    {
+        return;
+    }
+    stage_timers().clear();
+    std::string error;
+    bool counting = perf_counters().enable(error);
+    // Containers and VMs often have no PMU; then the step runs uncounted.
+    EXPECT_EQ(counting, error.empty()) << error;
+    EXPECT_EQ(perf_counters().enabled(), counting);
+
+    Fluid f = Create_Tank_Fluid_Instance();
+    TaskScheduler scheduler(3);
+    f.scheduler = &scheduler;
+    f.rowsPerTask = 5;
+    f.simulate(1.0 / 60.0, -9.81, 10);
+    perf_counters().disable();
+
+    for (TimedStage stage : {STAGE_INTEGRATE, STAGE_SOLVE, STAGE_ADVECT_VEL, STAGE_OUTPUTS})
+    {
+        StageCounts counts = stage_timers().counts(stage);
+        if (counting)
+        {
+            EXPECT_GT(counts.ns, 0u) << stage_name(stage);
+            EXPECT_GT(counts.values[PERF_CYCLES], 0.0) << stage_name(stage);
+        }
+        else
+        {
+            EXPECT_EQ(counts.ns, 0u) << stage_name(stage);
+        }
+    }
+    std::stringstream csv;
+    stage_timers().write_counters_csv(csv);
+    std::string header;
+    std::getline(csv, header);
+    EXPECT_EQ(header, "stage,ms,cycles,instructions,branches,branch_misses,cache_references,cache_misses,"
+                      "ipc,branch_miss_pct,cache_miss_pct,gb_per_s");
+    stage_timers().clear();
+}
@@ -0,0 +1,292 @@
+#include "colour_map.h"
+#include "scene.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct GridSize {
+    int numX;
+    int numY;
+};
+
+struct Options {
+    std::vector<GridSize> sizes{{64, 32}, {128, 64}, {256, 128}, {512, 256}, {1024, 512}, {2048, 1024}, {4096, 2048}};
+    std::vector<int> scenes{0, 1, 2};
+    std::vector<std::string> stages;
+    double minMs{200.0};
+    int numIters{0};
+    std::string jsonPath;
+};
+
+// One stage on one grid: calls repeated until minMs has passed.
+struct StageResult {
+    int sceneNr;
+    int numX;
+    int numY;
+    std::string stage;
+    int calls;
+    double totalMs;
+    double cellsPerCall;
+    double bytesPerCall;
+};
+
+const char* sceneNames[]{"tank", "windtunnel", "paint"};
+
+void print_usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [--sizes 64x32,128x64,...] [--scenes tank,windtunnel,paint]\n"
+              << "       [--stages integrate,solve,...] [--min-ms MS] [--iters N] [--json FILE]\n"
+              << "stages: integrate solve extrapolate advect_vel advect_smoke set_obstacle colour\n";
+}
+
+std::vector<std::string> split(const char* list)
+{
+    std::vector<std::string> items;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int k{1}; k < argc; ++k)
+    {
+        bool hasValue = k + 1 < argc;
+        if (std::strcmp(argv[k], "--sizes") == 0 && hasValue)
+        {
+            options.sizes.clear();
+            for (const std::string& size : split(argv[++k]))
+            {
+                GridSize grid{0, 0};
+                if (std::sscanf(size.c_str(), "%dx%d", &grid.numX, &grid.numY) != 2 || grid.numY <= 0 || grid.numX != 2 * grid.numY)
+                {
+                    std::cerr << "grid size " << size << " must be 2N x N, as every scene is twice as wide as high\n";
+                    return false;
+                }
+                options.sizes.push_back(grid);
+            }
+        }
+        else if (std::strcmp(argv[k], "--scenes") == 0 && hasValue)
+        {
+            options.scenes.clear();
+            for (const std::string& name : split(argv[++k]))
+            {
+                int sceneNr{0};
+                while (sceneNr < 3 && name != sceneNames[sceneNr])
+                {
+                    sceneNr++;
+                }
+                if (sceneNr == 3)
+                {
+                    return false;
+                }
+                options.scenes.push_back(sceneNr);
+            }
+        }
+        else if (std::strcmp(argv[k], "--stages") == 0 && hasValue) { options.stages = split(argv[++k]); }
+        else if (std::strcmp(argv[k], "--min-ms") == 0 && hasValue) { options.minMs = std::atof(argv[++k]); }
+        else if (std::strcmp(argv[k], "--iters") == 0 && hasValue) { options.numIters = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--json") == 0 && hasValue) { options.jsonPath = argv[++k]; }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool wanted(const Options& options, const std::string& stage)
+{
+    if (options.stages.empty())
+    {
+        return true;
+    }
+    for (const std::string& name : options.stages)
+    {
+        if (name == stage)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Calls work until minMs has passed, at least once.
+StageResult time_stage(const std::string& stage, double minMs, const std::function<void()>& work)
+{
+    StageResult result{};
+    result.stage = stage;
+    auto start = std::chrono::steady_clock::now();
+    do
+    {
+        work();
+        result.calls++;
+        result.totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    } while (result.totalMs < minMs);
+    return result;
+}
+
+void bench_grid(const Options& options, int sceneNr, GridSize grid, std::vector<StageResult>& results)
+{
+    size_t first = results.size();
+    SimulationParameters params;
+    params.sceneNr = sceneNr;
+    params.resolution = grid.numY;
+    setup_scene(params);
+    Fluid& f = *params.fluid;
+    float dt = static_cast<float>(params.dt);
+    float gravity = static_cast<float>(params.gravity);
+    int numIters = options.numIters > 0 ? options.numIters : params.numIters;
+    double cells = f.numCells;
+    double border = 2.0 * (f.numX + f.numY);
+
+    // Bytes per call assume each field is streamed through memory once per
+    // sweep; neighbouring rows are taken to hit in cache.
+    struct Stage {
+        const char* name;
+        double cells;
+        double bytes;
+        std::function<void()> work;
+    };
+    std::vector<Stage> stages{
+        {"integrate", cells, cells * 4 * sizeof(float), [&] { f.integrate(dt, gravity); }},
+        // per iteration: read s, u, v, p; write u, v, p
+        {"solve", cells * numIters, cells * numIters * 7 * sizeof(float), [&] { f.solve_incompressibility(numIters, dt); }},
+        {"extrapolate", border, border * 4 * sizeof(float), [&] { f.extrapolate(); }},
+        // read u, v, s; write newU, newV; copy them back
+        {"advect_vel", cells, cells * 9 * sizeof(float), [&] { f.advect_vel(dt); }},
+        // read u, v, s, m; write newM; copy it back
+        {"advect_smoke", cells, cells * 7 * sizeof(float), [&] { f.advect_smoke(dt); }},
+    };
+
+    for (Stage& stage : stages)
+    {
+        if (wanted(options, stage.name))
+        {
+            StageResult result = time_stage(stage.name, options.minMs, stage.work);
+            result.cellsPerCall = stage.cells;
+            result.bytesPerCall = stage.bytes;
+            results.push_back(result);
+        }
+    }
+
+    if (wanted(options, "set_obstacle"))
+    {
+        // Drags the obstacle back and forth so every call redraws its box.
+        int call{0};
+        double boxCells{0.0};
+        StageResult result = time_stage("set_obstacle", options.minMs, [&] {
+            float x = 0.3f + 0.1f * (call++ % 2);
+            set_obstacle(params, x, 0.5f, false);
+            boxCells += (params.obstacleBox[1] - params.obstacleBox[0] + 1.0) * (params.obstacleBox[3] - params.obstacleBox[2] + 1.0);
+        });
+        // write s, u, v and m over the box, reading the base mask
+        result.cellsPerCall = boxCells / result.calls;
+        result.bytesPerCall = result.cellsPerCall * 5 * sizeof(float);
+        results.push_back(result);
+    }
+
+    if (wanted(options, "colour"))
+    {
+        ColourOptions colours;
+        colours.showPressure = params.showPressure;
+        colours.showSmoke = params.showSmoke;
+        colours.smokeInColour = sceneNr == 2;
+        std::vector<Rgba8> pixels(f.numCells);
+        StageResult result = time_stage("colour", options.minMs, [&] { colour_fluid(f, colours, pixels.data()); });
+        result.cellsPerCall = cells;
+        result.bytesPerCall = cells * (sizeof(float) + sizeof(Rgba8));
+        results.push_back(result);
+    }
+
+    for (size_t k{first}; k < results.size(); ++k)
+    {
+        results[k].sceneNr = sceneNr;
+        results[k].numX = grid.numX;
+        results[k].numY = grid.numY;
+    }
+    delete params.fluid;
+}
+
+void write_json(std::ostream& out, const std::vector<StageResult>& results)
+{
+#ifdef NDEBUG
+    const char* build = "release";
+#else
+    const char* build = "debug";
+#endif
+    out << "{\n  \"build\": \"" << build << "\",\n  \"results\": [\n";
+    for (size_t k{0}; k < results.size(); ++k)
+    {
+        const StageResult& r = results[k];
+        double seconds = r.totalMs / 1000.0;
+        out << "    {\"scene\": \"" << sceneNames[r.sceneNr] << "\", \"numX\": " << r.numX << ", \"numY\": " << r.numY
+            << ", \"stage\": \"" << r.stage << "\", \"calls\": " << r.calls
+            << ", \"msPerCall\": " << r.totalMs / r.calls
+            << ", \"cellsPerSecond\": " << r.cellsPerCall * r.calls / seconds
+            << ", \"bytesPerSecond\": " << r.bytesPerCall * r.calls / seconds << "}"
+            << (k + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+#ifndef NDEBUG
+    std::cerr << "warning: built without NDEBUG; configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers\n";
+#endif
+
+    std::vector<StageResult> results;
+    std::printf("%-10s %11s %-13s %7s %12s %14s %10s\n", "scene", "grid", "stage", "calls", "ms/call", "cells/s", "GB/s");
+    for (int sceneNr : options.scenes)
+    {
+        for (GridSize grid : options.sizes)
+        {
+            size_t first = results.size();
+            bench_grid(options, sceneNr, grid, results);
+            for (size_t k{first}; k < results.size(); ++k)
+            {
+                const StageResult& r = results[k];
+                double seconds = r.totalMs / 1000.0;
+                std::printf("%-10s %5dx%-5d %-13s %7d %12.4f %14.4g %10.3f\n", sceneNames[sceneNr], r.numX, r.numY,
+                            r.stage.c_str(), r.calls, r.totalMs / r.calls, r.cellsPerCall * r.calls / seconds,
+                            r.bytesPerCall * r.calls / seconds / 1e9);
+            }
+            std::fflush(stdout);
+        }
+    }
+
+    if (!options.jsonPath.empty())
+    {
+        std::ofstream json(options.jsonPath);
+        write_json(json, results);
+        if (!json)
+        {
+            std::cerr << "cannot write " << options.jsonPath << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+
+uint64_t align_up(uint64_t value)
+{
+    return (value + checkpointAlignment - 1) / checkpointAlignment * checkpointAlignment;
+}
+
+const std::vector<float>& field_of(const SimulationParameters& params, const std::vector<float>& shapes, int field)
+{
+    const Fluid& f = *params.fluid;
+    switch (field)
+    {
+        case CHECKPOINT_U: return f.u;
+        case CHECKPOINT_V: return f.v;
+        case CHECKPOINT_P: return f.p;
+        case CHECKPOINT_S: return f.s;
+        case CHECKPOINT_M: return f.m;
+        case CHECKPOINT_BASE_SOLID: return params.baseSolid;
+        default: return shapes;
+    }
+}
+
+}
+
+bool write_checkpoint(const std::string& path, const SimulationParameters& params, std::string& error)
+{
+    const Fluid* f = params.fluid;
+    if (f == nullptr)
+    {
+        error = "no simulation to checkpoint";
+        return false;
+    }
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = checkpointVersion;
+    header.numFields = checkpointNumFields;
+    header.numX = f->numX;
+    header.numY = f->numY;
+    header.h = f->h;
+    header.density = f->density;
+    header.frameNr = params.frameNr;
+    header.overRelaxation = static_cast<float>(params.overRelaxation);
+    header.gravity = params.gravity;
+    header.dt = params.dt;
+    header.numIters = params.numIters;
+    header.sceneNr = params.sceneNr;
+    header.shape = params.shape;
+    header.obstacleX = params.obstacleX;
+    header.obstacleY = params.obstacleY;
+    header.obstacleRadius = params.obstacleRadius;
+    header.smoothObstacles = params.smoothObstacles;
+    std::copy(params.obstacleBox, params.obstacleBox + 4, header.obstacleBox);
+    header.obstacleBoxValid = params.obstacleBoxValid;
+
+    if (params.customShapes.size() > static_cast<size_t>(checkpointMaxShapes))
+    {
+        error = "cannot checkpoint more than " + std::to_string(checkpointMaxShapes) + " custom shapes";
+        return false;
+    }
+    std::vector<float> shapes;
+    for (const ShapeSdf& shape : params.customShapes)
+    {
+        const std::vector<float>& vertices = shape.polygon_vertices();
+        if (vertices.empty())
+        {
+            error = "cannot checkpoint a custom shape that is not a polygon";
+            return false;
+        }
+        header.shapeVertices[header.numShapes++] = static_cast<uint32_t>(vertices.size());
+        shapes.insert(shapes.end(), vertices.begin(), vertices.end());
+    }
+
+    static const char zeros[checkpointAlignment]{};
+    iovec parts[2 * checkpointNumFields + 2];
+    int numParts{0};
+    uint64_t offset = align_up(sizeof(header));
+
+    parts[numParts++] = {&header, sizeof(header)};
+    parts[numParts++] = {const_cast<char*>(zeros), offset - sizeof(header)};
+
+    for (int k{0}; k < checkpointNumFields; ++k)
+    {
+        const std::vector<float>& data = field_of(params, shapes, k);
+        uint64_t bytes = data.size() * sizeof(float);
+        header.fieldOffset[k] = offset;
+        header.fieldBytes[k] = bytes;
+        parts[numParts++] = {const_cast<float*>(data.data()), bytes};
+
+        uint64_t padding = align_up(bytes) - bytes;
+        if (padding > 0 && k + 1 < checkpointNumFields)
+        {
+            parts[numParts++] = {const_cast<char*>(zeros), padding};
+        }
+        offset += align_up(bytes);
+    }
+
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        error = "cannot create " + temporary + ": " + std::strerror(errno);
+        return false;
+    }
+
+    // One writev() for the whole file. A short write only advances the iovec
+    // array and carries on from there.
+    iovec* next = parts;
+    ssize_t written{0};
+    while (numParts > 0)
+    {
+        written = writev(fd, next, numParts);
+        if (written < 0)
+        {
+            break;
+        }
+        while (numParts > 0 && static_cast<size_t>(written) >= next->iov_len)
+        {
+            written -= next->iov_len;
+            ++next;
+            --numParts;
+        }
+        if (numParts > 0)
+        {
+            next->iov_base = static_cast<char*>(next->iov_base) + written;
+            next->iov_len -= written;
+        }
+    }
+
+    bool closed = ::close(fd) == 0;
+    if (written < 0 || !closed)
+    {
+        error = "cannot write " + temporary + ": " + std::strerror(errno);
+        ::unlink(temporary.c_str());
+        return false;
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        error = "cannot rename " + temporary + " to " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+CheckpointView::~CheckpointView()
+{
+    close();
+}
+
+bool CheckpointView::open(const std::string& path, std::string& error)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(CheckpointHeader))
+    {
+        ::close(fd);
+        error = path + " is too small to be a checkpoint";
+        return false;
+    }
+
+    // Not populated: restore faults each field page in on the worker that
+    // copies that row block, so the file is read once, in parallel.
+    void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+        error = "cannot map " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    mapping = memory;
+    mappedBytes = info.st_size;
+    const CheckpointHeader& h = header();
+
+    if (std::memcmp(h.magic, checkpointMagic, sizeof(h.magic)) != 0)
+    {
+        error = path + " is not a checkpoint";
+    }
+    else if (h.version != checkpointVersion || h.numFields != checkpointNumFields)
+    {
+        error = path + " has unsupported checkpoint version " + std::to_string(h.version);
+    }
+    else if (h.numX < 3 || h.numY < 3)
+    {
+        error = path + " has an invalid grid size";
+    }
+    else if (h.numShapes > static_cast<uint32_t>(checkpointMaxShapes))
+    {
+        error = path + " has a corrupt shape table";
+    }
+    else
+    {
+        uint64_t cellBytes = static_cast<uint64_t>(h.numX) * h.numY * sizeof(float);
+        uint64_t shapeBytes{0};
+        for (uint32_t k{0}; k < h.numShapes; ++k)
+        {
+            shapeBytes += h.shapeVertices[k] * sizeof(float);
+        }
+        bool valid{true};
+        for (int k{0}; k < checkpointNumFields; ++k)
+        {
+            uint64_t bytes = h.fieldBytes[k];
+            bool sized = k == CHECKPOINT_SHAPES ? bytes == shapeBytes
+                         : k == CHECKPOINT_BASE_SOLID ? bytes == 0 || bytes == cellBytes
+                         : bytes == cellBytes;
+            valid = valid && sized && h.fieldOffset[k] + bytes <= mappedBytes;
+        }
+        if (valid)
+        {
+            return true;
+        }
+        error = path + " is truncated or has a corrupt field table";
+    }
+
+    close();
+    return false;
+}
+
+void CheckpointView::close()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappedBytes);
+        mapping = nullptr;
+        mappedBytes = 0;
+    }
+}
+
+const CheckpointHeader& CheckpointView::header() const
+{
+    return *static_cast<const CheckpointHeader*>(mapping);
+}
+
+const float* CheckpointView::field(CheckpointField field) const
+{
+    return reinterpret_cast<const float*>(static_cast<const char*>(mapping) + header().fieldOffset[field]);
+}
+
+bool restore_checkpoint(const std::string& path, SimulationParameters& params, TaskScheduler* scheduler, std::string& error)
+{
+    CheckpointView view;
+    if (!view.open(path, error))
+    {
+        return false;
+    }
+
+    const CheckpointHeader& h = view.header();
+    delete params.fluid;
+    params.fluid = new Fluid(h.density, h.numX - 2, h.numY - 2, h.h);
+    params.fluid->scheduler = scheduler;
+
+    params.fluid->distribute_pages(view.field(CHECKPOINT_U), view.field(CHECKPOINT_V), view.field(CHECKPOINT_P),
+                                   view.field(CHECKPOINT_S), view.field(CHECKPOINT_M));
+
+    const float* baseSolid = view.field(CHECKPOINT_BASE_SOLID);
+    params.baseSolid.assign(baseSolid, baseSolid + h.fieldBytes[CHECKPOINT_BASE_SOLID] / sizeof(float));
+    params.customShapes.clear();
+    const float* vertices = view.field(CHECKPOINT_SHAPES);
+    for (uint32_t k{0}; k < h.numShapes; ++k)
+    {
+        params.customShapes.push_back(ShapeSdf::polygon(std::vector<float>(vertices, vertices + h.shapeVertices[k])).precomputed());
+        vertices += h.shapeVertices[k];
+    }
+    params.smoothObstacles = h.smoothObstacles != 0;
+    std::copy(h.obstacleBox, h.obstacleBox + 4, params.obstacleBox);
+    params.obstacleBoxValid = h.obstacleBoxValid != 0;
+
+    params.frameNr = h.frameNr;
+    params.overRelaxation = h.overRelaxation;
+    params.gravity = h.gravity;
+    params.dt = h.dt;
+    params.numIters = h.numIters;
+    params.sceneNr = h.sceneNr;
+    params.shape = h.shape;
+    params.obstacleX = h.obstacleX;
+    params.obstacleY = h.obstacleY;
+    params.obstacleRadius = h.obstacleRadius;
+    params.showObstacle = h.sceneNr != 0;
+    return true;
+}
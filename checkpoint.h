@@ -0,0 +1,92 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "scene.h"
+
+// Binary checkpoint layout, version 2:
+//   CheckpointHeader, zero padded to checkpointAlignment bytes
+//   u, v, p, s, m as raw little-endian floats, each block starting on a
+//   checkpointAlignment boundary
+//   baseSolid, the solid mask without the draggable obstacle; empty when the
+//   scene has none
+//   the vertices of every custom obstacle shape, one after the other
+// numX and numY are the padded sizes held by Fluid. Alignment is one page so
+// every field block can be used straight out of a mapping.
+constexpr char checkpointMagic[8]{'E', 'F', 'S', 'C', 'K', 'P', 'T', '\0'};
+constexpr uint32_t checkpointVersion{2};
+constexpr uint64_t checkpointAlignment{4096};
+constexpr int checkpointNumFields{7};
+constexpr int checkpointMaxShapes{8};
+
+enum CheckpointField {
+    CHECKPOINT_U,
+    CHECKPOINT_V,
+    CHECKPOINT_P,
+    CHECKPOINT_S,
+    CHECKPOINT_M,
+    CHECKPOINT_BASE_SOLID,
+    CHECKPOINT_SHAPES
+};
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numFields;
+    int32_t numX;
+    int32_t numY;
+    float h;
+    float density;
+    int32_t frameNr;
+    float overRelaxation;
+    double gravity;
+    double dt;
+    int32_t numIters;
+    int32_t sceneNr;
+    int32_t shape;
+    int32_t smoothObstacles;
+    double obstacleX;
+    double obstacleY;
+    double obstacleRadius;
+    int32_t obstacleBox[4];
+    int32_t obstacleBoxValid;
+    uint32_t numShapes;
+    uint32_t shapeVertices[checkpointMaxShapes]; // floats per custom shape
+    uint64_t fieldOffset[checkpointNumFields];
+    uint64_t fieldBytes[checkpointNumFields];
+};
+
+// Writes params.fluid and the scene state with one writev() call.
+bool write_checkpoint(const std::string& path, const SimulationParameters& params, std::string& error);
+
+// Read-only mapping of a checkpoint. The field pointers point into the mapped
+// file, so inspecting a checkpoint costs no copies.
+class CheckpointView
+{
+public:
+    CheckpointView() = default;
+    ~CheckpointView();
+
+    CheckpointView(const CheckpointView&) = delete;
+    CheckpointView& operator=(const CheckpointView&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    void close();
+
+    const CheckpointHeader& header() const;
+    const float* field(CheckpointField field) const;
+
+private:
+    void* mapping{nullptr};
+    size_t mappedBytes{0};
+};
+
+// Replaces params.fluid and the obstacle state with the checkpointed ones, so
+// the draggable obstacle moves over the same static obstacles afterwards.
+// params.obstacles is left to its owner. Fluid keeps its fields in
+// std::vector, so they cannot be adopted in place; with a scheduler each row
+// block is copied out of the mapping by the worker that owns it, which is the
+// only pass over the file.
+bool restore_checkpoint(const std::string& path, SimulationParameters& params, TaskScheduler* scheduler, std::string& error);
+#endif // CHECKPOINT_H
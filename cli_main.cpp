@@ -0,0 +1,405 @@
+#include "checkpoint.h"
+#include "frame_recorder.h"
+#include "image_sequence.h"
+#include "input_log.h"
+#include "quality_governor.h"
+#include "shm_frame_ring.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "task_scheduler.h"
+#include "trace_events.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace
+{
+
+struct Options {
+    int sceneNr{1};
+    int steps{1000};
+    int threads{static_cast<int>(std::thread::hardware_concurrency())};
+    int resolution{0};
+    int numIters{0};
+    int shape{0};
+    double obstacleRadius{0.085};
+    bool smoothObstacles{false};
+    int rotorBlades{0};
+    double targetStepMs{0.0};
+    bool pinThreads{false};
+    bool numaReport{false};
+    std::string restartPath;
+    std::string checkpointPath;
+    std::string recordPath;
+    int recordInterval{1};
+    std::string exportPrefix;
+    std::string timingsPath;
+    std::string tracePath;
+    std::string perfPath;
+    int exportInterval{1};
+    std::string publishName;
+    std::string sceneFile;
+    std::string sceneCache{default_scene_cache_dir()};
+    std::string replayPath;
+};
+
+void print_usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [--scene tank|windtunnel|paint] [--steps N] [--threads N]\n"
+              << "       [--res N] [--iters N] [--shape circle|square|triangle|oval] [--radius R]\n"
+              << "       [--smooth-obstacles] [--rotor BLADES] [--target-step-ms MS]\n"
+              << "       [--pin-threads] [--numa-report] [--restart FILE] [--checkpoint-out FILE]\n"
+              << "       [--record FILE] [--record-every N] [--publish /SHM_NAME]\n"
+              << "       [--export PREFIX] [--export-every N] [--timings-csv FILE] [--trace FILE]\n"
+              << "       [--perf-csv FILE] [--scene-file FILE] [--scene-cache DIR|none] [--replay INPUT_LOG]\n";
+}
+
+int index_of(const char* value, std::initializer_list<const char*> names)
+{
+    int index{0};
+    for (const char* name : names)
+    {
+        if (std::strcmp(value, name) == 0)
+        {
+            return index;
+        }
+        index++;
+    }
+    return -1;
+}
+
+// A ring of small circular blades a third of the way down the tunnel; every
+// blade moves every step, which exercises params.obstacles.
+constexpr float rotorX{0.6f};
+constexpr float rotorY{0.5f};
+constexpr float rotorRadius{0.2f};
+constexpr float rotorSpeed{3.0f}; // rad/s
+
+void add_rotor(SimulationParameters& params, int blades)
+{
+    int circle = blades > 0 ? params.obstacles.add_shape(ShapeSdf::circle()) : 0;
+    for (int k{0}; k < blades; ++k)
+    {
+        float angle = 2.0f * M_PI * k / blades;
+        params.obstacles.add(circle, rotorX + rotorRadius * std::cos(angle), rotorY + rotorRadius * std::sin(angle), 0.03f);
+    }
+}
+
+void turn_rotor(SimulationParameters& params, int blades)
+{
+    if (blades == 0)
+    {
+        return;
+    }
+    float turn = rotorSpeed * params.dt * (params.frameNr + 1);
+    for (int k{0}; k < blades; ++k)
+    {
+        float angle = 2.0f * M_PI * k / blades + turn;
+        params.obstacles.move(k, rotorX + rotorRadius * std::cos(angle), rotorY + rotorRadius * std::sin(angle), params.dt);
+    }
+    update_obstacles(params);
+}
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int k{1}; k < argc; ++k)
+    {
+        bool hasValue = k + 1 < argc;
+        if (std::strcmp(argv[k], "--scene") == 0 && hasValue) { options.sceneNr = index_of(argv[++k], {"tank", "windtunnel", "paint"}); }
+        else if (std::strcmp(argv[k], "--steps") == 0 && hasValue) { options.steps = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--threads") == 0 && hasValue) { options.threads = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--res") == 0 && hasValue) { options.resolution = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--iters") == 0 && hasValue) { options.numIters = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--shape") == 0 && hasValue) { options.shape = index_of(argv[++k], {"circle", "square", "triangle", "oval"}); }
+        else if (std::strcmp(argv[k], "--radius") == 0 && hasValue) { options.obstacleRadius = std::atof(argv[++k]); }
+        else if (std::strcmp(argv[k], "--smooth-obstacles") == 0) { options.smoothObstacles = true; }
+        else if (std::strcmp(argv[k], "--rotor") == 0 && hasValue) { options.rotorBlades = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--target-step-ms") == 0 && hasValue) { options.targetStepMs = std::atof(argv[++k]); }
+        else if (std::strcmp(argv[k], "--pin-threads") == 0) { options.pinThreads = true; }
+        else if (std::strcmp(argv[k], "--numa-report") == 0) { options.numaReport = true; }
+        else if (std::strcmp(argv[k], "--restart") == 0 && hasValue) { options.restartPath = argv[++k]; }
+        else if (std::strcmp(argv[k], "--checkpoint-out") == 0 && hasValue) { options.checkpointPath = argv[++k]; }
+        else if (std::strcmp(argv[k], "--record") == 0 && hasValue) { options.recordPath = argv[++k]; }
+        else if (std::strcmp(argv[k], "--record-every") == 0 && hasValue) { options.recordInterval = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--export") == 0 && hasValue) { options.exportPrefix = argv[++k]; }
+        else if (std::strcmp(argv[k], "--export-every") == 0 && hasValue) { options.exportInterval = std::max(1, std::atoi(argv[++k])); }
+        else if (std::strcmp(argv[k], "--trace") == 0 && hasValue) { options.tracePath = argv[++k]; }
+        else if (std::strcmp(argv[k], "--timings-csv") == 0 && hasValue) { options.timingsPath = argv[++k]; }
+        else if (std::strcmp(argv[k], "--perf-csv") == 0 && hasValue) { options.perfPath = argv[++k]; }
+        else if (std::strcmp(argv[k], "--publish") == 0 && hasValue) { options.publishName = argv[++k]; }
+        else if (std::strcmp(argv[k], "--scene-file") == 0 && hasValue) { options.sceneFile = argv[++k]; }
+        else if (std::strcmp(argv[k], "--scene-cache") == 0 && hasValue) { options.sceneCache = argv[++k]; }
+        else if (std::strcmp(argv[k], "--replay") == 0 && hasValue) { options.replayPath = argv[++k]; }
+        else
+        {
+            return false;
+        }
+    }
+    return options.sceneNr >= 0 && options.shape >= 0 && options.steps >= 0;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    TaskScheduler scheduler(options.threads);
+    if (options.pinThreads && !scheduler.pin_threads())
+    {
+        std::cerr << "could not pin all solver threads\n";
+    }
+
+    SimulationParameters params;
+    std::string error;
+    InputReplay replay;
+    bool replaying = !options.replayPath.empty();
+    if (replaying)
+    {
+        // The log's leading commands build the scene; --steps is taken from its end.
+        if (!replay.load(options.replayPath, error) || (!replay.apply_due(params, &scheduler, error) && !error.empty()))
+        {
+            std::cerr << error << "\n";
+            delete params.fluid;
+            return 1;
+        }
+        if (params.fluid == nullptr)
+        {
+            std::cerr << options.replayPath << ": the log builds no scene\n";
+            return 1;
+        }
+    }
+    else if (!options.restartPath.empty())
+    {
+        if (!restore_checkpoint(options.restartPath, params, &scheduler, error))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+    else if (!options.sceneFile.empty())
+    {
+        bool fromCache{false};
+        std::string cacheDir = options.sceneCache == "none" ? "" : options.sceneCache;
+        params.resolution = options.resolution;
+        auto start = std::chrono::steady_clock::now();
+        if (!load_scene_file(options.sceneFile, params, &scheduler, cacheDir, error, &fromCache))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        double sceneMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "scene=" << options.sceneFile << " sceneMs=" << sceneMs << " cached=" << fromCache << "\n";
+    }
+    else
+    {
+        params.sceneNr = options.sceneNr;
+        params.shape = options.shape;
+        params.obstacleRadius = options.obstacleRadius;
+        params.smoothObstacles = options.smoothObstacles;
+        params.resolution = options.resolution;
+        setup_scene(params, &scheduler);
+
+        // The paint scene only opens up its interior once an obstacle is placed,
+        // which the GUI leaves to the first mouse drag.
+        if (params.sceneNr == 2)
+        {
+            set_obstacle(params, 1.0, 0.5, true);
+        }
+    }
+    add_rotor(params, options.rotorBlades);
+    if (options.numIters > 0)
+    {
+        params.numIters = options.numIters;
+    }
+    if (options.numaReport)
+    {
+        std::cerr << params.fluid->placement_report();
+    }
+
+    FrameRecorder recorder;
+    if (!options.recordPath.empty() && !recorder.open(options.recordPath, options.recordInterval, error))
+    {
+        std::cerr << error << "\n";
+        delete params.fluid;
+        return 1;
+    }
+
+    ShmFramePublisher publisher;
+    if (!options.publishName.empty() && !publisher.open(options.publishName, params.fluid->numCells, 4, error))
+    {
+        std::cerr << error << "\n";
+        delete params.fluid;
+        return 1;
+    }
+
+    ImageSequenceWriter exporter;
+    if (!options.exportPrefix.empty() && !exporter.open(options.exportPrefix, "ppm", write_ppm, error))
+    {
+        std::cerr << error << "\n";
+        delete params.fluid;
+        return 1;
+    }
+    ColourOptions colours;
+    colours.showPressure = params.showPressure;
+    colours.showSmoke = params.showSmoke;
+    colours.smokeInColour = params.sceneNr == 2;
+
+    // A replay has to reproduce the recorded run, so it is never governed.
+    bool governed = options.targetStepMs > 0.0 && !replaying;
+    QualitySettings quality;
+    quality.targetStepMs = options.targetStepMs;
+    QualityGovernor governor(quality);
+
+    trace_recorder().set_thread_name("main");
+    if (!options.tracePath.empty() && !trace_recorder().start(options.tracePath, error))
+    {
+        std::cerr << error << "\n";
+        delete params.fluid;
+        return 1;
+    }
+
+    // Counters are a diagnostic: without them the run goes ahead untouched.
+    bool counting{false};
+    if (!options.perfPath.empty())
+    {
+        if (!stageTimersEnabled)
+        {
+            std::cerr << "perf counters unavailable: built without FLUID_ENABLE_TIMERS\n";
+        }
+        else
+        {
+            counting = perf_counters().enable(error);
+            if (!counting)
+            {
+                std::cerr << "perf counters unavailable: " << error << "\n";
+            }
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int steps{0};
+    for (; replaying ? !replay.finished() : steps < options.steps; ++steps)
+    {
+        turn_rotor(params, options.rotorBlades);
+        auto stepStart = std::chrono::steady_clock::now();
+        simulate_step(params);
+        if (governed)
+        {
+            double stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stepStart).count();
+            if (governor.observe(stepMs, params))
+            {
+                std::cout << "quality: " << governor.last_decision().describe() << "\n";
+            }
+        }
+        recorder.record(*params.fluid, params.frameNr);
+        if (exporter.is_open() && params.frameNr % options.exportInterval == 0)
+        {
+            ImageFrame* frame = exporter.acquire();
+            grid_image(*params.fluid, colours, params.frameNr, *frame);
+            exporter.submit(frame);
+        }
+        publisher.publish(*params.fluid, params.frameNr);
+        if (replaying && !replay.apply_due(params, &scheduler, error) && !error.empty())
+        {
+            std::cerr << error << "\n";
+            delete params.fluid;
+            return 1;
+        }
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (trace_recorder().active())
+    {
+        trace_recorder().stop();
+        std::cout << "traceEvents=" << trace_recorder().events_written() << " traceDropped=" << trace_recorder().events_dropped() << "\n";
+    }
+
+    Fluid* f = params.fluid;
+    double cellsPerSecond = wallMs > 0.0 ? 1000.0 * f->numCells * steps / wallMs : 0.0;
+    std::cout << "grid=" << f->numX << "x" << f->numY << " threads=" << scheduler.num_threads()
+              << " steps=" << steps << " wallMs=" << wallMs
+              << " msPerStep=" << (steps > 0 ? wallMs / steps : 0.0)
+              << " cellsPerSecond=" << cellsPerSecond << "\n";
+    const FieldStats& stats = f->field_stats();
+    if (stats.valid)
+    {
+        std::cout << "minP=" << stats.p.min << " maxP=" << stats.p.max << " maxSpeed=" << stats.maxSpeed
+                  << " smoke=" << stats.m.sum << " maxDivergence=" << stats.maxDivergence << "\n";
+    }
+    if (governed)
+    {
+        int resolution = governor.next_resolution(f->numY - 2, params.frameNr);
+        std::cout << "numIters=" << params.numIters << " suggestedRes=" << resolution << "\n";
+    }
+
+    int status{0};
+    if (!options.timingsPath.empty())
+    {
+        std::ofstream timings(options.timingsPath);
+        stage_timers().write_csv(timings);
+        if (!timings)
+        {
+            std::cerr << "cannot write " << options.timingsPath << "\n";
+            status = 1;
+        }
+    }
+
+    if (counting)
+    {
+        perf_counters().disable();
+        std::ofstream counters(options.perfPath);
+        stage_timers().write_counters_csv(counters);
+        if (!counters)
+        {
+            std::cerr << "cannot write " << options.perfPath << "\n";
+            status = 1;
+        }
+    }
+
+    if (exporter.is_open())
+    {
+        if (!exporter.close(error))
+        {
+            std::cerr << error << "\n";
+            status = 1;
+        }
+        std::cout << "framesExported=" << exporter.frames_written() << " exportStalls=" << exporter.stalls() << "\n";
+    }
+
+    if (replaying)
+    {
+        uint64_t hash = state_hash(*f);
+        bool match = !replay.has_expected_hash() || hash == replay.expected_hash();
+        std::cout << std::hex << "hash=" << hash << " expected=" << replay.expected_hash() << std::dec
+                  << " match=" << (match ? "yes" : "no") << "\n";
+        status = match ? status : 3;
+    }
+
+    if (recorder.is_open())
+    {
+        recorder.close();
+        std::cout << "framesRecorded=" << recorder.frames_written() << " framesDropped=" << recorder.frames_dropped()
+                  << " bytes=" << recorder.bytes_written() << "\n";
+    }
+
+    if (!options.checkpointPath.empty() && !write_checkpoint(options.checkpointPath, params, error))
+    {
+        std::cerr << error << "\n";
+        delete params.fluid;
+        return 1;
+    }
+
+    delete params.fluid;
+    return status;
+}
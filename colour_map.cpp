@@ -0,0 +1,127 @@
+#include "colour_map.h"
+#include <algorithm>
+#include <cstring>
+
+Rgba8 pack_rgba8(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    const uint8_t bytes[4]{r, g, b, a};
+    Rgba8 pixel;
+    std::memcpy(&pixel, bytes, sizeof(pixel));
+    return pixel;
+}
+
+ColourMap::ColourMap()
+{
+    for (int k{0}; k < lutSize; ++k)
+    {
+        // Entry k covers [k, k + 1) / lutSize; sample its centre.
+        double val = (k + 0.5) / lutSize;
+        double m{0.25};
+        int num{static_cast<int>(val / m)};
+        double s{(val - num * m) / m};
+        double r{0.0};
+        double g{0.0};
+        double b{0.0};
+
+        switch (num) {
+            case 0: r = 0.0; g = s; b = 1.0; break;
+            case 1: r = 0.0; g = 1.0; b = 1.0 - s; break;
+            case 2: r = s; g = 1.0; b = 0.0; break;
+            default: r = 1.0; g = 1.0 - s; b = 0.0; break;
+        }
+        lut[k] = pack_rgba8(static_cast<uint8_t>(255 * r + 0.5), static_cast<uint8_t>(255 * g + 0.5), static_cast<uint8_t>(255 * b + 0.5));
+    }
+}
+
+Rgba8 ColourMap::colour(float val, float minVal, float maxVal) const
+{
+    Rgba8 pixel;
+    apply(&val, 1, minVal, maxVal, &pixel);
+    return pixel;
+}
+
+void ColourMap::apply(const float* values, size_t count, float minVal, float maxVal, Rgba8* out) const
+{
+    float d = maxVal - minVal;
+    float scale = d > 0.0f ? lutSize / d : 0.0f;
+    float offset = d > 0.0f ? -minVal * scale : 0.5f * lutSize;
+    constexpr float last = lutSize - 1;
+
+    // Kept branch-free so the scale and clamp vectorise; only the table
+    // load is a gather. The argument order sends NaN to entry 0.
+    for (size_t k{0}; k < count; ++k)
+    {
+        float t = std::min(last, std::max(0.0f, values[k] * scale + offset));
+        out[k] = lut[static_cast<int>(t)];
+    }
+}
+
+const ColourMap& sci_colour_map()
+{
+    static const ColourMap map;
+    return map;
+}
+
+void colour_fluid(const Fluid& f, const ColourOptions& options, std::vector<Rgba8>& rgba)
+{
+    rgba.resize(f.numCells);
+    colour_fluid(f, options, rgba.data());
+}
+
+void colour_fluid(const Fluid& f, const ColourOptions& options, Rgba8* out)
+{
+    ScopedStageTimer timer(STAGE_COLOUR);
+    size_t numCells = f.numCells;
+    const float* m = f.m.data();
+
+    if (options.showPressure)
+    {
+        // The solver's step statistics already hold the range; scan only for
+        // fields it has not stepped yet.
+        const FieldStats& stats = f.field_stats();
+        float minP = stats.p.min;
+        float maxP = stats.p.max;
+        if (!stats.valid)
+        {
+            auto range = std::minmax_element(f.p.begin(), f.p.end());
+            minP = *range.first;
+            maxP = *range.second;
+        }
+        sci_colour_map().apply(f.p.data(), numCells, minP, maxP, out);
+        if (options.showSmoke)
+        {
+            // Smoke darkens the pressure colours.
+            uint8_t* bytes = reinterpret_cast<uint8_t*>(out);
+            for (size_t k{0}; k < numCells; ++k)
+            {
+                int dark = static_cast<int>(255.0f * m[k]);
+                for (int c{0}; c < 3; ++c)
+                {
+                    bytes[4 * k + c] = static_cast<uint8_t>(std::max(0, bytes[4 * k + c] - dark));
+                }
+            }
+        }
+    }
+    else if (options.showSmoke && options.smokeInColour)
+    {
+        sci_colour_map().apply(m, numCells, 0.0f, 1.0f, out);
+    }
+    else if (options.showSmoke)
+    {
+        for (size_t k{0}; k < numCells; ++k)
+        {
+            uint8_t grey = static_cast<uint8_t>(255.0f * std::min(1.0f, std::max(0.0f, m[k])));
+            out[k] = pack_rgba8(grey, grey, grey);
+        }
+    }
+    else
+    {
+        const Rgba8 white = pack_rgba8(255, 255, 255);
+        const Rgba8 black = pack_rgba8(0, 0, 0);
+        const float* s = f.s.data();
+        for (size_t k{0}; k < numCells; ++k)
+        {
+            out[k] = s[k] == 0.0f ? black : white;
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef COLOUR_MAP_H
+#define COLOUR_MAP_H
+#include <cstdint>
+#include <vector>
+#include "fluid.h"
+
+// RGBA8 pixels packed into uint32_t in memory order R, G, B, A, so a buffer of
+// them uploads as GL_RGBA / GL_UNSIGNED_BYTE.
+using Rgba8 = uint32_t;
+
+Rgba8 pack_rgba8(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255);
+
+// The blue-cyan-green-yellow-red scientific colour map, sampled once into a
+// lookup table so that colouring a cell is a scale, a clamp and a load.
+class ColourMap
+{
+public:
+    static constexpr int lutSize{4096};
+
+    ColourMap();
+
+    // Colour of val within [minVal, maxVal]; the midpoint for an empty range.
+    Rgba8 colour(float val, float minVal, float maxVal) const;
+    // Maps count values to pixels in one pass.
+    void apply(const float* values, size_t count, float minVal, float maxVal, Rgba8* out) const;
+
+private:
+    Rgba8 lut[lutSize];
+};
+
+const ColourMap& sci_colour_map();
+
+// What the grid view shows, in the GUI's order of precedence.
+struct ColourOptions {
+    bool showPressure{false};
+    bool showSmoke{true};
+    bool smokeInColour{false}; // the paint scene maps smoke through the colour map
+};
+
+// Colours every cell of f into rgba, which holds numCells pixels (a mapped
+// pixel buffer, say). The pixels follow the field layout, cell (i, j) at
+// i * numY + j, so they upload as a texture numY texels wide and numX high.
+void colour_fluid(const Fluid& f, const ColourOptions& options, Rgba8* rgba);
+// Same, resizing rgba to fit.
+void colour_fluid(const Fluid& f, const ColourOptions& options, std::vector<Rgba8>& rgba);
+#endif // COLOUR_MAP_H
@@ -0,0 +1,246 @@
+#include "distributed_fluid.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+int slab_begin(int rank, int size, int globalNumX)
+{
+    int base = globalNumX / size;
+    int remainder = globalNumX % size;
+    return rank * base + std::min(rank, remainder);
+}
+
+int local_begin(HaloTransport& t, int globalNumX, int haloWidth)
+{
+    int halo = distributed_halo_width(haloWidth, t.size(), globalNumX);
+    return std::max(slab_begin(t.rank(), t.size(), globalNumX) - halo, 0);
+}
+
+int local_end(HaloTransport& t, int globalNumX, int haloWidth)
+{
+    int halo = distributed_halo_width(haloWidth, t.size(), globalNumX);
+    return std::min(slab_begin(t.rank() + 1, t.size(), globalNumX) + halo, globalNumX);
+}
+
+}
+
+int distributed_halo_width(int haloWidth, int numRanks, int globalNumX)
+{
+    return std::max(1, std::min(haloWidth, globalNumX / numRanks));
+}
+
+DistributedFluid::DistributedFluid(HaloTransport& transport, float density, int numX, int numY, float h, int haloWidth)
+    : local(density, local_end(transport, numX + 2, haloWidth) - local_begin(transport, numX + 2, haloWidth) - 2, numY, h),
+    globalNumX(numX + 2),
+    firstColumn(local_begin(transport, numX + 2, haloWidth)),
+    ownedBegin(slab_begin(transport.rank(), transport.size(), numX + 2)),
+    ownedEnd(slab_begin(transport.rank() + 1, transport.size(), numX + 2)),
+    haloWidth(distributed_halo_width(haloWidth, transport.size(), numX + 2)),
+    transport(transport),
+    faceSnapshot(local.numY, 0.0),
+    faceDelta(local.numY, 0.0)
+{
+}
+
+int DistributedFluid::owned_begin_local() const
+{
+    return ownedBegin - firstColumn;
+}
+
+int DistributedFluid::owned_end_local() const
+{
+    return ownedEnd - firstColumn;
+}
+
+void DistributedFluid::initialise(const std::function<void(Fluid&, int, int)>& init)
+{
+    for (int i{0}; i < local.numX; ++i)
+    {
+        init(local, firstColumn + i, i);
+    }
+}
+
+bool DistributedFluid::exchange_halo(std::vector<float>& field, int width)
+{
+    size_t n = local.numY;
+    int begin = owned_begin_local();
+    int end = owned_end_local();
+    bool hasLeft = transport.rank() > 0;
+    bool hasRight = transport.rank() + 1 < transport.size();
+
+    // Columns are contiguous, so the owned edge columns are sent straight out
+    // of the field and the ghosts are received in place.
+    return transport.exchange(hasLeft ? field.data() + begin * n : nullptr,
+                              hasLeft ? field.data() + (begin - width) * n : nullptr,
+                              hasRight ? field.data() + (end - width) * n : nullptr,
+                              hasRight ? field.data() + end * n : nullptr,
+                              width * n * sizeof(float));
+}
+
+// The last owned cell of a slab also corrects the u face that starts the next
+// slab. That correction is shipped to the owner and added there, so both
+// sides' contributions to a shared face survive the sweep.
+bool DistributedFluid::exchange_interface_faces()
+{
+    size_t n = local.numY;
+    int begin = owned_begin_local();
+    int end = owned_end_local();
+
+    if (transport.rank() + 1 < transport.size())
+    {
+        for (size_t j{0}; j < n; ++j)
+        {
+            faceDelta[j] = local.u[end * n + j] - faceSnapshot[j];
+        }
+        if (!transport.send(transport.rank() + 1, faceDelta.data(), n * sizeof(float)))
+        {
+            return false;
+        }
+    }
+
+    if (transport.rank() > 0)
+    {
+        if (!transport.recv(transport.rank() - 1, faceDelta.data(), n * sizeof(float)))
+        {
+            return false;
+        }
+        for (size_t j{0}; j < n; ++j)
+        {
+            local.u[begin * n + j] += faceDelta[j];
+        }
+    }
+
+    return exchange_halo(local.u, 1);
+}
+
+bool DistributedFluid::solve_incompressibility(size_t numIters, float dt)
+{
+    size_t n = local.numY;
+    float cp = local.density * local.h / dt;
+    int end = owned_end_local();
+    int beginI = std::max(owned_begin_local(), 1);
+    int endI = std::min(end, local.numX - 1);
+    bool hasRight = transport.rank() + 1 < transport.size();
+
+    for (size_t iter{0}; iter < numIters; ++iter)
+    {
+        if (hasRight)
+        {
+            std::copy(local.u.begin() + end * n, local.u.begin() + (end + 1) * n, faceSnapshot.begin());
+        }
+        local.solve_incompressibility_sweep(cp, beginI, endI);
+        if (!exchange_interface_faces())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DistributedFluid::extrapolate()
+{
+    int n = local.numY;
+
+    for (int i{0}; i < local.numX; ++i)
+    {
+        local.extrapolate_horizontal_velocity(i, n);
+    }
+
+    for (int j{0}; j < n; ++j)
+    {
+        if (transport.rank() == 0)
+        {
+            local.v[j] = local.v[n + j];
+        }
+        if (transport.rank() + 1 == transport.size())
+        {
+            local.v[(local.numX - 1) * n + j] = local.v[(local.numX - 2) * n + j];
+        }
+    }
+}
+
+bool DistributedFluid::simulate(float dt, float gravity, size_t numIters)
+{
+    int beginI = std::max(owned_begin_local(), 1);
+    int endI = owned_end_local();
+
+    local.integrate_rows(dt, gravity, beginI, endI);
+    local.p.assign(local.p.size(), 0.0);
+    if (!solve_incompressibility(numIters, dt))
+    {
+        return false;
+    }
+    extrapolate();
+
+    if (!exchange_halo(local.u, haloWidth) || !exchange_halo(local.v, haloWidth) || !exchange_halo(local.m, haloWidth))
+    {
+        return false;
+    }
+
+    local.tempU = local.u;
+    local.tempV = local.v;
+    local.advect_vel_rows(dt, beginI, endI);
+    local.u.swap(local.tempU);
+    local.v.swap(local.tempV);
+
+    if (!exchange_halo(local.u, haloWidth) || !exchange_halo(local.v, haloWidth))
+    {
+        return false;
+    }
+
+    local.tempM = local.m;
+    local.advect_smoke_rows(dt, beginI, std::min(endI, local.numX - 1), local.u.data(), local.v.data());
+    local.m.swap(local.tempM);
+    return true;
+}
+
+bool DistributedFluid::max_speed(double& maxSpeed)
+{
+    size_t n = local.numY;
+    maxSpeed = 0.0;
+
+    for (int i{std::max(owned_begin_local(), 1)}; i < std::min(owned_end_local(), local.numX - 1); ++i)
+    {
+        for (int j{1}; j < local.numY - 1; ++j)
+        {
+            float u = 0.5f * (local.u[i * n + j] + local.u[(i + 1) * n + j]);
+            float v = 0.5f * (local.v[i * n + j] + local.v[i * n + j + 1]);
+            maxSpeed = std::max<double>(maxSpeed, std::sqrt(u * u + v * v));
+        }
+    }
+    return transport.reduce_max(maxSpeed);
+}
+
+bool DistributedFluid::smoke_mass(double& mass)
+{
+    size_t n = local.numY;
+    mass = 0.0;
+
+    for (size_t k{owned_begin_local() * n}; k < owned_end_local() * n; ++k)
+    {
+        mass += local.m[k];
+    }
+    return transport.reduce_sum(mass);
+}
+
+bool DistributedFluid::max_divergence(double& maxDiv)
+{
+    size_t n = local.numY;
+    maxDiv = 0.0;
+
+    for (int i{std::max(owned_begin_local(), 1)}; i < std::min(owned_end_local(), local.numX - 1); ++i)
+    {
+        for (int j{1}; j < local.numY - 1; ++j)
+        {
+            if (local.s[i * n + j] == 0.0)
+            {
+                continue;
+            }
+            float div = local.u[(i + 1) * n + j] - local.u[i * n + j] + local.v[i * n + j + 1] - local.v[i * n + j];
+            maxDiv = std::max<double>(maxDiv, std::abs(div));
+        }
+    }
+    return transport.reduce_max(maxDiv);
+}
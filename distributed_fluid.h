@@ -0,0 +1,56 @@
+#ifndef DISTRIBUTED_FLUID_H
+#define DISTRIBUTED_FLUID_H
+#include <functional>
+#include <vector>
+#include "fluid.h"
+#include "halo_transport.h"
+
+// One slab of a numX x numY domain split along i between transport ranks.
+// The local Fluid covers the owned columns plus haloWidth ghost columns on
+// each side that has a neighbour; its outer ghost columns play the role of the
+// usual +2 border padding. Ghosts are refreshed through the transport after
+// every pressure sweep and around both advection passes. The halo must be at
+// least as wide as the largest back-trace in cells (dt * |u| / h), otherwise
+// the semi-Lagrangian sample is clamped at the slab edge.
+//
+// simulate() returns false when the transport fails; the neighbours are then
+// left waiting and the caller has to abort all ranks.
+class DistributedFluid
+{
+public:
+    DistributedFluid(HaloTransport& transport, float density, int numX, int numY, float h, int haloWidth);
+
+    Fluid local;
+    int globalNumX;
+    int firstColumn;
+    int ownedBegin;
+    int ownedEnd;
+    int haloWidth;
+
+    // Calls init(local, globalI, localI) for every local column so scenes can
+    // be set up from global indices without building the whole grid.
+    void initialise(const std::function<void(Fluid&, int, int)>& init);
+    bool simulate(float dt, float gravity, size_t numIters);
+
+    // Reductions over all ranks; false when the transport fails.
+    bool max_speed(double& maxSpeed);
+    bool smoke_mass(double& mass);
+    bool max_divergence(double& maxDiv);
+
+private:
+    HaloTransport& transport;
+    std::vector<float> faceSnapshot;
+    std::vector<float> faceDelta;
+
+    int owned_begin_local() const;
+    int owned_end_local() const;
+    bool exchange_halo(std::vector<float>& field, int width);
+    bool exchange_interface_faces();
+    bool solve_incompressibility(size_t numIters, float dt);
+    void extrapolate();
+};
+
+// The halo width DistributedFluid uses for a requested one: at least one
+// column and at most a slab. globalNumX includes the border padding.
+int distributed_halo_width(int haloWidth, int numRanks, int globalNumX);
+#endif // DISTRIBUTED_FLUID_H
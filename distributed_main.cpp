@@ -0,0 +1,238 @@
+#include "distributed_fluid.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef FLUID_WITH_MPI
+#include <mpi.h>
+#endif
+
+namespace
+{
+
+struct Options {
+    int ranks{2};
+    std::string transport{"shm"};
+    std::string scene{"windtunnel"};
+    int resolution{100};
+    int steps{100};
+    int numIters{40};
+    int haloWidth{4};
+    int basePort{47000};
+};
+
+void print_usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [--ranks N] [--transport shm|socket"
+#ifdef FLUID_WITH_MPI
+              << "|mpi"
+#endif
+              << "] [--scene windtunnel|tank] [--res N] [--steps N] [--iters N] [--halo N] [--port N]\n";
+}
+
+// Builds the scene on the whole grid through setup_scene(), exactly as the
+// other front ends do, and copies this rank's columns into its slab.
+bool init_slab(const Options& options, DistributedFluid& fluid, SimulationParameters& scene)
+{
+    scene.sceneNr = options.scene == "tank" ? 0 : 1;
+    scene.resolution = options.resolution;
+    setup_scene(scene);
+
+    const Fluid& global = *scene.fluid;
+    bool matches = global.numX == fluid.globalNumX && global.numY == fluid.local.numY;
+    if (matches)
+    {
+        size_t n = global.numY;
+        fluid.initialise([&](Fluid& f, int globalI, int i) {
+            const std::vector<float>* from[]{&global.u, &global.v, &global.s, &global.m};
+            std::vector<float>* to[]{&f.u, &f.v, &f.s, &f.m};
+            for (int k{0}; k < 4; ++k)
+            {
+                std::copy(from[k]->begin() + globalI * n, from[k]->begin() + (globalI + 1) * n, to[k]->begin() + i * n);
+            }
+        });
+    }
+    delete scene.fluid;
+    scene.fluid = nullptr;
+    return matches;
+}
+
+int run_rank(const Options& options, HaloTransport& transport)
+{
+    double h{1.0 / options.resolution};
+    int numX{static_cast<int>(std::floor(2.0 / h))};
+    int numY{static_cast<int>(std::floor(1.0 / h))};
+
+    DistributedFluid fluid(transport, 1000.0, numX, numY, h, options.haloWidth);
+    SimulationParameters scene;
+    if (!init_slab(options, fluid, scene))
+    {
+        std::cerr << "rank " << transport.rank() << ": scene grid does not match the decomposed grid\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int step{0}; step < options.steps; ++step)
+    {
+        if (!fluid.simulate(scene.dt, scene.gravity, options.numIters))
+        {
+            std::cerr << "rank " << transport.rank() << ": halo exchange failed at step " << step << "\n";
+            return 1;
+        }
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    double maxSpeed{0.0};
+    double maxDivergence{0.0};
+    double smokeMass{0.0};
+    double slowestMs{wallMs};
+    if (!fluid.max_speed(maxSpeed) || !fluid.max_divergence(maxDivergence) || !fluid.smoke_mass(smokeMass)
+        || !transport.reduce_max(slowestMs))
+    {
+        std::cerr << "rank " << transport.rank() << ": reduction failed\n";
+        return 1;
+    }
+
+    std::cerr << "rank " << transport.rank() << ": columns [" << fluid.ownedBegin << ", " << fluid.ownedEnd
+              << ") halo " << fluid.haloWidth << ", " << wallMs << " ms\n";
+
+    if (transport.rank() == 0)
+    {
+        std::cout << "ranks=" << transport.size() << " transport=" << options.transport
+                  << " grid=" << fluid.globalNumX << "x" << fluid.local.numY
+                  << " steps=" << options.steps << " wallMs=" << slowestMs
+                  << " maxSpeed=" << maxSpeed << " maxDivergence=" << maxDivergence
+                  << " smokeMass=" << smokeMass << std::endl;
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    for (int k{1}; k < argc; ++k)
+    {
+        bool hasValue = k + 1 < argc;
+        if (std::strcmp(argv[k], "--ranks") == 0 && hasValue) { options.ranks = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--transport") == 0 && hasValue) { options.transport = argv[++k]; }
+        else if (std::strcmp(argv[k], "--scene") == 0 && hasValue) { options.scene = argv[++k]; }
+        else if (std::strcmp(argv[k], "--res") == 0 && hasValue) { options.resolution = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--steps") == 0 && hasValue) { options.steps = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--iters") == 0 && hasValue) { options.numIters = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--halo") == 0 && hasValue) { options.haloWidth = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--port") == 0 && hasValue) { options.basePort = std::atoi(argv[++k]); }
+        else
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+#ifdef FLUID_WITH_MPI
+    if (options.transport == "mpi")
+    {
+        MPI_Init(&argc, &argv);
+        MpiTransport transport;
+        int result = run_rank(options, transport);
+        MPI_Finalize();
+        return result;
+    }
+#endif
+
+    if (options.ranks < 1 || options.resolution < 1 || options.haloWidth < 1
+        || (options.transport != "shm" && options.transport != "socket"))
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    // Local transports fork one process per rank from here. A mailbox holds a
+    // whole halo, and never less than the one column of interface faces.
+    double h{1.0 / options.resolution};
+    int numX{static_cast<int>(std::floor(2.0 / h))};
+    int numY{static_cast<int>(std::floor(1.0 / h))};
+    int haloWidth = distributed_halo_width(options.haloWidth, options.ranks, numX + 2);
+    size_t capacity = static_cast<size_t>(numY + 2) * sizeof(float) * haloWidth;
+    SharedMemoryTransport::Region* region{nullptr};
+    if (options.transport == "shm")
+    {
+        region = SharedMemoryTransport::create_region(options.ranks, capacity);
+        if (region == nullptr)
+        {
+            std::cerr << "cannot map shared memory for " << options.ranks << " ranks\n";
+            return 1;
+        }
+    }
+
+    std::vector<pid_t> pids;
+    for (int rank{0}; rank < options.ranks; ++rank)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            std::unique_ptr<HaloTransport> transport;
+            if (region != nullptr)
+            {
+                transport = std::make_unique<SharedMemoryTransport>(region, rank);
+            }
+            else
+            {
+                auto sockets = std::make_unique<SocketTransport>(rank, options.ranks, options.basePort);
+                if (!sockets->connected())
+                {
+                    std::cerr << "rank " << rank << ": cannot connect on port " << options.basePort << "\n";
+                    _exit(1);
+                }
+                transport = std::move(sockets);
+            }
+            _exit(run_rank(options, *transport));
+        }
+        if (pid < 0)
+        {
+            std::cerr << "fork failed for rank " << rank << "\n";
+            options.ranks = rank;
+            break;
+        }
+        pids.push_back(pid);
+    }
+
+    // A failed rank leaves its neighbours waiting on a halo that never comes,
+    // so the first failure takes the remaining ranks down with it.
+    int result = static_cast<int>(pids.size()) == options.ranks ? 0 : 1;
+    while (!pids.empty())
+    {
+        if (result != 0)
+        {
+            for (pid_t pid : pids)
+            {
+                kill(pid, SIGTERM);
+            }
+        }
+        int status{0};
+        pid_t done = wait(&status);
+        if (done < 0)
+        {
+            break;
+        }
+        pids.erase(std::remove(pids.begin(), pids.end(), done), pids.end());
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            result = 1;
+        }
+    }
+
+    SharedMemoryTransport::destroy_region(region);
+    return result;
+}
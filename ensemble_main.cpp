@@ -0,0 +1,89 @@
+#include "ensemble_runner.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+
+void print_usage(const char* program)
+{
+    std::cerr << "usage: " << program << " <sweep-spec> [--threads N] [--batch N] [--out summary.csv]\n";
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const char* specPath{nullptr};
+    const char* outPath{nullptr};
+    size_t numThreads = std::thread::hardware_concurrency();
+    size_t batchSize{0};
+
+    for (int k{1}; k < argc; ++k)
+    {
+        if (std::strcmp(argv[k], "--threads") == 0 && k + 1 < argc)
+        {
+            numThreads = std::strtoul(argv[++k], nullptr, 10);
+        }
+        else if (std::strcmp(argv[k], "--batch") == 0 && k + 1 < argc)
+        {
+            batchSize = std::strtoul(argv[++k], nullptr, 10);
+        }
+        else if (std::strcmp(argv[k], "--out") == 0 && k + 1 < argc)
+        {
+            outPath = argv[++k];
+        }
+        else if (specPath == nullptr && argv[k][0] != '-')
+        {
+            specPath = argv[k];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (specPath == nullptr)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    std::ifstream spec(specPath);
+    if (!spec)
+    {
+        std::cerr << "cannot open sweep spec " << specPath << "\n";
+        return 1;
+    }
+
+    std::vector<SweepRun> runs;
+    std::string error;
+    if (!parse_sweep_spec(spec, runs, error))
+    {
+        std::cerr << specPath << ": " << error << "\n";
+        return 1;
+    }
+
+    TaskScheduler scheduler(numThreads);
+    std::cerr << "running " << runs.size() << " runs on " << scheduler.num_threads() << " threads\n";
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<RunSummary> summaries = run_ensemble(runs, scheduler, batchSize);
+    double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "finished in " << totalMs << " ms\n";
+
+    if (outPath != nullptr)
+    {
+        std::ofstream out(outPath);
+        write_summary_csv(out, summaries);
+    }
+    else
+    {
+        write_summary_csv(std::cout, summaries);
+    }
+    return 0;
+}
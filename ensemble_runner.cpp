@@ -0,0 +1,274 @@
+#include "ensemble_runner.h"
+#include "fluid.h"
+#include "scene.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <sstream>
+
+namespace
+{
+
+std::string trim(const std::string& text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool parse_scene(const std::string& value, double& out)
+{
+    if (value == "tank") { out = 0; return true; }
+    if (value == "windtunnel") { out = 1; return true; }
+    if (value == "paint") { out = 2; return true; }
+    return false;
+}
+
+bool parse_shape(const std::string& value, double& out)
+{
+    if (value == "circle") { out = 0; return true; }
+    if (value == "square") { out = 1; return true; }
+    if (value == "triangle") { out = 2; return true; }
+    if (value == "oval") { out = 3; return true; }
+    return false;
+}
+
+bool parse_number(const std::string& value, double& out)
+{
+    std::stringstream number(value);
+    return static_cast<bool>(number >> out) && number.eof();
+}
+
+// Smallest value an integer axis accepts; resolution matches the scene files.
+int integer_axis_minimum(const std::string& key)
+{
+    if (key == "resolution") { return 4; }
+    if (key == "numIters" || key == "steps") { return 1; }
+    return -1;
+}
+
+double estimated_cost(const SweepRun& run)
+{
+    double cells = 2.0 * run.resolution * run.resolution;
+    return cells * (run.numIters + 4) * run.steps;
+}
+
+}
+
+bool parse_sweep_spec(std::istream& in, std::vector<SweepRun>& runs, std::string& error)
+{
+    std::map<std::string, std::vector<double>> axes{
+        {"scene", {1}},
+        {"overRelaxation", {1.9}},
+        {"numIters", {40}},
+        {"obstacleRadius", {0.085}},
+        {"shape", {0}},
+        {"steps", {100}},
+        {"resolution", {100}}
+    };
+
+    std::string line;
+    int lineNr{0};
+    while (std::getline(in, line))
+    {
+        lineNr++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+        {
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        std::string key = trim(line.substr(0, eq));
+        if (eq == std::string::npos || axes.find(key) == axes.end())
+        {
+            error = "line " + std::to_string(lineNr) + ": expected one of the sweep keys before '='";
+            return false;
+        }
+
+        std::vector<double> values;
+        std::stringstream list(line.substr(eq + 1));
+        std::string item;
+        while (std::getline(list, item, ','))
+        {
+            item = trim(item);
+            double value{0.0};
+            bool ok{true};
+            if (key == "scene")
+            {
+                ok = parse_scene(item, value);
+            }
+            else if (key == "shape")
+            {
+                ok = parse_shape(item, value);
+            }
+            else
+            {
+                ok = parse_number(item, value);
+            }
+
+            if (!ok)
+            {
+                error = "line " + std::to_string(lineNr) + ": bad value '" + item + "' for " + key;
+                return false;
+            }
+            int minimum = integer_axis_minimum(key);
+            if (minimum >= 0 && (value != std::floor(value) || value < minimum || value > std::numeric_limits<int>::max()))
+            {
+                error = "line " + std::to_string(lineNr) + ": " + key + " needs an integer of at least "
+                        + std::to_string(minimum) + ", not '" + item + "'";
+                return false;
+            }
+            values.push_back(value);
+        }
+
+        if (values.empty())
+        {
+            error = "line " + std::to_string(lineNr) + ": no values for " + key;
+            return false;
+        }
+        axes[key] = values;
+    }
+
+    runs.clear();
+    for (double scene : axes["scene"])
+    for (double overRelaxation : axes["overRelaxation"])
+    for (double numIters : axes["numIters"])
+    for (double obstacleRadius : axes["obstacleRadius"])
+    for (double shape : axes["shape"])
+    for (double steps : axes["steps"])
+    for (double resolution : axes["resolution"])
+    {
+        SweepRun run;
+        run.id = static_cast<int>(runs.size());
+        run.sceneNr = static_cast<int>(scene);
+        run.overRelaxation = overRelaxation;
+        run.numIters = static_cast<int>(numIters);
+        run.obstacleRadius = obstacleRadius;
+        run.shape = static_cast<int>(shape);
+        run.steps = static_cast<int>(steps);
+        run.resolution = static_cast<int>(resolution);
+        runs.push_back(run);
+    }
+    return true;
+}
+
+RunSummary run_single(const SweepRun& run)
+{
+    RunSummary summary;
+    summary.run = run;
+
+    SimulationParameters params;
+    params.sceneNr = run.sceneNr;
+    params.shape = run.shape;
+    params.obstacleRadius = run.obstacleRadius;
+    params.resolution = run.resolution;
+    setup_scene(params);
+    if (run.sceneNr == 2)
+    {
+        set_obstacle(params, 1.0, 0.5, true);
+    }
+    params.overRelaxation = run.overRelaxation;
+    params.numIters = run.numIters;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int step{0}; step < run.steps; ++step)
+    {
+        simulate_step(params);
+    }
+    auto end = std::chrono::steady_clock::now();
+    Fluid& f = *params.fluid;
+
+    summary.wallMs = std::chrono::duration<double, std::milli>(end - start).count();
+    summary.msPerStep = run.steps > 0 ? summary.wallMs / run.steps : 0.0;
+
+    size_t n = f.numY;
+    summary.minP = f.p[0];
+    summary.maxP = f.p[0];
+    for (int i{0}; i < f.numCells; ++i)
+    {
+        summary.minP = std::min(summary.minP, f.p[i]);
+        summary.maxP = std::max(summary.maxP, f.p[i]);
+        summary.smokeMass += f.m[i];
+    }
+
+    for (int i{1}; i < f.numX - 1; ++i)
+    {
+        for (int j{1}; j < f.numY - 1; ++j)
+        {
+            if (f.s[i * n + j] == 0.0)
+            {
+                continue;
+            }
+            float u = 0.5f * (f.u[i * n + j] + f.u[(i + 1) * n + j]);
+            float v = 0.5f * (f.v[i * n + j] + f.v[i * n + j + 1]);
+            float div = f.u[(i + 1) * n + j] - f.u[i * n + j] + f.v[i * n + j + 1] - f.v[i * n + j];
+            summary.maxSpeed = std::max(summary.maxSpeed, std::sqrt(u * u + v * v));
+            summary.maxDivergence = std::max(summary.maxDivergence, std::abs(div));
+        }
+    }
+
+    delete params.fluid;
+    return summary;
+}
+
+std::vector<RunSummary> run_ensemble(const std::vector<SweepRun>& runs, TaskScheduler& scheduler, size_t batchSize)
+{
+    std::vector<RunSummary> summaries(runs.size());
+    std::vector<size_t> order(runs.size());
+    for (size_t k{0}; k < order.size(); ++k)
+    {
+        order[k] = k;
+    }
+    std::sort(order.begin(), order.end(), [&runs](size_t a, size_t b) {
+        return estimated_cost(runs[a]) > estimated_cost(runs[b]);
+    });
+
+    if (batchSize == 0)
+    {
+        batchSize = std::max<size_t>(1, runs.size() / (4 * scheduler.num_threads()));
+    }
+
+    size_t numBatches = (order.size() + batchSize - 1) / batchSize;
+    std::atomic<size_t> started{0};
+    TaskGraph graph;
+    for (size_t batch{numBatches}; batch-- > 0;)
+    {
+        size_t begin = batch * batchSize;
+        size_t end = std::min(begin + batchSize, order.size());
+        graph.add_task([&, begin, end] {
+            for (size_t k{begin}; k < end; ++k)
+            {
+                size_t startOrder = started++;
+                summaries[order[k]] = run_single(runs[order[k]]);
+                summaries[order[k]].startOrder = startOrder;
+            }
+        });
+    }
+    scheduler.run(graph);
+    return summaries;
+}
+
+void write_summary_csv(std::ostream& out, const std::vector<RunSummary>& summaries)
+{
+    static const char* sceneNames[]{"tank", "windtunnel", "paint"};
+    static const char* shapeNames[]{"circle", "square", "triangle", "oval"};
+
+    out << "id,scene,overRelaxation,numIters,obstacleRadius,shape,steps,resolution,"
+           "wallMs,msPerStep,maxSpeed,maxDivergence,smokeMass,minP,maxP\n";
+    for (const RunSummary& s : summaries)
+    {
+        const SweepRun& r = s.run;
+        out << r.id << ',' << sceneNames[std::clamp(r.sceneNr, 0, 2)] << ',' << r.overRelaxation << ','
+            << r.numIters << ',' << r.obstacleRadius << ',' << shapeNames[std::clamp(r.shape, 0, 3)] << ','
+            << r.steps << ',' << r.resolution << ',' << s.wallMs << ',' << s.msPerStep << ','
+            << s.maxSpeed << ',' << s.maxDivergence << ',' << s.smokeMass << ',' << s.minP << ',' << s.maxP << '\n';
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef ENSEMBLE_RUNNER_H
+#define ENSEMBLE_RUNNER_H
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "task_scheduler.h"
+
+// One point of a parameter sweep. sceneNr and shape use the same numbering as
+// SimulationParameters (0 tank, 1 wind tunnel, 2 paint; 0 circle, 1 square,
+// 2 triangle, 3 oval).
+struct SweepRun {
+    int id{0};
+    int sceneNr{1};
+    float overRelaxation{1.9};
+    int numIters{40};
+    double obstacleRadius{0.085};
+    int shape{0};
+    int steps{100};
+    int resolution{100};
+};
+
+struct RunSummary {
+    SweepRun run;
+    size_t startOrder{0}; // runs of the ensemble started before this one
+    double wallMs{0.0};
+    double msPerStep{0.0};
+    float maxSpeed{0.0};
+    float maxDivergence{0.0};
+    float smokeMass{0.0};
+    float minP{0.0};
+    float maxP{0.0};
+};
+
+// Parses a sweep specification. Each non-comment line is "key = v1, v2, ...";
+// the runs are the cartesian product of every listed value. Keys: scene,
+// overRelaxation, numIters, obstacleRadius, shape, steps, resolution.
+// numIters and steps take positive integers, resolution integers from 4.
+bool parse_sweep_spec(std::istream& in, std::vector<SweepRun>& runs, std::string& error);
+
+// Steps every run to completion on the scheduler. Runs are sorted by estimated
+// cost and dealt out in batches of batchSize, queued cheapest first: workers
+// pop their own deque from the back, so each starts on its longest batch and
+// the work-stealing pool evens out the tail with the cheap ones. batchSize 0
+// picks a batch size from the thread count.
+std::vector<RunSummary> run_ensemble(const std::vector<SweepRun>& runs, TaskScheduler& scheduler, size_t batchSize);
+
+RunSummary run_single(const SweepRun& run);
+void write_summary_csv(std::ostream& out, const std::vector<RunSummary>& summaries);
+#endif // ENSEMBLE_RUNNER_H
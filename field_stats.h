@@ -0,0 +1,51 @@
+#ifndef FIELD_STATS_H
+#define FIELD_STATS_H
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+struct FieldRange {
+    float min{std::numeric_limits<float>::max()};
+    float max{std::numeric_limits<float>::lowest()};
+    float absMax{0.0f};
+    double sum{0.0};
+
+    void add(float value)
+    {
+        min = std::min(min, value);
+        max = std::max(max, value);
+        absMax = std::max(absMax, std::abs(value));
+        sum += value;
+    }
+
+    void merge(const FieldRange& other)
+    {
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        absMax = std::max(absMax, other.absMax);
+        sum += other.sum;
+    }
+};
+
+// Reductions over one step's result, gathered by the solver while it sweeps
+// the fields. p covers every cell, as the renderer colours them; u, v and m
+// every stored value. maxDivergence is the largest residual the last pressure
+// sweep corrected, maxSpeed the largest cell-centred |(u, v)|.
+struct FieldStats {
+    FieldRange p;
+    FieldRange u;
+    FieldRange v;
+    FieldRange m;
+    float maxSpeed{0.0f};
+    float maxDivergence{0.0f};
+    bool valid{false}; // false until the first step
+
+    void merge_velocity_and_smoke(const FieldStats& other)
+    {
+        u.merge(other.u);
+        v.merge(other.v);
+        m.merge(other.m);
+        maxSpeed = std::max(maxSpeed, other.maxSpeed);
+    }
+};
+#endif // FIELD_STATS_H
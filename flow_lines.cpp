@@ -0,0 +1,195 @@
+#include "flow_lines.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+constexpr float minSpeed{1e-4f};
+
+}
+
+void FlowLines::trace(const Fluid& f, TaskScheduler* scheduler, float pixelsPerCell, const FlowLineSettings& settings)
+{
+    fluid = &f;
+    config = settings;
+    config.maxPoints = std::max(config.maxPoints, 2);
+
+    // Seeds sit on the interior cells only; the border is solid in every scene.
+    int innerX = std::max(f.numX - 2, 1);
+    int innerY = std::max(f.numY - 2, 1);
+    spacing = std::max(1.0f, config.seedSpacingPixels / std::max(pixelsPerCell, 1e-3f));
+    float numSeeds = (innerX / spacing) * (innerY / spacing);
+    if (numSeeds > config.maxSeeds)
+    {
+        spacing *= std::sqrt(numSeeds / std::max(config.maxSeeds, 1));
+    }
+    seedsX = std::max(1, static_cast<int>(innerX / spacing));
+    seedsY = std::max(1, static_cast<int>(innerY / spacing));
+
+    int total = seedsX * seedsY;
+    slotFloats = (config.streamlines ? 4 * (config.maxPoints - 1) : 0);
+    if (slots.size() < static_cast<size_t>(total) * slotFloats)
+    {
+        slots.resize(static_cast<size_t>(total) * slotFloats);
+    }
+    slotCounts.resize(total);
+    seedSpeeds.resize(total);
+
+    if (scheduler == nullptr || scheduler->num_threads() <= 1)
+    {
+        trace_seeds(0, total);
+    }
+    else
+    {
+        if (graphSeeds != total || graphScheduler != scheduler)
+        {
+            graph.clear();
+            int chunk = std::max(1, total / static_cast<int>(4 * scheduler->num_threads()));
+            for (int begin{0}; begin < total; begin += chunk)
+            {
+                int end = std::min(begin + chunk, total);
+                graph.add_task([this, begin, end] { trace_seeds(begin, end); });
+            }
+            graphSeeds = total;
+            graphScheduler = scheduler;
+        }
+        scheduler->run(graph);
+    }
+
+    lines.clear();
+    for (int seed{0}; seed < total; ++seed)
+    {
+        const float* slot = slots.data() + static_cast<size_t>(seed) * slotFloats;
+        lines.insert(lines.end(), slot, slot + slotCounts[seed]);
+    }
+
+    if (config.arrows)
+    {
+        // Arrow length is relative to the fastest seed, up to 90 % of the spacing.
+        float fastest = *std::max_element(seedSpeeds.begin(), seedSpeeds.end());
+        float sx = 1.0f / (f.numX * f.h);
+        float sy = 1.0f / (f.numY * f.h);
+        for (int seed{0}; seed < total; ++seed)
+        {
+            if (seedSpeeds[seed] < minSpeed || fastest < minSpeed)
+            {
+                continue;
+            }
+            float x = (1.0f + (seed / seedsY + 0.5f) * spacing) * f.h;
+            float y = (1.0f + (seed % seedsY + 0.5f) * spacing) * f.h;
+            float u = f.sample_field(x, y, Fluid::U_FIELD) / seedSpeeds[seed];
+            float v = f.sample_field(x, y, Fluid::V_FIELD) / seedSpeeds[seed];
+            float length = 0.9f * spacing * f.h * seedSpeeds[seed] / fastest;
+            float tipX = x + u * length;
+            float tipY = y + v * length;
+            float head = 0.3f * length;
+            float segments[]{
+                x, y, tipX, tipY,
+                tipX, tipY, tipX - head * (u + 0.5f * v), tipY - head * (v - 0.5f * u),
+                tipX, tipY, tipX - head * (u - 0.5f * v), tipY - head * (v + 0.5f * u)
+            };
+            for (int k{0}; k < 12; k += 2)
+            {
+                lines.push_back(segments[k] * sx - 0.5f);
+                lines.push_back(segments[k + 1] * sy - 0.5f);
+            }
+        }
+    }
+}
+
+void FlowLines::trace_seeds(int begin, int end)
+{
+    for (int seed{begin}; seed < end; ++seed)
+    {
+        trace_seed(seed);
+    }
+}
+
+void FlowLines::trace_seed(int seed)
+{
+    const Fluid& f = *fluid;
+    float x0 = (1.0f + (seed / seedsY + 0.5f) * spacing) * f.h;
+    float y0 = (1.0f + (seed % seedsY + 0.5f) * spacing) * f.h;
+    float u = f.sample_field(x0, y0, Fluid::U_FIELD);
+    float v = f.sample_field(x0, y0, Fluid::V_FIELD);
+    seedSpeeds[seed] = std::sqrt(u * u + v * v);
+    slotCounts[seed] = 0;
+
+    int i = static_cast<int>(x0 / f.h);
+    int j = static_cast<int>(y0 / f.h);
+    if (f.s[i * f.numY + j] == 0.0f)
+    {
+        seedSpeeds[seed] = 0.0f;
+        return;
+    }
+    if (!config.streamlines)
+    {
+        return;
+    }
+
+    float* out = slots.data() + static_cast<size_t>(seed) * slotFloats;
+    int count{0};
+    float sx = 1.0f / (f.numX * f.h);
+    float sy = 1.0f / (f.numY * f.h);
+    float ds = config.stepCells * f.h;
+    int half = (config.maxPoints - 1) / 2;
+
+    // Downstream, then upstream from the seed again.
+    for (float direction : {ds, -ds})
+    {
+        float x = x0;
+        float y = y0;
+        int steps = direction > 0.0f ? config.maxPoints - 1 - half : half;
+        for (int k{0}; k < steps; ++k)
+        {
+            float fromX = x;
+            float fromY = y;
+            if (!step(x, y, direction))
+            {
+                break;
+            }
+            out[count++] = fromX * sx - 0.5f;
+            out[count++] = fromY * sy - 0.5f;
+            out[count++] = x * sx - 0.5f;
+            out[count++] = y * sy - 0.5f;
+        }
+    }
+    slotCounts[seed] = count;
+}
+
+// One midpoint step of length |ds| along the unit velocity direction. Returns
+// false where the flow stalls or the line would leave the fluid.
+bool FlowLines::step(float& x, float& y, float ds) const
+{
+    const Fluid& f = *fluid;
+    float u = f.sample_field(x, y, Fluid::U_FIELD);
+    float v = f.sample_field(x, y, Fluid::V_FIELD);
+    float speed = std::sqrt(u * u + v * v);
+    if (speed < minSpeed)
+    {
+        return false;
+    }
+    float midX = x + 0.5f * ds * u / speed;
+    float midY = y + 0.5f * ds * v / speed;
+
+    u = f.sample_field(midX, midY, Fluid::U_FIELD);
+    v = f.sample_field(midX, midY, Fluid::V_FIELD);
+    speed = std::sqrt(u * u + v * v);
+    if (speed < minSpeed)
+    {
+        return false;
+    }
+    float nextX = x + ds * u / speed;
+    float nextY = y + ds * v / speed;
+
+    int i = static_cast<int>(nextX / f.h);
+    int j = static_cast<int>(nextY / f.h);
+    if (i < 1 || i >= f.numX - 1 || j < 1 || j >= f.numY - 1 || f.s[i * f.numY + j] == 0.0f)
+    {
+        return false;
+    }
+    x = nextX;
+    y = nextY;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef FLOW_LINES_H
+#define FLOW_LINES_H
+#include <vector>
+#include "fluid.h"
+#include "task_scheduler.h"
+
+struct FlowLineSettings {
+    bool streamlines{true};
+    bool arrows{false};
+    float seedSpacingPixels{20.0f}; // on-screen distance between seeds
+    int maxSeeds{2048};
+    int maxPoints{48};              // per streamline, half upstream and half downstream
+    float stepCells{0.75f};         // tracing step
+};
+
+// Velocity overlay: streamlines traced through sample_field on U_FIELD and
+// V_FIELD from a lattice of seeds, and arrows at the seeds. Seeds are spaced a
+// fixed number of pixels apart, so they thin out as cells shrink on screen, and
+// are capped at maxSeeds, so the cost stays bounded on large grids. Seeds are
+// traced in parallel on the scheduler into fixed slots; the buffers are kept
+// from frame to frame and only grow.
+class FlowLines
+{
+public:
+    // pixelsPerCell is the on-screen size of one cell.
+    void trace(const Fluid& f, TaskScheduler* scheduler, float pixelsPerCell, const FlowLineSettings& settings);
+
+    // GL_LINES vertex pairs, x and y in the grid quad's [-0.5, 0.5] range.
+    const std::vector<float>& vertices() const { return lines; }
+    int num_seeds() const { return seedsX * seedsY; }
+
+private:
+    void trace_seeds(int begin, int end);
+    void trace_seed(int seed);
+    bool step(float& x, float& y, float ds) const;
+
+    const Fluid* fluid{nullptr};
+    FlowLineSettings config;
+    int seedsX{0};
+    int seedsY{0};
+    float spacing{1.0f};           // between seeds, in cells
+    int slotFloats{0};             // capacity of one seed's slot
+    std::vector<float> slots;      // traced lines, one fixed slot per seed
+    std::vector<int> slotCounts;   // floats used in each slot
+    std::vector<float> seedSpeeds; // for scaling the arrows
+    std::vector<float> lines;
+
+    TaskGraph graph;
+    int graphSeeds{-1};
+    const TaskScheduler* graphScheduler{nullptr};
+};
+#endif // FLOW_LINES_H
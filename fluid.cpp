@@ -1,4 +1,5 @@
 #include "fluid.h"
+#include "numa_placement.h"
 #include <algorithm>
 #include <cmath>
 #include <iostream>
@@ -12,9 +13,14 @@ Fluid::Fluid(float density, int numX, int numY, float h)
 }
 
 void Fluid::integrate(float dt, float gravity)
+{
+    integrate_rows(dt, gravity, 1, this->numX);
+}
+
+void Fluid::integrate_rows(float dt, float gravity, int beginI, int endI)
 {
     int n = this->numY;
-    for (int i = 1; i < this->numX; i++)
+    for (int i = beginI; i < endI; i++)
     {
         for (int j = 1; j < this->numY - 1; j++)
         {
@@ -26,25 +32,53 @@ void Fluid::integrate(float dt, float gravity)
 
 void Fluid::solve_incompressibility(size_t numIters, float dt)
 {
-    int n = this->numY;
     float cp = this->density * this->h / dt;
 
-    for (int iter = 0; iter < numIters; iter++)
+    // A cell's pressure only changes when the sweep visits it, so the last
+    // sweep sees every final value. The boundary cells stay at zero.
+    pendingStats = FieldStats{};
+    pendingStats.p.add(0.0f);
+    FieldStats* lastSweepStats = (this->outputs & OUTPUT_STATS) != 0 ? &pendingStats : nullptr;
+    for (size_t iter = 0; iter < numIters; iter++)
+    {
+        solve_incompressibility_sweep(cp, 1, this->numX - 1, iter + 1 == numIters ? lastSweepStats : nullptr);
+    }
+}
+
+void Fluid::solve_incompressibility_sweep(float cp, int beginI, int endI, FieldStats* stats)
+{
+    int n = this->numY;
+
+    for (int i = beginI; i < endI; i++)
     {
-        for (int i = 1; i < this->numX - 1; i++)
+        for (int j = 1; j < this->numY - 1; j++)
         {
-            for (int j = 1; j < this->numY - 1; j++)
+            if (this->s[i * n + j] == 0.0)
             {
-                if (this->s[i * n + j] == 0.0)
-                    continue;
+                if (stats != nullptr)
+                    stats->p.add(this->p[i * n + j]);
+                continue;
+            }
 
-                sumOfAllNeighbours = sum_of_all_neighbours(i, j, n);
+            sumOfAllNeighbours = sum_of_all_neighbours(i, j, n);
 
-                if (sumOfAllNeighbours == 0.0)
-                    continue;
+            if (sumOfAllNeighbours == 0.0)
+            {
+                if (stats != nullptr)
+                    stats->p.add(this->p[i * n + j]);
+                continue;
+            }
 
-                update_solve_incompressibilitys_vectors(cp, i,j,n);
+            if (stats != nullptr)
+            {
+                float div = this->u[(i + 1) * n + j] - this->u[i * n + j] + this->v[i * n + j + 1] - this->v[i * n + j];
+                stats->maxDivergence = std::max(stats->maxDivergence, std::abs(div));
             }
+
+            update_solve_incompressibilitys_vectors(cp, i,j,n);
+
+            if (stats != nullptr)
+                stats->p.add(this->p[i * n + j]);
         }
     }
 }
@@ -63,7 +97,8 @@ void Fluid::update_solve_incompressibilitys_vectors(float cp, int i, int j, int
     float div = this->u[(i + 1) * n + j] - this->u[i * n + j] + this->v[i * n + j + 1] - this->v[i * n + j];
     float p = -div / sumOfAllNeighbours;
     p *= overRelaxation;
-    this->p[i * n + j] += cp * p;
+    if ((this->outputs & OUTPUT_PRESSURE) != 0)
+        this->p[i * n + j] += cp * p;
     this->u[i * n + j] -= neighbours.cellAboveOfCurrentCell * p;
     this->u[(i + 1) * n + j] += neighbours.cellBelowOfCurrentCell * p;
     this->v[i * n + j] -= neighbours.cellLeftOfCurrentCell * p;
@@ -97,7 +132,7 @@ void Fluid::extrapolate_vertical_velocity(int j, int gridSizeY)
     this->v[(this->numX - 1) * gridSizeY + j] = this->v[(this->numX - 2) * gridSizeY + j];
 }
 
-float Fluid::sample_field(float x, float y, int field)
+float Fluid::sample_field(float x, float y, int field) const
 {
     int gridSizeY = this->numY;
     float h = this->h;
@@ -158,11 +193,19 @@ void Fluid::advect_vel(float dt)
     tempU = this->u;
     tempV = this->v;
 
+    advect_vel_rows(dt, 1, this->numX);
+
+    this->u = tempU;
+    this->v = tempV;
+}
+
+void Fluid::advect_vel_rows(float dt, int beginI, int endI)
+{
     int gridSizeY = this->numY;
     float h = this->h;
     float h2 = 0.5f * h;
 
-    for (int i = 1; i < this->numX; i++)
+    for (int i = beginI; i < endI; i++)
     {
         for (int j = 1; j < this->numY; j++)
         {
@@ -176,9 +219,6 @@ void Fluid::advect_vel(float dt)
             }
         }
     }
-
-    this->u = tempU;
-    this->v = tempV;
 }
 
 void Fluid::compute_u_for_advect_velocity(int i, int j, float h2, int gridSizeY, float dt)
@@ -209,33 +249,83 @@ void Fluid::advect_smoke(float dt)
 {
     tempM = this->m;
 
+    advect_smoke_rows(dt, 1, this->numX - 1, this->u.data(), this->v.data());
+
+    this->m = tempM;
+}
+
+void Fluid::advect_smoke_rows(float dt, int beginI, int endI, const float* uField, const float* vField)
+{
     int gridSizeY = this->numY;
     float h = this->h;
     float h2 = 0.5f * h;
 
-    for (int i = 1; i < this->numX - 1; i++)
+    for (int i = beginI; i < endI; i++)
     {
         for (int j = 1; j < this->numY - 1; j++)
         {
             if (this->s[i * gridSizeY + j] != 0.0) {
-                compute_m_for_advect_smoke(i, j, h2, gridSizeY, dt);
+                compute_m_for_advect_smoke(i, j, h2, gridSizeY, dt, uField, vField);
             }
         }
     }
-
-    this->m = tempM;
 }
 
 void Fluid::compute_m_for_advect_smoke(int i, int j, float h2, int gridSizeY, float dt)
 {
-    float u = (this->u[i * gridSizeY + j] + this->u[(i + 1) * gridSizeY + j]) * 0.5f;
-    float v = (this->v[i * gridSizeY + j] + this->v[i * gridSizeY + j + 1]) * 0.5f;
+    compute_m_for_advect_smoke(i, j, h2, gridSizeY, dt, this->u.data(), this->v.data());
+}
+
+void Fluid::compute_m_for_advect_smoke(int i, int j, float h2, int gridSizeY, float dt, const float* uField, const float* vField)
+{
+    float u = (uField[i * gridSizeY + j] + uField[(i + 1) * gridSizeY + j]) * 0.5f;
+    float v = (vField[i * gridSizeY + j] + vField[i * gridSizeY + j + 1]) * 0.5f;
     float x = i * h + h2 - dt * u;
     float y = j * h + h2 - dt * v;
 
     tempM[i * gridSizeY + j] = this->sample_field(x, y, S_FIELD);
 }
 
+// Corner vorticity dv/dx - du/dy from the faces around each corner, for rows
+// [beginI, endI); reads row beginI - 1.
+void Fluid::vorticity_rows(int beginI, int endI, const float* uField, const float* vField)
+{
+    int n = this->numY;
+    float h1 = 1.0f / this->h;
+    for (int i = std::max(beginI, 1); i < endI; i++)
+    {
+        for (int j = 1; j < n; j++)
+        {
+            vorticity[i * n + j] = (vField[i * n + j] - vField[(i - 1) * n + j] - uField[i * n + j] + uField[i * n + j - 1]) * h1;
+        }
+    }
+}
+
+// Reduces rows [beginI, endI) of the advected fields into partial. Run on a
+// block straight after advecting it, while its rows are still in cache.
+// partial.maxSpeed holds the squared speed until the step takes its root.
+void Fluid::accumulate_stats_rows(int beginI, int endI, const float* uField, const float* vField, const float* mField, FieldStats& partial) const
+{
+    int n = this->numY;
+    for (int i = beginI; i < endI; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            partial.u.add(uField[i * n + j]);
+            partial.v.add(vField[i * n + j]);
+            partial.m.add(mField[i * n + j]);
+        }
+        if (i + 1 >= this->numX)
+            continue;
+        for (int j = 0; j < n - 1; j++)
+        {
+            float uc = (uField[i * n + j] + uField[(i + 1) * n + j]) * 0.5f;
+            float vc = (vField[i * n + j] + vField[i * n + j + 1]) * 0.5f;
+            partial.maxSpeed = std::max(partial.maxSpeed, uc * uc + vc * vc);
+        }
+    }
+}
+
 void Fluid::set_v_velocity(size_t i, size_t j, float value)
 {
     this->v[i*this->numY +j]= value;
@@ -253,10 +343,294 @@ void Fluid::set_s_velocity(size_t i, size_t j, float value)
 
 void Fluid::simulate(float dt, float gravity, size_t numIters)
 {
-    this->integrate(dt, gravity);
-    this->p.assign(this->p.size(), 0.0);
-    this->solve_incompressibility(numIters, dt);
-    this->extrapolate();
-    this->advect_vel(dt);
-    this->advect_smoke(dt);
+    if (this->scheduler != nullptr && this->scheduler->num_threads() > 1)
+    {
+        simulate_with_scheduler(dt, gravity, numIters);
+        return;
+    }
+
+    {
+        ScopedStageTimer timer(STAGE_INTEGRATE);
+        this->integrate(dt, gravity);
+    }
+    {
+        ScopedStageTimer timer(STAGE_SOLVE);
+        if ((this->outputs & OUTPUT_PRESSURE) != 0)
+            this->p.assign(this->p.size(), 0.0);
+        this->solve_incompressibility(numIters, dt);
+    }
+    {
+        ScopedStageTimer timer(STAGE_EXTRAPOLATE);
+        this->extrapolate();
+    }
+    {
+        ScopedStageTimer timer(STAGE_ADVECT_VEL);
+        this->advect_vel(dt);
+    }
+
+    ScopedStageTimer timer(STAGE_OUTPUTS);
+    if ((this->outputs & OUTPUT_SMOKE) != 0)
+        this->advect_smoke(dt);
+    if ((this->outputs & OUTPUT_VORTICITY) != 0)
+    {
+        vorticity.resize(this->numCells);
+        vorticity_rows(0, this->numX, this->u.data(), this->v.data());
+    }
+
+    stats.valid = false;
+    if ((this->outputs & OUTPUT_STATS) != 0)
+    {
+        FieldStats velocityStats;
+        accumulate_stats_rows(0, this->numX, this->u.data(), this->v.data(), this->m.data(), velocityStats);
+        stats = pendingStats;
+        stats.merge_velocity_and_smoke(velocityStats);
+        stats.maxSpeed = std::sqrt(stats.maxSpeed);
+        stats.valid = true;
+    }
+}
+
+
+// Runs one step as a task graph over blocks of rowsPerTask storage rows (one
+// row is a fixed i). The solve stays a single task because Gauss-Seidel sweeps
+// are order dependent. Velocity advection writes tempU/tempV block by block,
+// and each smoke block starts as soon as the velocity blocks it reads (its own
+// rows plus the first row of the next block, and the last of the previous one
+// for vorticity) are finished, reading the new velocities straight out of
+// tempU/tempV. The results match simulate() bit for bit.
+void Fluid::simulate_with_scheduler(float dt, float gravity, size_t numIters)
+{
+    int numBlocks = (this->numX + this->rowsPerTask - 1) / this->rowsPerTask;
+
+    if (numBlocks != stepGraphBlocks || stepGraphOwner != this)
+    {
+        build_step_graph(numBlocks);
+    }
+
+    stepDt = dt;
+    stepGravity = gravity;
+    stepNumIters = numIters;
+
+    tempU.resize(this->numCells);
+    tempV.resize(this->numCells);
+    tempM.resize(this->numCells);
+    blockStats.assign(numBlocks, FieldStats{});
+    blockStageNs.assign(numBlocks * numBlockStages, 0);
+    if ((this->outputs & OUTPUT_VORTICITY) != 0)
+        vorticity.resize(this->numCells);
+
+    this->scheduler->run(stepGraph);
+}
+
+void Fluid::build_step_graph(int numBlocks)
+{
+    stepGraph.clear();
+    stepGraphBlocks = numBlocks;
+    stepGraphOwner = this;
+
+    int rows = this->rowsPerTask;
+    std::vector<TaskGraph::TaskId> integrateTasks;
+    std::vector<TaskGraph::TaskId> velTasks;
+    std::vector<TaskGraph::TaskId> smokeTasks;
+
+    for (int b{0}; b < numBlocks; ++b)
+    {
+        int beginI = std::max(b * rows, 1);
+        int endI = std::min((b + 1) * rows, this->numX);
+        integrateTasks.push_back(stepGraph.add_task([this, b, beginI, endI] {
+            ScopedStageTimer timer(STAGE_INTEGRATE, block_stage_ns(b, 0));
+            integrate_rows(stepDt, stepGravity, beginI, endI);
+        }, block_worker(b, numBlocks)));
+    }
+
+    TaskGraph::TaskId solve = stepGraph.add_task([this] {
+        ScopedStageTimer timer(STAGE_SOLVE);
+        if ((this->outputs & OUTPUT_PRESSURE) != 0)
+            this->p.assign(this->p.size(), 0.0);
+        solve_incompressibility(stepNumIters, stepDt);
+    });
+
+    for (TaskGraph::TaskId id : integrateTasks)
+    {
+        stepGraph.add_dependency(id, solve);
+    }
+
+    TaskGraph::TaskId extrapolateTask = stepGraph.add_task([this] {
+        ScopedStageTimer timer(STAGE_EXTRAPOLATE);
+        extrapolate();
+    });
+    stepGraph.add_dependency(solve, extrapolateTask);
+
+    for (int b{0}; b < numBlocks; ++b)
+    {
+        int beginI = b * rows;
+        int endI = std::min((b + 1) * rows, this->numX);
+        velTasks.push_back(stepGraph.add_task([this, b, beginI, endI] {
+            ScopedStageTimer timer(STAGE_ADVECT_VEL, block_stage_ns(b, 1));
+            size_t n = this->numY;
+            std::copy(this->u.begin() + beginI * n, this->u.begin() + endI * n, tempU.begin() + beginI * n);
+            std::copy(this->v.begin() + beginI * n, this->v.begin() + endI * n, tempV.begin() + beginI * n);
+            advect_vel_rows(stepDt, std::max(beginI, 1), endI);
+        }, block_worker(b, numBlocks)));
+        stepGraph.add_dependency(extrapolateTask, velTasks.back());
+    }
+
+    for (int b{0}; b < numBlocks; ++b)
+    {
+        int beginI = b * rows;
+        int endI = std::min((b + 1) * rows, this->numX);
+        // Everything derived from the new velocities of a block, each part
+        // only while someone subscribes to it.
+        smokeTasks.push_back(stepGraph.add_task([this, b, beginI, endI] {
+            ScopedStageTimer timer(STAGE_OUTPUTS, block_stage_ns(b, 2));
+            size_t n = this->numY;
+            if ((this->outputs & OUTPUT_SMOKE) != 0)
+            {
+                std::copy(this->m.begin() + beginI * n, this->m.begin() + endI * n, tempM.begin() + beginI * n);
+                advect_smoke_rows(stepDt, std::max(beginI, 1), std::min(endI, this->numX - 1), tempU.data(), tempV.data());
+            }
+            if ((this->outputs & OUTPUT_VORTICITY) != 0)
+                vorticity_rows(beginI, endI, tempU.data(), tempV.data());
+            if ((this->outputs & OUTPUT_STATS) != 0)
+            {
+                const float* mField = (this->outputs & OUTPUT_SMOKE) != 0 ? tempM.data() : this->m.data();
+                accumulate_stats_rows(beginI, endI, tempU.data(), tempV.data(), mField, blockStats[b]);
+            }
+        }, block_worker(b, numBlocks)));
+        stepGraph.add_dependency(velTasks[b], smokeTasks.back());
+        if (b + 1 < numBlocks)
+        {
+            stepGraph.add_dependency(velTasks[b + 1], smokeTasks.back());
+        }
+        if (b > 0)
+        {
+            stepGraph.add_dependency(velTasks[b - 1], smokeTasks.back());
+        }
+    }
+
+    TaskGraph::TaskId commit = stepGraph.add_task([this] {
+        this->u.swap(tempU);
+        this->v.swap(tempV);
+        if ((this->outputs & OUTPUT_SMOKE) != 0)
+            this->m.swap(tempM);
+
+        stats.valid = false;
+        if ((this->outputs & OUTPUT_STATS) != 0)
+        {
+            stats = pendingStats;
+            for (const FieldStats& partial : blockStats)
+            {
+                stats.merge_velocity_and_smoke(partial);
+            }
+            stats.maxSpeed = std::sqrt(stats.maxSpeed);
+            stats.valid = true;
+        }
+
+        if (stageTimersEnabled)
+        {
+            // One sample per split stage: the sum over its blocks.
+            const TimedStage blockStages[numBlockStages]{STAGE_INTEGRATE, STAGE_ADVECT_VEL, STAGE_OUTPUTS};
+            for (int k{0}; k < numBlockStages; ++k)
+            {
+                uint64_t ns{0};
+                for (size_t b{0}; b < blockStats.size(); ++b)
+                {
+                    ns += blockStageNs[b * numBlockStages + k];
+                }
+                stage_timers().record(blockStages[k], ns);
+            }
+        }
+    });
+
+    for (TaskGraph::TaskId id : velTasks)
+    {
+        stepGraph.add_dependency(id, commit);
+    }
+    for (TaskGraph::TaskId id : smokeTasks)
+    {
+        stepGraph.add_dependency(id, commit);
+    }
+}
+
+// Blocks are dealt to workers in contiguous runs, so each worker keeps the
+// same slice of every field from step to step.
+int Fluid::block_worker(int block, int numBlocks) const
+{
+    int numThreads = static_cast<int>(this->scheduler->num_threads());
+    return static_cast<int>(static_cast<long>(block) * numThreads / numBlocks);
+}
+
+// Re-faults every field page on the worker that will run the row block the
+// page belongs to. The constructor zero-fills the fields from one thread,
+// which puts all of them on that thread's NUMA node; here each field is saved,
+// its pages dropped, and the contents written back block by block through the
+// scheduler so the first touch after the drop matches the kernels' row
+// partitioning. Call it after setting the scheduler; contents are preserved.
+void Fluid::distribute_pages()
+{
+    distribute_pages(nullptr, nullptr, nullptr, nullptr, nullptr);
+}
+
+// A field without a source is saved and written back from the copy.
+void Fluid::distribute_pages(const float* uSource, const float* vSource, const float* pSource, const float* sSource,
+                             const float* mSource)
+{
+    std::vector<float>* fields[]{&u, &v, &newU, &newV, &p, &s, &m, &newM, &tempU, &tempV, &tempM};
+    const float* sources[]{uSource, vSource, nullptr, nullptr, pSource, sSource, mSource, nullptr, nullptr, nullptr,
+                           nullptr};
+
+    if (this->scheduler == nullptr)
+    {
+        for (size_t k{0}; k < 11; ++k)
+        {
+            if (sources[k] != nullptr)
+            {
+                std::copy(sources[k], sources[k] + fields[k]->size(), fields[k]->begin());
+            }
+        }
+        return;
+    }
+
+    tempU.resize(this->numCells);
+    tempV.resize(this->numCells);
+    tempM.resize(this->numCells);
+
+    int numBlocks = (this->numX + this->rowsPerTask - 1) / this->rowsPerTask;
+    size_t n = this->numY;
+    std::vector<float> saved;
+
+    for (size_t k{0}; k < 11; ++k)
+    {
+        std::vector<float>* field = fields[k];
+        const float* source = sources[k];
+        if (source == nullptr)
+        {
+            saved = *field;
+            source = saved.data();
+        }
+        release_pages(field->data(), field->size() * sizeof(float));
+
+        TaskGraph touch;
+        for (int b{0}; b < numBlocks; ++b)
+        {
+            size_t begin = b * this->rowsPerTask * n;
+            size_t end = std::min<size_t>((b + 1) * this->rowsPerTask * n, field->size());
+            touch.add_task([field, source, begin, end] {
+                std::copy(source + begin, source + end, field->begin() + begin);
+            }, block_worker(b, numBlocks));
+        }
+        this->scheduler->run(touch);
+    }
+}
+
+std::string Fluid::placement_report() const
+{
+    const std::vector<float>* fields[]{&u, &v, &newU, &newV, &p, &s, &m, &newM, &tempU, &tempV, &tempM};
+    const char* names[]{"u", "v", "newU", "newV", "p", "s", "m", "newM", "tempU", "tempV", "tempM"};
+    std::string report;
+
+    for (size_t k{0}; k < 11; ++k)
+    {
+        report += placement_summary(names[k], fields[k]->data(), fields[k]->size() * sizeof(float)) + "\n";
+    }
+    return report;
 }
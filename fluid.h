@@ -1,7 +1,11 @@
 #ifndef TMP_IMPL_HPP
 #define TMP_IMPL_HPP
+#include <string>
 #include <vector>
-
+#include "field_stats.h"
+#include "fluid_outputs.h"
+#include "stage_timers.h"
+#include "task_scheduler.h"
 
 class Fluid
 {
@@ -20,6 +24,11 @@ public:
     float sumOfAllNeighbours;
     float overRelaxation{1.9};
 
+    unsigned outputs{OUTPUT_ALL}; // FluidOutput bits the next step produces
+
+    TaskScheduler* scheduler{nullptr};
+    int rowsPerTask{16};
+
     std::vector<float> u;
     std::vector<float> v;
     std::vector<float> newU;
@@ -28,6 +37,7 @@ public:
     std::vector<float> s;
     std::vector<float> m;
     std::vector<float> newM;
+    std::vector<float> vorticity; // at cell corners, (i, j) at x = i * h, y = j * h
 
     std::vector<float> tempU;
     std::vector<float> tempV;
@@ -41,23 +51,59 @@ public:
     }neighbours;
 
     void integrate(float dt, float gravity);
+    void integrate_rows(float dt, float gravity, int beginI, int endI);
     void solve_incompressibility(size_t numIters, float dt);
+    void solve_incompressibility_sweep(float cp, int beginI, int endI, FieldStats* stats = nullptr);
     float sum_of_all_neighbours(int i, int j, int n);
     void update_solve_incompressibilitys_vectors(float cp, int i, int j, int n);
     void extrapolate();
     void extrapolate_horizontal_velocity(int i, int gridSizeY);
     void extrapolate_vertical_velocity(int j, int gridSizeY);
-    float sample_field(float x, float y, int field);
+    float sample_field(float x, float y, int field) const;
     float avg_u(size_t i, size_t j);
     float avg_v(size_t i, size_t j);
     void advect_vel(float dt);
+    void advect_vel_rows(float dt, int beginI, int endI);
     void compute_u_for_advect_velocity(int i, int j, float h2, int gridSizeY, float dt);
     void compute_v_for_advect_velocity(int i, int j, float h2, int gridSizeY, float dt);
     void advect_smoke(float dt);
+    void advect_smoke_rows(float dt, int beginI, int endI, const float* uField, const float* vField);
     void compute_m_for_advect_smoke(int i, int j, float h2, int gridSizeY, float dt);
+    void compute_m_for_advect_smoke(int i, int j, float h2, int gridSizeY, float dt, const float* uField, const float* vField);
     void simulate(float dt, float gravity, size_t numIters);
+    void simulate_with_scheduler(float dt, float gravity, size_t numIters);
+    void distribute_pages();
+    // distribute_pages() for a fluid filled from outside: u, v, p, s and m are
+    // copied from the given arrays (numCells floats each) straight into their
+    // placed pages, so each source is read once by the worker owning the block.
+    void distribute_pages(const float* uSource, const float* vSource, const float* pSource, const float* sSource,
+                          const float* mSource);
+    std::string placement_report() const;
+    void vorticity_rows(int beginI, int endI, const float* uField, const float* vField);
+    void accumulate_stats_rows(int beginI, int endI, const float* uField, const float* vField, const float* mField, FieldStats& partial) const;
+    // Statistics of the last simulate() step, free to read between steps.
+    const FieldStats& field_stats() const { return stats; }
     void set_v_velocity(size_t i, size_t j, float value);
     void set_u_velocity(size_t i, size_t j, float value);
     void set_s_velocity(size_t i, size_t j, float value);
+
+private:
+    TaskGraph stepGraph;
+    int stepGraphBlocks{0};
+    const Fluid* stepGraphOwner{nullptr};
+    float stepDt{0.0};
+    float stepGravity{0.0};
+    size_t stepNumIters{0};
+    FieldStats stats;
+    FieldStats pendingStats; // pressure half, filled by the last solve sweep
+    std::vector<FieldStats> blockStats;
+    // Task time per block of integrate, advect_vel and the outputs, summed
+    // into one sample each when the step commits.
+    static constexpr int numBlockStages{3};
+    std::vector<uint64_t> blockStageNs;
+
+    void build_step_graph(int numBlocks);
+    int block_worker(int block, int numBlocks) const;
+    uint64_t& block_stage_ns(int block, int stage) { return blockStageNs[block * numBlockStages + stage]; }
 };
 #endif // TMP_IMPL_HPP
@@ -0,0 +1,59 @@
+#ifndef FLUID_OUTPUTS_H
+#define FLUID_OUTPUTS_H
+
+// Derived fields and reductions a step can produce. None of them feeds back
+// into the velocity solve, so the solver may skip any nobody reads.
+enum FluidOutput : unsigned {
+    OUTPUT_PRESSURE = 1u << 0,  // Fluid::p
+    OUTPUT_SMOKE = 1u << 1,     // Fluid::m advection
+    OUTPUT_VORTICITY = 1u << 2, // Fluid::vorticity
+    OUTPUT_STATS = 1u << 3,     // Fluid::field_stats(); implies pressure and smoke
+    OUTPUT_ALL = (1u << 4) - 1
+};
+
+// Counts the consumers (renderer, recorders, analysis) subscribed to each
+// output. Until demandDriven is switched on every output is produced, which
+// keeps headless tools and existing callers unchanged.
+class OutputDemand
+{
+public:
+    bool demandDriven{false};
+
+    void subscribe(unsigned outputs)
+    {
+        for (int k{0}; k < numOutputs; ++k)
+        {
+            counts[k] += (outputs >> k) & 1u;
+        }
+    }
+
+    void unsubscribe(unsigned outputs)
+    {
+        for (int k{0}; k < numOutputs; ++k)
+        {
+            if (((outputs >> k) & 1u) != 0 && counts[k] > 0)
+            {
+                counts[k]--;
+            }
+        }
+    }
+
+    unsigned active() const
+    {
+        if (!demandDriven)
+        {
+            return OUTPUT_ALL;
+        }
+        unsigned outputs{0};
+        for (int k{0}; k < numOutputs; ++k)
+        {
+            outputs |= counts[k] > 0 ? 1u << k : 0u;
+        }
+        return (outputs & OUTPUT_STATS) != 0 ? outputs | OUTPUT_PRESSURE | OUTPUT_SMOKE : outputs;
+    }
+
+private:
+    static constexpr int numOutputs{4};
+    int counts[numOutputs]{};
+};
+#endif // FLUID_OUTPUTS_H
@@ -0,0 +1,382 @@
+#include "frame_recorder.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+void put_varint(std::vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool get_varint(const uint8_t*& in, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (int shift{0}; shift < 35 && in < end; shift += 7)
+    {
+        uint8_t byte = *in++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unzigzag(uint32_t value)
+{
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+const std::vector<float>& field_of(const Fluid& f, int field)
+{
+    switch (field)
+    {
+        case FRAME_M: return f.m;
+        case FRAME_P: return f.p;
+        case FRAME_U: return f.u;
+        default: return f.v;
+    }
+}
+
+}
+
+FrameRecorder::FrameRecorder(size_t numBuffers)
+  : buffers(std::max<size_t>(numBuffers, 1))
+{
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    close();
+}
+
+bool FrameRecorder::open(const std::string& path, int interval, std::string& error)
+{
+    close();
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        error = "cannot create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    uint32_t version = frameStreamVersion;
+    uint32_t numFields = frameNumFields;
+    std::fwrite(frameStreamMagic, sizeof(frameStreamMagic), 1, file);
+    std::fwrite(&version, sizeof(version), 1, file);
+    std::fwrite(&numFields, sizeof(numFields), 1, file);
+
+    this->interval = std::max(interval, 1);
+    stopping = false;
+    framesWritten = 0;
+    framesDropped = 0;
+    bytesWritten = sizeof(frameStreamMagic) + sizeof(version) + sizeof(numFields);
+    previousNumX = 0;
+    previousNumY = 0;
+    framesSinceKey = 0;
+    freeBuffers.clear();
+    fullBuffers.clear();
+    for (Buffer& buffer : buffers)
+    {
+        freeBuffers.push_back(&buffer);
+    }
+
+    writer = std::thread(&FrameRecorder::writer_loop, this);
+    return true;
+}
+
+bool FrameRecorder::record(const Fluid& f, int frameNr)
+{
+    if (file == nullptr || frameNr % interval != 0)
+    {
+        return false;
+    }
+
+    Buffer* buffer{nullptr};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeBuffers.empty())
+        {
+            framesDropped++;
+            return false;
+        }
+        buffer = freeBuffers.front();
+        freeBuffers.pop_front();
+    }
+
+    buffer->frameNr = frameNr;
+    buffer->numX = f.numX;
+    buffer->numY = f.numY;
+    for (int k{0}; k < frameNumFields; ++k)
+    {
+        const std::vector<float>& field = field_of(f, k);
+        buffer->fields[k].resize(field.size());
+        std::memcpy(buffer->fields[k].data(), field.data(), field.size() * sizeof(float));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fullBuffers.push_back(buffer);
+    }
+    wake.notify_one();
+    return true;
+}
+
+void FrameRecorder::close()
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    std::fclose(file);
+    file = nullptr;
+}
+
+size_t FrameRecorder::frames_written() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return framesWritten;
+}
+
+size_t FrameRecorder::frames_dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return framesDropped;
+}
+
+size_t FrameRecorder::bytes_written() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesWritten;
+}
+
+void FrameRecorder::writer_loop()
+{
+    while (true)
+    {
+        Buffer* buffer{nullptr};
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !fullBuffers.empty(); });
+            if (fullBuffers.empty())
+            {
+                return;
+            }
+            buffer = fullBuffers.front();
+            fullBuffers.pop_front();
+        }
+
+        encode(*buffer);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        freeBuffers.push_back(buffer);
+    }
+}
+
+void FrameRecorder::encode(Buffer& buffer)
+{
+    size_t numCells = static_cast<size_t>(buffer.numX) * buffer.numY;
+    bool keyFrame = framesSinceKey == 0 || buffer.numX != previousNumX || buffer.numY != previousNumY;
+    float low[frameNumFields];
+    float high[frameNumFields];
+    for (int k{0}; k < frameNumFields; ++k)
+    {
+        auto range = std::minmax_element(buffer.fields[k].begin(), buffer.fields[k].end());
+        low[k] = *range.first;
+        high[k] = *range.second;
+        keyFrame = keyFrame || low[k] < rangeMin[k] || high[k] > rangeMax[k];
+    }
+    if (keyFrame)
+    {
+        for (int k{0}; k < frameNumFields; ++k)
+        {
+            float margin = frameRangeMargin * (high[k] - low[k]);
+            rangeMin[k] = low[k] - margin;
+            rangeMax[k] = high[k] + margin;
+        }
+    }
+    framesSinceKey = keyFrame ? 1 : (framesSinceKey + 1) % frameKeyInterval;
+    previousNumX = buffer.numX;
+    previousNumY = buffer.numY;
+
+    FrameChunkHeader header{};
+    header.frameNr = buffer.frameNr;
+    header.numX = buffer.numX;
+    header.numY = buffer.numY;
+    header.keyFrame = keyFrame ? 1 : 0;
+
+    quantised.resize(numCells);
+    for (int k{0}; k < frameNumFields; ++k)
+    {
+        const std::vector<float>& field = buffer.fields[k];
+        float minValue = rangeMin[k];
+        float range = rangeMax[k] - rangeMin[k];
+        float scale = range > 0.0f ? 65535.0f / range : 0.0f;
+        header.minValue[k] = minValue;
+        header.maxValue[k] = rangeMax[k];
+
+        for (size_t c{0}; c < numCells; ++c)
+        {
+            quantised[c] = static_cast<uint16_t>(std::lround((field[c] - minValue) * scale));
+        }
+
+        std::vector<uint16_t>& base = previous[k];
+        if (keyFrame)
+        {
+            base.assign(numCells, 0);
+        }
+
+        std::vector<uint8_t>& out = payload[k];
+        out.clear();
+        for (size_t c{0}; c < numCells;)
+        {
+            uint32_t value = zigzag(static_cast<int32_t>(quantised[c]) - base[c]);
+            if (value != 0)
+            {
+                put_varint(out, value);
+                c++;
+                continue;
+            }
+
+            size_t run{1};
+            while (c + run < numCells && quantised[c + run] == base[c + run])
+            {
+                run++;
+            }
+            put_varint(out, 0);
+            put_varint(out, static_cast<uint32_t>(run - 1));
+            c += run;
+        }
+        header.payloadBytes[k] = static_cast<uint32_t>(out.size());
+        base.swap(quantised);
+        quantised.resize(numCells);
+    }
+
+    size_t bytes = std::fwrite(&header, sizeof(header), 1, file) * sizeof(header);
+    for (int k{0}; k < frameNumFields; ++k)
+    {
+        bytes += std::fwrite(payload[k].data(), 1, payload[k].size(), file);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    framesWritten++;
+    bytesWritten += bytes;
+}
+
+FrameReader::~FrameReader()
+{
+    if (file != nullptr)
+    {
+        std::fclose(file);
+    }
+}
+
+bool FrameReader::open(const std::string& path, std::string& error)
+{
+    file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        error = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    char magic[sizeof(frameStreamMagic)];
+    uint32_t version{0};
+    uint32_t numFields{0};
+    bool ok = std::fread(magic, sizeof(magic), 1, file) == 1
+              && std::fread(&version, sizeof(version), 1, file) == 1
+              && std::fread(&numFields, sizeof(numFields), 1, file) == 1;
+    if (!ok || std::memcmp(magic, frameStreamMagic, sizeof(magic)) != 0)
+    {
+        error = path + " is not a frame stream";
+        return false;
+    }
+    if (version != frameStreamVersion || numFields != frameNumFields)
+    {
+        error = path + " has unsupported frame stream version " + std::to_string(version);
+        return false;
+    }
+    return true;
+}
+
+bool FrameReader::next(FrameChunkHeader& header, std::vector<float> fields[frameNumFields], std::string& error)
+{
+    if (file == nullptr || std::fread(&header, sizeof(header), 1, file) != 1)
+    {
+        return false;
+    }
+
+    size_t numCells = static_cast<size_t>(header.numX) * header.numY;
+    for (int k{0}; k < frameNumFields; ++k)
+    {
+        std::vector<uint16_t>& base = previous[k];
+        if (header.keyFrame != 0)
+        {
+            base.assign(numCells, 0);
+        }
+        else if (base.size() != numCells)
+        {
+            error = "delta frame " + std::to_string(header.frameNr) + " has no matching key frame";
+            return false;
+        }
+
+        payload.resize(header.payloadBytes[k]);
+        if (std::fread(payload.data(), 1, payload.size(), file) != payload.size())
+        {
+            error = "frame " + std::to_string(header.frameNr) + " is truncated";
+            return false;
+        }
+
+        const uint8_t* in = payload.data();
+        const uint8_t* end = in + payload.size();
+        for (size_t c{0}; c < numCells;)
+        {
+            uint32_t value{0};
+            uint32_t run{0};
+            if (!get_varint(in, end, value) || (value == 0 && (!get_varint(in, end, run) || c + run >= numCells)))
+            {
+                error = "frame " + std::to_string(header.frameNr) + " has a corrupt payload";
+                return false;
+            }
+            if (value == 0)
+            {
+                c += run + 1;
+                continue;
+            }
+            base[c] = static_cast<uint16_t>(base[c] + unzigzag(value));
+            c++;
+        }
+
+        float range = header.maxValue[k] - header.minValue[k];
+        fields[k].resize(numCells);
+        for (size_t c{0}; c < numCells; ++c)
+        {
+            fields[k][c] = header.minValue[k] + base[c] * range / 65535.0f;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,117 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fluid.h"
+
+// Frame stream layout, version 1:
+//   file:  magic "EFSFRAME", uint32 version, uint32 numFields
+//   frame: FrameChunkHeader, then numFields encoded field payloads
+// Each field is quantised to 16 bits over the [min, max] range in the chunk
+// header. A key frame picks that range from its own values, widened by a
+// margin; the delta frames after it keep the range, so unchanged values keep
+// their codes, until a value leaves it and forces the next key frame. Key
+// frames store the quantised values, other frames the difference to the
+// previous frame. Values are zigzag varints, and a zero value is followed by a
+// varint holding the length of the zero run minus one.
+constexpr char frameStreamMagic[8]{'E', 'F', 'S', 'F', 'R', 'A', 'M', 'E'};
+constexpr uint32_t frameStreamVersion{1};
+constexpr int frameNumFields{4};
+constexpr int frameKeyInterval{32};
+constexpr float frameRangeMargin{0.125f}; // of the key frame's range, each side
+
+enum FrameField { FRAME_M, FRAME_P, FRAME_U, FRAME_V };
+
+struct FrameChunkHeader {
+    int32_t frameNr;
+    int32_t numX;
+    int32_t numY;
+    uint32_t keyFrame;
+    float minValue[frameNumFields];
+    float maxValue[frameNumFields];
+    uint32_t payloadBytes[frameNumFields];
+};
+
+// Records every Nth frame of m, p, u and v. record() runs on the simulation
+// thread and only copies the fields into a preallocated buffer; encoding and
+// file output happen on a background writer thread. When every buffer is still
+// queued the frame is dropped rather than stalling the step.
+class FrameRecorder
+{
+public:
+    explicit FrameRecorder(size_t numBuffers = 4);
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    bool open(const std::string& path, int interval, std::string& error);
+    bool record(const Fluid& f, int frameNr);
+    void close();
+
+    bool is_open() const { return file != nullptr; }
+    size_t frames_written() const;
+    size_t frames_dropped() const;
+    size_t bytes_written() const;
+
+private:
+    struct Buffer {
+        int frameNr{0};
+        int numX{0};
+        int numY{0};
+        std::vector<float> fields[frameNumFields];
+    };
+
+    void writer_loop();
+    void encode(Buffer& buffer);
+
+    FILE* file{nullptr};
+    int interval{1};
+    std::vector<Buffer> buffers;
+    std::deque<Buffer*> freeBuffers;
+    std::deque<Buffer*> fullBuffers;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::thread writer;
+    bool stopping{false};
+    size_t framesWritten{0};
+    size_t framesDropped{0};
+    size_t bytesWritten{0};
+
+    // Writer thread state: the previous frame's quantised fields, the delta base.
+    std::vector<uint16_t> previous[frameNumFields];
+    int previousNumX{0};
+    int previousNumY{0};
+    int framesSinceKey{0};
+    float rangeMin[frameNumFields]{};
+    float rangeMax[frameNumFields]{};
+    std::vector<uint16_t> quantised;
+    std::vector<uint8_t> payload[frameNumFields];
+};
+
+// Sequential decoder for a frame stream.
+class FrameReader
+{
+public:
+    FrameReader() = default;
+    ~FrameReader();
+
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    // Returns false at the end of the stream or on a corrupt frame (error set).
+    bool next(FrameChunkHeader& header, std::vector<float> fields[frameNumFields], std::string& error);
+
+private:
+    FILE* file{nullptr};
+    std::vector<uint16_t> previous[frameNumFields];
+    std::vector<uint8_t> payload;
+};
+#endif // FRAME_RECORDER_H
@@ -0,0 +1,459 @@
+#include "halo_transport.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#ifdef FLUID_WITH_MPI
+#include <mpi.h>
+#endif
+
+template <typename Combine>
+bool HaloTransport::reduce(double& value, Combine combine)
+{
+    if (has_left())
+    {
+        double partial{0.0};
+        if (!recv(rank() - 1, &partial, sizeof(partial)))
+        {
+            return false;
+        }
+        value = combine(value, partial);
+    }
+    if (has_right())
+    {
+        if (!send(rank() + 1, &value, sizeof(value)) || !recv(rank() + 1, &value, sizeof(value)))
+        {
+            return false;
+        }
+    }
+    return !has_left() || send(rank() - 1, &value, sizeof(value));
+}
+
+bool HaloTransport::reduce_sum(double& value)
+{
+    return reduce(value, [](double a, double b) { return a + b; });
+}
+
+bool HaloTransport::reduce_max(double& value)
+{
+    return reduce(value, [](double a, double b) { return std::max(a, b); });
+}
+
+namespace
+{
+
+struct Mailbox {
+    std::atomic<uint32_t> full;
+    uint32_t bytes;
+};
+
+size_t mailbox_stride(size_t capacity)
+{
+    return (sizeof(Mailbox) + capacity + 63) / 64 * 64;
+}
+
+void wait_for(const std::atomic<uint32_t>& flag, uint32_t value)
+{
+    int spins{0};
+    while (flag.load(std::memory_order_acquire) != value)
+    {
+        if (++spins > 256)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+}
+
+struct SharedMemoryTransport::Region {
+    int numRanks;
+    size_t capacity;
+    size_t mappedBytes;
+
+    // Mailbox 2 * r carries messages from rank r to r - 1, 2 * r + 1 from r
+    // to r + 1.
+    Mailbox* mailbox(int sender, bool toRight)
+    {
+        char* base = reinterpret_cast<char*>(this) + 64;
+        return reinterpret_cast<Mailbox*>(base + (2 * sender + (toRight ? 1 : 0)) * mailbox_stride(capacity));
+    }
+};
+
+SharedMemoryTransport::Region* SharedMemoryTransport::create_region(int numRanks, size_t capacity)
+{
+    size_t bytes = 64 + 2 * numRanks * mailbox_stride(capacity);
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (memory == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    Region* region = static_cast<Region*>(memory);
+    region->numRanks = numRanks;
+    region->capacity = capacity;
+    region->mappedBytes = bytes;
+
+    for (int r{0}; r < numRanks; ++r)
+    {
+        new (region->mailbox(r, false)) Mailbox{{0}, 0};
+        new (region->mailbox(r, true)) Mailbox{{0}, 0};
+    }
+    return region;
+}
+
+void SharedMemoryTransport::destroy_region(Region* region)
+{
+    if (region != nullptr)
+    {
+        munmap(region, region->mappedBytes);
+    }
+}
+
+SharedMemoryTransport::SharedMemoryTransport(Region* region, int rank)
+    : region(region), myRank(rank)
+{
+}
+
+int SharedMemoryTransport::rank() const
+{
+    return myRank;
+}
+
+int SharedMemoryTransport::size() const
+{
+    return region->numRanks;
+}
+
+bool SharedMemoryTransport::exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes)
+{
+    if (region->capacity == 0)
+    {
+        return bytes == 0;
+    }
+
+    // Large halos go through the single-slot mailboxes in capacity sized
+    // chunks; posting both sends before either receive keeps the chain from
+    // deadlocking.
+    for (size_t offset{0}; offset < bytes; offset += region->capacity)
+    {
+        size_t chunk = std::min(region->capacity, bytes - offset);
+        bool ok{true};
+
+        if (has_left())
+        {
+            ok = send(myRank - 1, static_cast<const char*>(sendLeft) + offset, chunk) && ok;
+        }
+        if (has_right())
+        {
+            ok = send(myRank + 1, static_cast<const char*>(sendRight) + offset, chunk) && ok;
+        }
+        if (!ok)
+        {
+            // Waiting for the replies could block forever.
+            return false;
+        }
+        if (has_left())
+        {
+            ok = recv(myRank - 1, static_cast<char*>(recvLeft) + offset, chunk) && ok;
+        }
+        if (has_right())
+        {
+            ok = recv(myRank + 1, static_cast<char*>(recvRight) + offset, chunk) && ok;
+        }
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SharedMemoryTransport::send(int neighbour, const void* data, size_t bytes)
+{
+    if (bytes > region->capacity)
+    {
+        return false;
+    }
+
+    Mailbox* box = region->mailbox(myRank, neighbour > myRank);
+    wait_for(box->full, 0);
+    box->bytes = static_cast<uint32_t>(bytes);
+    std::memcpy(reinterpret_cast<char*>(box) + sizeof(Mailbox), data, bytes);
+    box->full.store(1, std::memory_order_release);
+    return true;
+}
+
+bool SharedMemoryTransport::recv(int neighbour, void* data, size_t bytes)
+{
+    Mailbox* box = region->mailbox(neighbour, neighbour < myRank);
+    wait_for(box->full, 1);
+    bool ok = box->bytes == bytes;
+    std::memcpy(data, reinterpret_cast<char*>(box) + sizeof(Mailbox), std::min<size_t>(bytes, box->bytes));
+    box->full.store(0, std::memory_order_release);
+    return ok;
+}
+
+SocketTransport::SocketTransport(int rank, int numRanks, int basePort)
+    : myRank(rank), numRanks(numRanks)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one{1};
+
+    int listenFd{-1};
+    if (has_right())
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        address.sin_port = htons(basePort + rank);
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 1) != 0)
+        {
+            close(listenFd);
+            listenFd = -1;
+        }
+    }
+
+    if (has_left())
+    {
+        address.sin_port = htons(basePort + rank - 1);
+        for (int attempt{0}; attempt < 500 && leftFd < 0; ++attempt)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+            {
+                leftFd = fd;
+            }
+            else
+            {
+                close(fd);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    }
+
+    if (listenFd >= 0)
+    {
+        rightFd = accept(listenFd, nullptr, nullptr);
+        close(listenFd);
+    }
+
+    for (int fd : {leftFd, rightFd})
+    {
+        if (fd >= 0)
+        {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+    }
+}
+
+SocketTransport::~SocketTransport()
+{
+    if (leftFd >= 0)
+    {
+        close(leftFd);
+    }
+    if (rightFd >= 0)
+    {
+        close(rightFd);
+    }
+}
+
+bool SocketTransport::connected() const
+{
+    return (!has_left() || leftFd >= 0) && (!has_right() || rightFd >= 0);
+}
+
+int SocketTransport::rank() const
+{
+    return myRank;
+}
+
+int SocketTransport::size() const
+{
+    return numRanks;
+}
+
+int SocketTransport::fd_for(int neighbour) const
+{
+    return neighbour < myRank ? leftFd : rightFd;
+}
+
+bool SocketTransport::exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes)
+{
+    // Sends and receives on both sockets are interleaved with poll() so two
+    // neighbours pushing large halos at each other cannot fill both kernel
+    // buffers and deadlock.
+    struct Stream {
+        int fd;
+        const char* out;
+        char* in;
+        size_t sent;
+        size_t received;
+    };
+
+    Stream streams[2]{
+        {has_left() ? leftFd : -1, static_cast<const char*>(sendLeft), static_cast<char*>(recvLeft), 0, 0},
+        {has_right() ? rightFd : -1, static_cast<const char*>(sendRight), static_cast<char*>(recvRight), 0, 0}
+    };
+
+    while (true)
+    {
+        pollfd fds[2];
+        int count{0};
+        int owner[2];
+
+        for (int k{0}; k < 2; ++k)
+        {
+            Stream& s = streams[k];
+            if (s.fd < 0 || (s.sent == bytes && s.received == bytes))
+            {
+                continue;
+            }
+            fds[count].fd = s.fd;
+            fds[count].events = static_cast<short>((s.sent < bytes ? POLLOUT : 0) | (s.received < bytes ? POLLIN : 0));
+            fds[count].revents = 0;
+            owner[count++] = k;
+        }
+
+        if (count == 0)
+        {
+            return true;
+        }
+
+        if (poll(fds, count, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        for (int k{0}; k < count; ++k)
+        {
+            Stream& s = streams[owner[k]];
+            if (fds[k].revents & (POLLERR | POLLHUP | POLLNVAL))
+            {
+                if (!(fds[k].revents & POLLIN))
+                {
+                    return false;
+                }
+            }
+            if ((fds[k].revents & POLLOUT) && s.sent < bytes)
+            {
+                ssize_t n = ::send(s.fd, s.out + s.sent, bytes - s.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n > 0)
+                {
+                    s.sent += n;
+                }
+            }
+            if ((fds[k].revents & POLLIN) && s.received < bytes)
+            {
+                ssize_t n = ::recv(s.fd, s.in + s.received, bytes - s.received, MSG_DONTWAIT);
+                if (n == 0)
+                {
+                    return false;
+                }
+                if (n > 0)
+                {
+                    s.received += n;
+                }
+            }
+        }
+    }
+}
+
+bool SocketTransport::send(int neighbour, const void* data, size_t bytes)
+{
+    int fd = fd_for(neighbour);
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0)
+    {
+        ssize_t n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+bool SocketTransport::recv(int neighbour, void* data, size_t bytes)
+{
+    int fd = fd_for(neighbour);
+    char* p = static_cast<char*>(data);
+    while (bytes > 0)
+    {
+        ssize_t n = ::recv(fd, p, bytes, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+#ifdef FLUID_WITH_MPI
+MpiTransport::MpiTransport()
+{
+    MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+}
+
+int MpiTransport::rank() const
+{
+    return myRank;
+}
+
+int MpiTransport::size() const
+{
+    return numRanks;
+}
+
+bool MpiTransport::exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes)
+{
+    MPI_Request requests[4];
+    int count{0};
+    int n = static_cast<int>(bytes);
+
+    if (has_left())
+    {
+        MPI_Irecv(recvLeft, n, MPI_BYTE, myRank - 1, 0, MPI_COMM_WORLD, &requests[count++]);
+        MPI_Isend(sendLeft, n, MPI_BYTE, myRank - 1, 0, MPI_COMM_WORLD, &requests[count++]);
+    }
+    if (has_right())
+    {
+        MPI_Irecv(recvRight, n, MPI_BYTE, myRank + 1, 0, MPI_COMM_WORLD, &requests[count++]);
+        MPI_Isend(sendRight, n, MPI_BYTE, myRank + 1, 0, MPI_COMM_WORLD, &requests[count++]);
+    }
+    return MPI_Waitall(count, requests, MPI_STATUSES_IGNORE) == MPI_SUCCESS;
+}
+
+bool MpiTransport::send(int neighbour, const void* data, size_t bytes)
+{
+    return MPI_Send(data, static_cast<int>(bytes), MPI_BYTE, neighbour, 1, MPI_COMM_WORLD) == MPI_SUCCESS;
+}
+
+bool MpiTransport::recv(int neighbour, void* data, size_t bytes)
+{
+    return MPI_Recv(data, static_cast<int>(bytes), MPI_BYTE, neighbour, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+}
+#endif
@@ -0,0 +1,99 @@
+#ifndef HALO_TRANSPORT_H
+#define HALO_TRANSPORT_H
+#include <cstddef>
+
+// Moves ghost layers between neighbouring slabs of a decomposed domain. Ranks
+// form a chain: rank r only talks to r - 1 (left) and r + 1 (right).
+class HaloTransport
+{
+public:
+    virtual ~HaloTransport() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    // Sends and receives one block with each existing neighbour. Pointers for
+    // a missing neighbour (left of rank 0, right of the last rank) are ignored.
+    virtual bool exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes) = 0;
+
+    virtual bool send(int neighbour, const void* data, size_t bytes) = 0;
+    virtual bool recv(int neighbour, void* data, size_t bytes) = 0;
+
+    // Combine value over all ranks in place; false when a send or recv failed.
+    bool reduce_sum(double& value);
+    bool reduce_max(double& value);
+
+protected:
+    bool has_left() const { return rank() > 0; }
+    bool has_right() const { return rank() + 1 < size(); }
+
+private:
+    template <typename Combine>
+    bool reduce(double& value, Combine combine);
+};
+
+// Mailboxes in a MAP_SHARED anonymous mapping. The mapping must be created
+// before the ranks are forked (or shared between threads of one process).
+class SharedMemoryTransport : public HaloTransport
+{
+public:
+    struct Region;
+
+    static Region* create_region(int numRanks, size_t capacity);
+    static void destroy_region(Region* region);
+
+    SharedMemoryTransport(Region* region, int rank);
+
+    int rank() const override;
+    int size() const override;
+    bool exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes) override;
+    bool send(int neighbour, const void* data, size_t bytes) override;
+    bool recv(int neighbour, void* data, size_t bytes) override;
+
+private:
+    Region* region;
+    int myRank;
+};
+
+// TCP over localhost. Rank r listens on basePort + r for its right neighbour
+// and connects to basePort + r - 1 for its left one.
+class SocketTransport : public HaloTransport
+{
+public:
+    SocketTransport(int rank, int numRanks, int basePort);
+    ~SocketTransport() override;
+
+    bool connected() const;
+    int rank() const override;
+    int size() const override;
+    bool exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes) override;
+    bool send(int neighbour, const void* data, size_t bytes) override;
+    bool recv(int neighbour, void* data, size_t bytes) override;
+
+private:
+    int myRank;
+    int numRanks;
+    int leftFd{-1};
+    int rightFd{-1};
+
+    int fd_for(int neighbour) const;
+};
+
+#ifdef FLUID_WITH_MPI
+class MpiTransport : public HaloTransport
+{
+public:
+    MpiTransport();
+
+    int rank() const override;
+    int size() const override;
+    bool exchange(const void* sendLeft, void* recvLeft, const void* sendRight, void* recvRight, size_t bytes) override;
+    bool send(int neighbour, const void* data, size_t bytes) override;
+    bool recv(int neighbour, void* data, size_t bytes) override;
+
+private:
+    int myRank{0};
+    int numRanks{1};
+};
+#endif
+#endif // HALO_TRANSPORT_H
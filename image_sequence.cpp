@@ -0,0 +1,226 @@
+#include "image_sequence.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+// Reorders frame's pixels into TOP_DOWN rows, using scratch as the target.
+void make_top_down(ImageFrame& frame, std::vector<Rgba8>& scratch)
+{
+    if (frame.layout == ImageFrame::TOP_DOWN)
+    {
+        return;
+    }
+
+    size_t width = frame.width;
+    size_t height = frame.height;
+    scratch.resize(width * height);
+    for (size_t y{0}; y < height; ++y)
+    {
+        Rgba8* row = scratch.data() + y * width;
+        if (frame.layout == ImageFrame::BOTTOM_UP)
+        {
+            std::memcpy(row, frame.pixels.data() + (height - 1 - y) * width, width * sizeof(Rgba8));
+        }
+        else
+        {
+            // Field columns run bottom to top, so image row y is cell row height - 1 - y.
+            size_t j = height - 1 - y;
+            for (size_t x{0}; x < width; ++x)
+            {
+                row[x] = frame.pixels[x * height + j];
+            }
+        }
+    }
+    frame.pixels.swap(scratch);
+    frame.layout = ImageFrame::TOP_DOWN;
+}
+
+}
+
+bool write_ppm(const ImageFrame& frame, const std::string& path, std::string& error)
+{
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        error = "cannot create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    std::fprintf(file, "P6\n%d %d\n255\n", frame.width, frame.height);
+    std::vector<uint8_t> rgb(static_cast<size_t>(frame.width) * 3);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(frame.pixels.data());
+    for (int y{0}; y < frame.height; ++y)
+    {
+        for (int x{0}; x < frame.width; ++x)
+        {
+            const uint8_t* pixel = bytes + 4 * (static_cast<size_t>(y) * frame.width + x);
+            std::memcpy(&rgb[3 * x], pixel, 3);
+        }
+        std::fwrite(rgb.data(), 1, rgb.size(), file);
+    }
+
+    bool ok = std::ferror(file) == 0;
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        error = "cannot write " + path;
+    }
+    return ok;
+}
+
+void grid_image(const Fluid& f, const ColourOptions& options, int frameNr, ImageFrame& frame)
+{
+    frame.frameNr = frameNr;
+    frame.width = f.numX;
+    frame.height = f.numY;
+    frame.layout = ImageFrame::FIELD_ORDER;
+    colour_fluid(f, options, frame.pixels);
+}
+
+ImageSequenceWriter::ImageSequenceWriter(int numThreads, size_t numBuffers)
+  : numThreads(std::max(numThreads, 1)),
+    frames(std::max<size_t>(numBuffers, 1))
+{
+}
+
+ImageSequenceWriter::~ImageSequenceWriter()
+{
+    std::string error;
+    close(error);
+}
+
+bool ImageSequenceWriter::open(const std::string& prefix, const std::string& extension, ImageEncoder encoder,
+                               std::string& error)
+{
+    close(error);
+    error.clear();
+    if (!encoder)
+    {
+        error = "no encoder for ." + extension + " images";
+        return false;
+    }
+
+    this->prefix = prefix;
+    this->extension = extension;
+    this->encoder = std::move(encoder);
+    stopping = false;
+    framesWritten = 0;
+    numStalls = 0;
+    firstError.clear();
+    freeFrames.clear();
+    fullFrames.clear();
+    for (ImageFrame& frame : frames)
+    {
+        freeFrames.push_back(&frame);
+    }
+
+    for (int k{0}; k < numThreads; ++k)
+    {
+        workers.emplace_back(&ImageSequenceWriter::encoder_loop, this);
+    }
+    return true;
+}
+
+ImageFrame* ImageSequenceWriter::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (freeFrames.empty())
+    {
+        numStalls++;
+        frameFreed.wait(lock, [this] { return !freeFrames.empty(); });
+    }
+    ImageFrame* frame = freeFrames.front();
+    freeFrames.pop_front();
+    return frame;
+}
+
+void ImageSequenceWriter::submit(ImageFrame* frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fullFrames.push_back(frame);
+    }
+    wake.notify_one();
+}
+
+bool ImageSequenceWriter::close(std::string& error)
+{
+    if (workers.empty())
+    {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+
+    error = firstError;
+    return firstError.empty();
+}
+
+size_t ImageSequenceWriter::frames_written() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return framesWritten;
+}
+
+size_t ImageSequenceWriter::stalls() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numStalls;
+}
+
+std::string ImageSequenceWriter::path_for(int frameNr) const
+{
+    char number[16];
+    std::snprintf(number, sizeof(number), "%06d", frameNr);
+    return prefix + number + "." + extension;
+}
+
+void ImageSequenceWriter::encoder_loop()
+{
+    std::vector<Rgba8> scratch;
+    std::string error;
+    while (true)
+    {
+        ImageFrame* frame{nullptr};
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !fullFrames.empty(); });
+            if (fullFrames.empty())
+            {
+                return;
+            }
+            frame = fullFrames.front();
+            fullFrames.pop_front();
+        }
+
+        make_top_down(*frame, scratch);
+        bool ok = encoder(*frame, path_for(frame->frameNr), error);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ok)
+            {
+                framesWritten++;
+            }
+            else if (firstError.empty())
+            {
+                firstError = error;
+            }
+            freeFrames.push_back(frame);
+        }
+        frameFreed.notify_one();
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef IMAGE_SEQUENCE_H
+#define IMAGE_SEQUENCE_H
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "colour_map.h"
+
+// One exported picture. Renderers fill pixels in whichever order they have
+// them; encoders always see TOP_DOWN rows.
+struct ImageFrame {
+    enum Layout {
+        TOP_DOWN,    // row 0 is the top of the picture
+        BOTTOM_UP,   // as glReadPixels returns it
+        FIELD_ORDER  // colour_fluid output: cell (i, j) at i * height + j
+    };
+
+    int frameNr{0};
+    int width{0};
+    int height{0};
+    Layout layout{TOP_DOWN};
+    std::vector<Rgba8> pixels;
+};
+
+using ImageEncoder = std::function<bool(const ImageFrame& frame, const std::string& path, std::string& error)>;
+
+// Binary P6 PPM. Lossless, no compression, readable by ffmpeg as a sequence.
+bool write_ppm(const ImageFrame& frame, const std::string& path, std::string& error);
+
+// Colours the grid into frame, one pixel per cell, numX wide and numY high.
+void grid_image(const Fluid& f, const ColourOptions& options, int frameNr, ImageFrame& frame);
+
+// Writes numbered images (prefix000042.ppm, say) on a pool of encoder threads.
+// The producer acquires a free frame, fills it and submits it; encoding, file
+// output and reordering of the rows happen off its thread. Unlike the frame
+// recorder, a video must not lose frames, so acquire() waits for a buffer when
+// the encoders fall behind and counts those stalls.
+class ImageSequenceWriter
+{
+public:
+    explicit ImageSequenceWriter(int numThreads = 2, size_t numBuffers = 8);
+    ~ImageSequenceWriter();
+
+    ImageSequenceWriter(const ImageSequenceWriter&) = delete;
+    ImageSequenceWriter& operator=(const ImageSequenceWriter&) = delete;
+
+    bool open(const std::string& prefix, const std::string& extension, ImageEncoder encoder, std::string& error);
+    ImageFrame* acquire();
+    void submit(ImageFrame* frame);
+    // Waits for every submitted frame. Returns false, with the first encoder
+    // error, if any frame failed.
+    bool close(std::string& error);
+
+    bool is_open() const { return !workers.empty(); }
+    size_t frames_written() const;
+    size_t stalls() const;
+    std::string path_for(int frameNr) const;
+
+private:
+    void encoder_loop();
+
+    int numThreads{2};
+    std::string prefix;
+    std::string extension;
+    ImageEncoder encoder;
+    std::vector<ImageFrame> frames;
+    std::deque<ImageFrame*> freeFrames;
+    std::deque<ImageFrame*> fullFrames;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable frameFreed;
+    std::vector<std::thread> workers;
+    bool stopping{false};
+    size_t framesWritten{0};
+    size_t numStalls{0};
+    std::string firstError;
+};
+#endif // IMAGE_SEQUENCE_H
@@ -0,0 +1,250 @@
+#include "input_log.h"
+#include "checkpoint.h"
+#include "scene_file.h"
+#include <cerrno>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+const char* commandNames[]{"scene", "scenefile", "restart", "shape", "obstacle", "overrelax", "end"};
+
+}
+
+uint64_t state_hash(const Fluid& f)
+{
+    uint64_t hash{14695981039346656037ull};
+    for (const std::vector<float>* field : {&f.u, &f.v, &f.p, &f.m})
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(field->data());
+        for (size_t k{0}; k < field->size() * sizeof(float); ++k)
+        {
+            hash = (hash ^ bytes[k]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+InputRecorder::~InputRecorder()
+{
+    if (file != nullptr)
+    {
+        std::fclose(file);
+    }
+}
+
+bool InputRecorder::open(const std::string& path, const SimulationParameters& params, std::string& error)
+{
+    file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        error = "cannot create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    start = std::chrono::steady_clock::now();
+    std::fprintf(file, "# fluid input log 1\n");
+    record_scene(params);
+    record_shape(params);
+    return true;
+}
+
+void InputRecorder::close(const SimulationParameters& params)
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+    write(params.frameNr, "end %016" PRIx64, params.fluid != nullptr ? state_hash(*params.fluid) : 0);
+    std::fclose(file);
+    file = nullptr;
+}
+
+void InputRecorder::record_scene(const SimulationParameters& params)
+{
+    write(params.frameNr, "scene %d %d", params.sceneNr, params.resolution);
+}
+
+void InputRecorder::record_scene_file(const SimulationParameters& params, const std::string& path)
+{
+    write(params.frameNr, "scenefile %s", path.c_str());
+}
+
+void InputRecorder::record_restart(const SimulationParameters& params, const std::string& path)
+{
+    write(params.frameNr, "restart %s", path.c_str());
+}
+
+void InputRecorder::record_shape(const SimulationParameters& params)
+{
+    write(params.frameNr, "shape %d", params.shape);
+}
+
+void InputRecorder::record_obstacle(const SimulationParameters& params, float x, float y, bool reset)
+{
+    write(params.frameNr, "obstacle %.9g %.9g %d", x, y, reset ? 1 : 0);
+}
+
+void InputRecorder::record_overrelaxation(const SimulationParameters& params)
+{
+    write(params.frameNr, "overrelax %.17g", params.overRelaxation);
+}
+
+void InputRecorder::write(int frameNr, const char* format, ...)
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+    auto timeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(file, "%d %lld ", frameNr, static_cast<long long>(timeUs));
+
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(file, format, args);
+    va_end(args);
+    std::fputc('\n', file);
+}
+
+bool InputReplay::load(const std::string& path, std::string& error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    commands.clear();
+    next = 0;
+    done = false;
+
+    std::string line;
+    int lineNr{0};
+    while (std::getline(in, line))
+    {
+        lineNr++;
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::stringstream fields(line);
+        InputCommand command;
+        std::string name;
+        fields >> command.frameNr >> command.timeUs >> name;
+
+        int type{0};
+        while (type <= INPUT_END && name != commandNames[type])
+        {
+            type++;
+        }
+        command.type = static_cast<InputCommandType>(type);
+
+        bool ok = static_cast<bool>(fields) && type <= INPUT_END;
+        switch (command.type)
+        {
+            case INPUT_SCENE:
+                ok = ok && static_cast<bool>(fields >> command.value >> command.x);
+                break;
+            case INPUT_SCENE_FILE:
+            case INPUT_RESTART:
+                std::getline(fields >> std::ws, command.path);
+                ok = ok && !command.path.empty();
+                break;
+            case INPUT_SHAPE:
+                ok = ok && static_cast<bool>(fields >> command.value);
+                break;
+            case INPUT_OBSTACLE:
+                ok = ok && static_cast<bool>(fields >> command.x >> command.y >> command.value);
+                break;
+            case INPUT_OVERRELAXATION:
+                ok = ok && static_cast<bool>(fields >> command.x);
+                break;
+            case INPUT_END:
+                ok = ok && static_cast<bool>(fields >> std::hex >> command.hash);
+                break;
+        }
+
+        if (!ok)
+        {
+            error = path + ": line " + std::to_string(lineNr) + ": bad command '" + line + "'";
+            return false;
+        }
+        commands.push_back(command);
+    }
+
+    if (commands.empty() || (commands[0].type != INPUT_SCENE && commands[0].type != INPUT_SCENE_FILE && commands[0].type != INPUT_RESTART))
+    {
+        error = path + ": an input log has to start with a scene";
+        return false;
+    }
+    return true;
+}
+
+bool InputReplay::apply_due(SimulationParameters& params, TaskScheduler* scheduler, std::string& error)
+{
+    // The first command builds the scene whatever frame it was logged at. The
+    // replay then runs from the frame the recording started at; a restart
+    // takes its frame from the checkpoint instead.
+    if (next == 0 && !commands.empty())
+    {
+        const InputCommand& first = commands[next++];
+        if (first.type != INPUT_RESTART)
+        {
+            params.frameNr = first.frameNr;
+        }
+        if (!apply_input_command(first, params, scheduler, error))
+        {
+            done = true;
+            return false;
+        }
+    }
+
+    while (!done && next < commands.size() && commands[next].frameNr <= params.frameNr)
+    {
+        const InputCommand& command = commands[next++];
+        if (command.type == INPUT_END)
+        {
+            done = true;
+        }
+        else if (!apply_input_command(command, params, scheduler, error))
+        {
+            done = true;
+            return false;
+        }
+    }
+    done = done || next == commands.size();
+    return !done;
+}
+
+bool apply_input_command(const InputCommand& command, SimulationParameters& params, TaskScheduler* scheduler, std::string& error)
+{
+    switch (command.type)
+    {
+        case INPUT_SCENE:
+            params.sceneNr = command.value;
+            params.resolution = static_cast<int>(command.x);
+            setup_scene(params, scheduler);
+            return true;
+        case INPUT_SCENE_FILE:
+            return load_scene_file(command.path, params, scheduler, default_scene_cache_dir(), error);
+        case INPUT_RESTART:
+            return restore_checkpoint(command.path, params, scheduler, error);
+        case INPUT_SHAPE:
+            params.shape = command.value;
+            return true;
+        case INPUT_OBSTACLE:
+            set_obstacle(params, static_cast<float>(command.x), static_cast<float>(command.y), command.value != 0);
+            return true;
+        case INPUT_OVERRELAXATION:
+            params.overRelaxation = command.x;
+            return true;
+        case INPUT_END:
+            return true;
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "scene.h"
+
+// Text log of everything that changes the simulation from outside the step:
+//   # fluid input log 1
+//   <frameNr> <timeUs> scene <sceneNr> <resolution>
+//   <frameNr> <timeUs> scenefile <path>
+//   <frameNr> <timeUs> restart <checkpoint path>
+//   <frameNr> <timeUs> shape <shape>
+//   <frameNr> <timeUs> obstacle <x> <y> <reset>
+//   <frameNr> <timeUs> overrelax <value>
+//   <frameNr> <timeUs> end <state hash>
+// A command applies before the step that starts at frameNr. timeUs is wall
+// time since the recording started and is informational; replay runs as fast
+// as it can. Floats are written with enough digits to round-trip exactly.
+enum InputCommandType { INPUT_SCENE, INPUT_SCENE_FILE, INPUT_RESTART, INPUT_SHAPE, INPUT_OBSTACLE, INPUT_OVERRELAXATION, INPUT_END };
+
+struct InputCommand {
+    int frameNr{0};
+    int64_t timeUs{0};
+    InputCommandType type{INPUT_END};
+    int value{0};
+    double x{0.0};
+    double y{0.0};
+    std::string path;
+    uint64_t hash{0};
+};
+
+// FNV-1a over u, v, p and m; equal hashes mean bit-identical output.
+uint64_t state_hash(const Fluid& f);
+
+class InputRecorder
+{
+public:
+    InputRecorder() = default;
+    ~InputRecorder();
+
+    InputRecorder(const InputRecorder&) = delete;
+    InputRecorder& operator=(const InputRecorder&) = delete;
+
+    // Starts a log whose first command recreates the current scene.
+    bool open(const std::string& path, const SimulationParameters& params, std::string& error);
+    // Writes the end command with the current frame and state hash.
+    void close(const SimulationParameters& params);
+    bool is_open() const { return file != nullptr; }
+
+    void record_scene(const SimulationParameters& params);
+    void record_scene_file(const SimulationParameters& params, const std::string& path);
+    void record_restart(const SimulationParameters& params, const std::string& path);
+    void record_shape(const SimulationParameters& params);
+    void record_obstacle(const SimulationParameters& params, float x, float y, bool reset);
+    void record_overrelaxation(const SimulationParameters& params);
+
+private:
+    void write(int frameNr, const char* format, ...);
+
+    FILE* file{nullptr};
+    std::chrono::steady_clock::time_point start;
+};
+
+class InputReplay
+{
+public:
+    bool load(const std::string& path, std::string& error);
+
+    // Applies every command due before the step at params.frameNr. Returns
+    // false once the end command is reached, after which no more steps should
+    // run.
+    bool apply_due(SimulationParameters& params, TaskScheduler* scheduler, std::string& error);
+
+    bool finished() const { return done; }
+    bool has_expected_hash() const { return !commands.empty() && commands.back().type == INPUT_END; }
+    uint64_t expected_hash() const { return has_expected_hash() ? commands.back().hash : 0; }
+    const std::vector<InputCommand>& all_commands() const { return commands; }
+
+private:
+    std::vector<InputCommand> commands;
+    size_t next{0};
+    bool done{false};
+};
+
+// Applies one logged command to params.
+bool apply_input_command(const InputCommand& command, SimulationParameters& params, TaskScheduler* scheduler, std::string& error);
+#endif // INPUT_LOG_H
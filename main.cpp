@@ -1,6 +1,9 @@
 #include "mainwindow.hpp"
+#include "trace_events.h"
 #include <QSurfaceFormat>
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 
 int main(int argc, char* argv[])
 {
@@ -11,7 +14,94 @@ int main(int argc, char* argv[])
   format.setVersion(3, 3);
   QSurfaceFormat::setDefaultFormat(format);
 
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  QCommandLineOption pinThreadsOption("pin-threads", "Pin each solver thread to its own CPU.");
+  QCommandLineOption numaReportOption("numa-report", "Print the NUMA node of every field page after scene setup.");
+  QCommandLineOption sceneFileOption("scene-file", "Start with a scene loaded from a .scene file.", "file");
+  QCommandLineOption restartOption("restart", "Resume from a checkpoint file.", "file");
+  QCommandLineOption recordOption("record", "Stream every Nth frame of m, p, u and v to a file.", "file");
+  QCommandLineOption recordEveryOption("record-every", "Frame interval for --record.", "N", "1");
+  QCommandLineOption recordInputOption("record-input", "Record scene, shape and obstacle input to a log.", "file");
+  QCommandLineOption replayOption("replay", "Replay an input log as fast as possible.", "file");
+  QCommandLineOption publishOption("publish", "Publish live frames to a POSIX shared-memory ring.", "name");
+  QCommandLineOption targetStepOption("target-step-ms", "Adapt solver iterations and grid resolution to hold this step time.", "ms");
+  QCommandLineOption exportOption("export", "Render offscreen and write numbered images starting with this prefix, then exit.", "prefix");
+  QCommandLineOption exportFormatOption("export-format", "Image format for --export: png or ppm.", "format", "png");
+  QCommandLineOption exportFramesOption("export-frames", "Number of images to export.", "N", "600");
+  QCommandLineOption exportEveryOption("export-every", "Solver steps per exported image.", "N", "1");
+  QCommandLineOption exportSizeOption("export-size", "Exported image size.", "WxH", "1200x600");
+  QCommandLineOption traceOption("trace", "Write a Chrome trace-event timeline of the run to a JSON file.", "file");
+  parser.addOption(pinThreadsOption);
+  parser.addOption(numaReportOption);
+  parser.addOption(sceneFileOption);
+  parser.addOption(restartOption);
+  parser.addOption(recordOption);
+  parser.addOption(recordEveryOption);
+  parser.addOption(publishOption);
+  parser.addOption(recordInputOption);
+  parser.addOption(replayOption);
+  parser.addOption(targetStepOption);
+  parser.addOption(traceOption);
+  parser.addOption(exportOption);
+  parser.addOption(exportFormatOption);
+  parser.addOption(exportFramesOption);
+  parser.addOption(exportEveryOption);
+  parser.addOption(exportSizeOption);
+  parser.process(a);
+
+  trace_recorder().set_thread_name("gui");
+  std::string error;
+  if (parser.isSet(traceOption) && !trace_recorder().start(parser.value(traceOption).toStdString(), error))
+  {
+    qDebug().noquote() << QString::fromStdString(error);
+    return 1;
+  }
+
   MainWindow w;
+  w.configure_numa(parser.isSet(pinThreadsOption), parser.isSet(numaReportOption));
+  w.set_target_step_ms(parser.value(targetStepOption).toDouble());
+  if (parser.isSet(recordInputOption) && !w.start_input_recording(parser.value(recordInputOption)))
+  {
+    return 1;
+  }
+  if (parser.isSet(replayOption) && !w.start_replay(parser.value(replayOption)))
+  {
+    return 1;
+  }
+  if (parser.isSet(sceneFileOption) && !w.load_scene_file(parser.value(sceneFileOption)))
+  {
+    return 1;
+  }
+  if (parser.isSet(restartOption) && !w.load_checkpoint(parser.value(restartOption)))
+  {
+    return 1;
+  }
+  if (parser.isSet(recordOption) && !w.start_recording(parser.value(recordOption), parser.value(recordEveryOption).toInt()))
+  {
+    return 1;
+  }
+  if (parser.isSet(publishOption) && !w.start_publishing(parser.value(publishOption)))
+  {
+    return 1;
+  }
+  if (parser.isSet(exportOption))
+  {
+    QStringList size = parser.value(exportSizeOption).split('x');
+    int width = size.value(0).toInt();
+    int height = size.value(1).toInt();
+    if (width <= 0 || height <= 0)
+    {
+      qDebug() << "--export-size must be WIDTHxHEIGHT";
+      return 1;
+    }
+    bool exported = w.export_frames(parser.value(exportOption), parser.value(exportFormatOption), parser.value(exportFramesOption).toInt(),
+                                    parser.value(exportEveryOption).toInt(), width, height);
+    trace_recorder().stop();
+    return exported ? 0 : 1;
+  }
   w.show();
-  return a.exec();
+  int status = a.exec();
+  trace_recorder().stop();
+  return status;
 }
@@ -6,7 +6,22 @@
 #include "fluid.h"
 #include <QCheckBox>
 #include "sceneview.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <cmath>
+#include <QDebug>
+#include <QFileDialog>
+#include <QMenuBar>
+#include <QMessageBox>
+#include <QSignalBlocker>
+#include <QImage>
+#include <QThread>
+#include "checkpoint.h"
+#include "scene_file.h"
+#include "image_sequence.h"
+#include "trace_events.h"
+#include "offscreen_renderer.hpp"
 
 SimulationParameters params;
 SceneView* mainWindowSceneView;
@@ -62,6 +77,16 @@ void MainWindow::handle_smoke_checkbox(int state)
     }
 }
 
+void MainWindow::handle_streamlines_checkbox(int state)
+{
+    params.showStreamlines = state == Qt::Checked;
+}
+
+void MainWindow::handle_arrows_checkbox(int state)
+{
+    params.showArrows = state == Qt::Checked;
+}
+
 void MainWindow::handle_overrelax_checkbox(int state)
 {
     if (state == Qt::Checked)
@@ -72,16 +97,18 @@ void MainWindow::handle_overrelax_checkbox(int state)
     {
         params.overRelaxation = 1.0;
     }
+    inputRecorder->record_overrelaxation(params);
 }
 
 void MainWindow::combobox_current_index_changed(int index)
 {
     params.shape = index;
+    inputRecorder->record_shape(params);
     if (params.fluid != nullptr)
     {
         if (mainWindowSceneView->activated_by_moving_mouse)
         {
-            set_obstacle(mainWindowSceneView->zeroX + params.offsetForObstacle[params.shape][0],mainWindowSceneView->zeroY + params.offsetForObstacle[params.shape][1],false);
+            set_obstacle(mainWindowSceneView->zeroX + params.offsetForObstacle[std::min(params.shape, 4)][0],mainWindowSceneView->zeroY + params.offsetForObstacle[std::min(params.shape, 4)][1],false);
         }
         else
         {
@@ -100,8 +127,50 @@ void MainWindow::create_timer()
 
 void MainWindow::simulate()
 {
-    params.fluid->simulate(params.dt, params.gravity, params.numIters);
-    params.frameNr++;
+    if (inputReplay != nullptr)
+    {
+        replay_step();
+        return;
+    }
+
+    apply_pending_obstacle();
+    update_view_outputs();
+    auto stepStart = std::chrono::steady_clock::now();
+    simulate_step(params);
+    if (governed())
+    {
+        double stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stepStart).count();
+        if (governor->observe(stepMs, params))
+        {
+            qDebug().noquote() << "quality:" << QString::fromStdString(governor->last_decision().describe());
+        }
+    }
+    recorder->record(*params.fluid, params.frameNr);
+
+    if (!publishName.empty())
+    {
+        // Scenes differ in size; grow the ring when a larger one is loaded.
+        if (static_cast<size_t>(params.fluid->numCells) > publisher->capacity_cells())
+        {
+            start_publishing(QString::fromStdString(publishName));
+        }
+        publisher->publish(*params.fluid, params.frameNr);
+    }
+}
+
+// The view subscribes to what it currently shows, so the solver skips the
+// pressure accumulation or the smoke advection nobody looks at. Pressure
+// colours take their range from the step statistics; without them
+// colour_fluid would rescan p every frame.
+void MainWindow::update_view_outputs()
+{
+    unsigned shown = (params.showPressure ? OUTPUT_PRESSURE | OUTPUT_STATS : 0u) | (params.showSmoke ? OUTPUT_SMOKE : 0u);
+    if (shown != viewOutputs)
+    {
+        params.outputs.unsubscribe(viewOutputs);
+        params.outputs.subscribe(shown);
+        viewOutputs = shown;
+    }
 }
 
 void MainWindow::update()
@@ -117,6 +186,7 @@ void MainWindow::action_exit_triggered()
 
 void MainWindow::on_timer()
 {
+    ScopedTraceEvent event("on_timer");
     update();
 }
 
@@ -125,6 +195,7 @@ MainWindow::MainWindow(QWidget* parent)
   , ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    params.outputs.demandDriven = true;
     scene = new SceneView();
     mainWindowSceneView = scene;
     connect(ui->WindTunnel, SIGNAL(clicked()), this, SLOT(handle_wind_tunnel_button()));
@@ -133,12 +204,24 @@ MainWindow::MainWindow(QWidget* parent)
     connect(ui->Pressure, SIGNAL(stateChanged(int)), this, SLOT(handle_pressure_checkbox(int)));
     connect(ui->Smoke, SIGNAL(stateChanged(int)), this, SLOT(handle_smoke_checkbox(int)));
     connect(ui->Overrelax, SIGNAL(stateChanged(int)), this, SLOT(handle_overrelax_checkbox(int)));
+    connect(ui->Streamlines, SIGNAL(stateChanged(int)), this, SLOT(handle_streamlines_checkbox(int)));
+    connect(ui->Arrows, SIGNAL(stateChanged(int)), this, SLOT(handle_arrows_checkbox(int)));
     connect(ui->ShapesBox, SIGNAL(currentIndexChanged(int)), this, SLOT(combobox_current_index_changed(int)));
     ui->ShapesBox->addItem("Circle");
     ui->ShapesBox->addItem("Square");
     ui->ShapesBox->addItem("Triangle");
     ui->ShapesBox->addItem("Oval");
 
+    QMenu* fileMenu = ui->menubar->addMenu("File");
+    fileMenu->addAction("Open Scene...", this, &MainWindow::handle_open_scene);
+    fileMenu->addAction("Save Checkpoint...", this, &MainWindow::handle_save_checkpoint);
+    fileMenu->addAction("Load Checkpoint...", this, &MainWindow::handle_load_checkpoint);
+    fileMenu->addAction("Export Stage Timings...", this, &MainWindow::handle_export_timings);
+    QMenu* viewMenu = ui->menubar->addMenu("View");
+    QAction* timingsAction = viewMenu->addAction("Stage Timings");
+    timingsAction->setCheckable(true);
+    connect(timingsAction, &QAction::toggled, this, [](bool checked) { mainWindowSceneView->showTimings = checked; });
+
     create_timer();
 
     QGridLayout* layout = new QGridLayout(ui->frame);
@@ -154,256 +237,368 @@ MainWindow::MainWindow(QWidget* parent)
 
 MainWindow::~MainWindow()
 {
+    inputRecorder->close(params);
+    delete inputRecorder;
+    delete inputReplay;
+    delete governor;
     delete scene;
     scene = nullptr;
+    delete publisher;
+    delete recorder;
+    delete taskScheduler;
     delete ui;
 }
 
-void MainWindow::set_obstacle(float x, float y, bool reset)
+void MainWindow::set_target_step_ms(double ms)
 {
-    float vx{0.0};
-    float vy{0.0};
-    if (!reset)
+    delete governor;
+    governor = nullptr;
+    if (ms > 0.0)
     {
-        vx = (x - params.obstacleX) / params.dt;
-        vy = (y - params.obstacleY) / params.dt;
+        QualitySettings settings;
+        settings.targetStepMs = ms;
+        governor = new QualityGovernor(settings);
     }
-    params.obstacleX = x;
-    params.obstacleY = y;
-
-    double r = params.obstacleRadius;
-    Fluid* f = params.fluid;
-    size_t n = f->numY;
+}
 
-    for (int i{1}; i < f->numX - 2; i++)
+// Steps and renders offscreen as fast as the solver allows, every interval
+// steps one image, while encoder threads compress and write the previous ones.
+bool MainWindow::export_frames(const QString& prefix, const QString& format, int frames, int interval, int width, int height)
+{
+    ImageEncoder encoder;
+    if (format == "ppm")
+    {
+        encoder = write_ppm;
+    }
+    else if (format == "png")
     {
-        for (int j{1}; j < f->numY - 2; j++)
+        encoder = [](const ImageFrame& frame, const std::string& path, std::string& error)
         {
-            f->s[i * n + j] = 1.0;
-
-            float dx = (i + 0.5) * f->h - x;
-            float dy = (j + 0.5) * f->h - y;
-
-            if (params.shape == 0)
-            {
-                set_obstacle_for_circle(f, i, j, n, dx, dy, r, vx, vy);
-            }
-            else if (params.shape == 1)
+            QImage image(reinterpret_cast<const uchar*>(frame.pixels.data()), frame.width, frame.height, QImage::Format_RGBA8888);
+            if (!image.save(QString::fromStdString(path), "PNG"))
             {
-                set_obstacle_for_square(f, i, j, n, dx, dy, r, vx, vy);
-            }
-            else if (params.shape == 2)
-            {
-                set_obstacle_for_triangle(f, i, j, n, dx, dy, r, vx, vy);
-            }
-            else if (params.shape == 3)
-            {
-                set_obstacle_for_oval(f, i, j, n, dx, dy, r, vx, vy);
+                error = "cannot write " + path;
+                return false;
             }
+            return true;
+        };
+    }
+    else
+    {
+        qDebug() << "unknown export format" << format;
+        return false;
+    }
 
+    std::string error;
+    OffscreenRenderer renderer;
+    ImageSequenceWriter writer(std::max(2, QThread::idealThreadCount() / 2));
+    if (!renderer.create(width, height, error) || !writer.open(prefix.toStdString(), format.toStdString(), encoder, error))
+    {
+        qDebug().noquote() << QString::fromStdString(error);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int k{0}; k < frames; ++k)
+    {
+        for (int step{0}; step < std::max(interval, 1); ++step)
+        {
+            simulate();
         }
+        ColourOptions options;
+        options.showPressure = params.showPressure;
+        options.showSmoke = params.showSmoke;
+        options.smokeInColour = params.sceneNr == 2;
+        ImageFrame* frame = writer.acquire();
+        renderer.render(*params.fluid, options, params.frameNr, *frame);
+        writer.submit(frame);
     }
-    params.showObstacle = true;
+    bool ok = writer.close(error);
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (!ok)
+    {
+        qDebug().noquote() << QString::fromStdString(error);
+    }
+    qDebug().noquote() << QString("exported %1 frames in %2 ms (%3 fps), %4 encoder stalls")
+                              .arg(writer.frames_written())
+                              .arg(wallMs, 0, 'f', 0)
+                              .arg(wallMs > 0.0 ? 1000.0 * frames / wallMs : 0.0, 0, 'f', 1)
+                              .arg(writer.stalls());
+    return ok;
 }
 
-void MainWindow::setup_scene()
+// Input logs and replays must see the exact iterations and grid of the run
+// they describe, so the governor stands down while either is active.
+bool MainWindow::governed() const
 {
-    params.overRelaxation = 1.9;
-    ui->Overrelax->setChecked(true);
-    params.dt = 1.0 / 60.0;
-    params.numIters = 40;
-    int res{100};
+    return governor != nullptr && !inputRecorder->is_open() && inputReplay == nullptr;
+}
 
-    if (params.sceneNr == 0)
+void MainWindow::configure_numa(bool pinThreads, bool report)
+{
+    if (pinThreads && !taskScheduler->pin_threads())
     {
-        res = 50;
+        qDebug() << "could not pin all solver threads";
     }
+    else if (pinThreads && params.fluid != nullptr)
+    {
+        // The constructor's setup_scene() placed the pages before the threads
+        // were pinned; place them again from the pinned workers.
+        params.fluid->distribute_pages();
+    }
+    numaReport = report;
+    if (numaReport && params.fluid != nullptr)
+    {
+        qDebug().noquote() << QString::fromStdString(params.fluid->placement_report());
+    }
+}
 
-    double domainHeight{1.0};
-    double simHeight{1.0};
-    double simWidth{1.0};
-    double domainWidth{domainHeight / simHeight * simWidth};
-    double h{domainHeight / res};
-    int numX{static_cast<int>(std::floor(2 * domainWidth / h))};
-    int numY{static_cast<int>(std::floor(domainHeight / h))};
-    double density{1000.0};
-
-    params.fluid = new Fluid(density, numX, numY, h);
-    size_t n = params.fluid->numY;
+void MainWindow::handle_save_checkpoint()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Save Checkpoint", QString(), "Checkpoints (*.ckpt)");
+    if (path.isEmpty())
+    {
+        return;
+    }
 
-    if (params.sceneNr == 0)
+    std::string error;
+    if (!write_checkpoint(path.toStdString(), params, error))
     {
-        set_scene_for_wind_tunnel(n);
+        QMessageBox::warning(this, "Save Checkpoint", QString::fromStdString(error));
     }
-    else if (params.sceneNr == 1)
+}
+
+void MainWindow::handle_export_timings()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Export Stage Timings", QString(), "CSV (*.csv)");
+    if (path.isEmpty())
     {
-        set_scene_for_pressure_tank(n);
+        return;
     }
-    else if (params.sceneNr == 2)
+
+    std::ofstream out(path.toStdString());
+    stage_timers().write_csv(out);
+    if (!out)
     {
-        set_scene_for_paint(n);
+        QMessageBox::warning(this, "Export Stage Timings", "cannot write " + path);
     }
 }
 
-void MainWindow::set_obstacle_for_circle(Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+void MainWindow::handle_load_checkpoint()
 {
-    if (dx * dx + dy * dy < r * r)
+    QString path = QFileDialog::getOpenFileName(this, "Load Checkpoint", QString(), "Checkpoints (*.ckpt)");
+    if (!path.isEmpty())
     {
-        f->s[i * n + j] = 0.0;
-        if (params.sceneNr == 2)
-        {
-            f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
-        }
-        else
-        {
-            f->m[i * n + j] = 1.0;
-            f->u[i * n + j] = vx;
-            f->u[(i + 1) * n + j] = vx;
-            f->v[i * n + j] = vy;
-            f->v[i * n + j + 1] = vy;
-        }
+        load_checkpoint(path);
     }
 }
 
-void MainWindow::set_obstacle_for_square(Fluid *f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+void MainWindow::handle_open_scene()
 {
-    if (std::abs(dx) < r && std::abs(dy) < r)
+    QString path = QFileDialog::getOpenFileName(this, "Open Scene", QString(), "Scenes (*.scene)");
+    if (!path.isEmpty())
     {
-        f->s[i * n + j] = 0.0;
-        if (params.sceneNr == 2)
-        {
-            f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
-        }
-        f->m[i * n + j] = 1.0;
-        f->u[i * n + j] = vx;
-        f->u[(i + 1) * n + j] = vx;
-        f->v[i * n + j] = vy;
-        f->v[i * n + j + 1] = vy;
+        load_scene_file(path);
     }
 }
 
-void MainWindow::set_obstacle_for_triangle(Fluid *f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+bool MainWindow::load_scene_file(const QString& path)
 {
-    if (std::abs(dx) < r && std::abs(dy) < r)
+    std::string error;
+    obstaclePending = false;
+    if (!::load_scene_file(path.toStdString(), params, taskScheduler, default_scene_cache_dir(), error))
     {
-        if ((dx >= 0 && dy >= 0 && dx - dy >= 0) || (dx >= 0 && dy <= 0 && dx + dy >= 0))
-        {
-            f->s[i * n + j] = 0.0;
-            if (params.sceneNr == 2)
-            {
-                f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
-            }
+        QMessageBox::warning(this, "Open Scene", QString::fromStdString(error));
+        return false;
+    }
+    inputRecorder->record_scene_file(params, path.toStdString());
 
+    QSignalBlocker blocker(ui->ShapesBox);
+    ui->ShapesBox->setCurrentIndex(params.shape);
+    sync_checkboxes_with_params();
+    mainWindowSceneView->render_squares();
+    mainWindowSceneView->update_scene();
+    return true;
+}
 
-            f->m[i * n + j] = 1.0;
-            f->u[i * n + j] = vx;
-            f->u[(i + 1) * n + j] = vx;
-            if (dx >= 0 && dy >= 0 && dx - dy >= 0)
-            {
-                f->v[i * n + j] = vy;
-                f->v[i * n + j + 1] = vy;
-            }
-            else
-            {
-                f->v[i * n + j] = -vy;
-                f->v[i * n + j + 1] = -vy;
-            }
-        }
+bool MainWindow::load_checkpoint(const QString& path)
+{
+    std::string error;
+    obstaclePending = false;
+    if (!restore_checkpoint(path.toStdString(), params, taskScheduler, error))
+    {
+        QMessageBox::warning(this, "Load Checkpoint", QString::fromStdString(error));
+        return false;
     }
+    inputRecorder->record_restart(params, path.toStdString());
+
+    // Re-placing the obstacle would overwrite the restored s field.
+    QSignalBlocker blocker(ui->ShapesBox);
+    ui->ShapesBox->setCurrentIndex(params.shape);
+    sync_checkboxes_with_params();
+    mainWindowSceneView->render_squares();
+    mainWindowSceneView->update_scene();
+    return true;
 }
 
-void MainWindow::set_obstacle_for_oval(Fluid *f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+bool MainWindow::start_recording(const QString& path, int interval)
 {
-    double ovalRadiusX{r * 1.5};
-    double ovalRadiusY{r * 1.0};
+    std::string error;
+    if (!recorder->open(path.toStdString(), interval, error))
+    {
+        qDebug().noquote() << QString::fromStdString(error);
+        return false;
+    }
+    params.outputs.subscribe(OUTPUT_PRESSURE | OUTPUT_SMOKE);
+    return true;
+}
 
-    if ((dx * dx) / (ovalRadiusX * ovalRadiusX) + (dy * dy) / (ovalRadiusY * ovalRadiusY) < 1)
+bool MainWindow::start_publishing(const QString& name)
+{
+    std::string error;
+    bool wasPublishing = !publishName.empty();
+    publishName = name.toStdString();
+    if (!publisher->open(publishName, params.fluid->numCells, 4, error))
     {
-        f->s[i * n + j] = 0.0;
-        if (params.sceneNr == 2)
+        qDebug().noquote() << QString::fromStdString(error);
+        publishName.clear();
+        if (wasPublishing)
         {
-            f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
+            params.outputs.unsubscribe(OUTPUT_PRESSURE | OUTPUT_SMOKE);
         }
-        f->m[i * n + j] = 1.0;
-        f->u[i * n + j] = vx;
-        f->u[(i + 1) * n + j] = vx;
-        f->v[i * n + j] = vy;
-        f->v[i * n + j + 1] = vy;
+        return false;
     }
+    if (!wasPublishing)
+    {
+        params.outputs.subscribe(OUTPUT_PRESSURE | OUTPUT_SMOKE);
+    }
+    return true;
 }
 
-void MainWindow::set_scene_for_wind_tunnel(size_t n)
+bool MainWindow::start_input_recording(const QString& path)
 {
-    for (int i{0}; i < params.fluid->numX; ++i)
+    std::string error;
+    if (!inputRecorder->open(path.toStdString(), params, error))
     {
-        for (int j{0}; j < params.fluid->numY; ++j)
-        {
-            double s = 1.0;
-            if (i == 0 || i == params.fluid->numX - 1 || j == 0)
-            {
-                s = 0.0;
-            }
-            params.fluid->s[i * n + j] = s;
-        }
+        qDebug().noquote() << QString::fromStdString(error);
+        return false;
     }
+    // The end-of-log hash covers p and m.
+    params.outputs.subscribe(OUTPUT_PRESSURE | OUTPUT_SMOKE);
+    return true;
+}
 
-    params.gravity = -9.81;
-    params.showPressure = true;
-    ui->Pressure->setChecked(true);
-    params.showSmoke = false;
-    ui->Smoke->setChecked(false);
+bool MainWindow::start_replay(const QString& path)
+{
+    std::string error;
+    inputReplay = new InputReplay();
+    if (!inputReplay->load(path.toStdString(), error))
+    {
+        qDebug().noquote() << QString::fromStdString(error);
+        delete inputReplay;
+        inputReplay = nullptr;
+        return false;
+    }
+    params.outputs.subscribe(OUTPUT_PRESSURE | OUTPUT_SMOKE);
+
+    // Replays run as fast as the timer allows.
+    timer->setInterval(0);
+    apply_replay_commands();
+    return true;
 }
 
-void MainWindow::set_scene_for_pressure_tank(size_t n)
+void MainWindow::replay_step()
 {
-    double inVel = 2.0;
-    for (int i{0}; i < params.fluid->numX; ++i)
+    if (!inputReplay->finished())
     {
-        for (int j{0}; j < params.fluid->numY; ++j)
-        {
-            double s = 1.0;
-            if (i == 0 || j == 0 || j == params.fluid->numY - 1)
-            {
-                s = 0.0;
-            }
-            params.fluid->s[i * n + j] = s;
+        update_view_outputs();
+        simulate_step(params);
+        apply_replay_commands();
+    }
+}
 
-            if (i == 1)
-            {
-                params.fluid->u[i * n + j] = inVel;
-            }
+void MainWindow::apply_replay_commands()
+{
+    std::string error;
+    Fluid* before = params.fluid;
+    if (!inputReplay->apply_due(params, taskScheduler, error))
+    {
+        if (!error.empty())
+        {
+            qDebug().noquote() << QString::fromStdString(error);
         }
+        qDebug().noquote() << QString("replay finished at frame %1, hash %2, expected %3")
+                                  .arg(params.frameNr)
+                                  .arg(state_hash(*params.fluid), 16, 16, QChar('0'))
+                                  .arg(inputReplay->expected_hash(), 16, 16, QChar('0'));
+        timer->stop();
     }
 
-    double pipeH = 0.1 * params.fluid->numY;
-    int minJ = static_cast<int>(std::floor(0.5 * params.fluid->numY - 0.5 * pipeH));
-    int maxJ = static_cast<int>(std::floor(0.5 * params.fluid->numY + 0.5 * pipeH));
-
-    for (int j{minJ}; j < maxJ; ++j)
+    QSignalBlocker blocker(ui->ShapesBox);
+    ui->ShapesBox->setCurrentIndex(params.shape);
+    if (params.fluid != before)
     {
-        params.fluid->m[j] = 0.0;
+        sync_checkboxes_with_params();
+        mainWindowSceneView->render_squares();
     }
+}
 
-    set_obstacle(1.0, 0.5, true);
-    params.gravity = 0.0;
-    params.showPressure = false;
-    ui->Pressure->setChecked(false);
-    params.showSmoke = true;
-    ui->Smoke->setChecked(true);
+void MainWindow::set_obstacle(float x, float y, bool reset)
+{
+    // Mouse input would make a replay diverge from its log.
+    if (inputReplay != nullptr)
+    {
+        return;
+    }
 
+    // Mouse moves arrive faster than steps; only the latest one is drawn.
+    this->reset = obstaclePending ? this->reset || reset : reset;
+    this->x = x;
+    this->y = y;
+    obstaclePending = true;
 }
 
-void MainWindow::set_scene_for_paint(size_t n)
+void MainWindow::apply_pending_obstacle()
 {
-    params.gravity = 0.0;
-    params.overRelaxation = 1.0;
-    ui->Overrelax->setChecked(false);
-    params.showPressure = false;
-    ui->Pressure->setChecked(false);
-    params.showSmoke = true;
-    ui->Smoke->setChecked(true);
+    if (obstaclePending)
+    {
+        obstaclePending = false;
+        inputRecorder->record_obstacle(params, x, y, reset);
+        ::set_obstacle(params, x, y, reset);
+    }
 }
 
+void MainWindow::setup_scene()
+{
+    obstaclePending = false;
+    if (governed() && params.fluid != nullptr)
+    {
+        int current = params.fluid->numY - 2;
+        int next = governor->next_resolution(current, params.frameNr);
+        if (next != current)
+        {
+            params.resolution = next;
+            qDebug().noquote() << "quality:" << QString::fromStdString(governor->last_decision().describe());
+        }
+        governor->reset();
+    }
+    ::setup_scene(params, taskScheduler);
+    inputRecorder->record_scene(params);
+    sync_checkboxes_with_params();
 
+    if (numaReport)
+    {
+        qDebug().noquote() << QString::fromStdString(params.fluid->placement_report());
+    }
+}
 
-
+void MainWindow::sync_checkboxes_with_params()
+{
+    // Syncing is not a user command: keep it out of the input log and leave
+    // a scene's own overrelaxation value alone.
+    QSignalBlocker blocker(ui->Overrelax);
+    ui->Overrelax->setChecked(params.overRelaxation != 1.0);
+    ui->Pressure->setChecked(params.showPressure);
+    ui->Smoke->setChecked(params.showSmoke);
+}
@@ -4,33 +4,15 @@
 #include <QMainWindow>
 #include <QTimer>
 #include "fluid.h"
+#include "scene.h"
+#include "task_scheduler.h"
+#include "frame_recorder.h"
+#include "shm_frame_ring.h"
+#include "input_log.h"
+#include "quality_governor.h"
 #include <QCheckBox>
 class SceneView;
 
-struct SimulationParameters {
-    double gravity{-9.81};
-    double dt{1.0 / 120.0};
-    int numIters{100};
-    int frameNr{0};
-    double overRelaxation{1.9};
-    double obstacleX{0.0};
-    double obstacleY{0.0};
-    double obstacleRadius{0.085};
-    bool paused{false};
-    int sceneNr{1};
-    bool showObstacle{false};
-    bool showPressure{false};
-    bool showSmoke{true};
-    Fluid* fluid{nullptr};
-    int shape{0};
-    float offsetForObstacle[4][2]{
-        {0.01, 0.015}, // 0 is for Circle
-        {0.03, 0.015}, // 1 is for Square
-        {0.03, 0.015}, // 2 is for Triangle
-        {0.01, 0.015} // 2 is for Oval
-    };
-};
-
 extern SimulationParameters params;
 
 QT_BEGIN_NAMESPACE
@@ -48,6 +30,15 @@ public:
   MainWindow(QWidget* parent = nullptr);
   ~MainWindow();
   void set_obstacle(float, float, bool);
+  void configure_numa(bool pinThreads, bool report);
+  void set_target_step_ms(double ms);
+  bool load_checkpoint(const QString& path);
+  bool load_scene_file(const QString& path);
+  bool start_recording(const QString& path, int interval);
+  bool start_publishing(const QString& name);
+  bool start_input_recording(const QString& path);
+  bool start_replay(const QString& path);
+  bool export_frames(const QString& prefix, const QString& format, int frames, int interval, int width, int height);
 
 public slots:
   void action_exit_triggered();
@@ -58,7 +49,13 @@ public slots:
   void handle_pressure_checkbox(int state);
   void handle_smoke_checkbox(int state);
   void handle_overrelax_checkbox(int state);
+  void handle_streamlines_checkbox(int state);
+  void handle_arrows_checkbox(int state);
   void combobox_current_index_changed(int index);
+  void handle_save_checkpoint();
+  void handle_load_checkpoint();
+  void handle_open_scene();
+  void handle_export_timings();
 
 protected:
   void create_scene();
@@ -70,18 +67,28 @@ private:
   Ui::MainWindow* ui;
   SceneView* scene;
   QTimer* timer{new QTimer(this)};
+  TaskScheduler* taskScheduler{new TaskScheduler()};
+  FrameRecorder* recorder{new FrameRecorder()};
+  ShmFramePublisher* publisher{new ShmFramePublisher()};
+  std::string publishName;
+  InputRecorder* inputRecorder{new InputRecorder()};
+  InputReplay* inputReplay{nullptr};
+  QualityGovernor* governor{nullptr};
 
+  // Latest obstacle position from the mouse, applied once before the next step.
   float x;
   float y;
   bool reset;
+  bool obstaclePending{false};
+  bool numaReport{false};
+  unsigned viewOutputs{0};
 
   void setup_scene();
-  void set_obstacle_for_circle(Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
-  void set_obstacle_for_square(Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
-  void set_obstacle_for_triangle(Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
-  void set_obstacle_for_oval(Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
-  void set_scene_for_wind_tunnel(size_t n);
-  void set_scene_for_pressure_tank(size_t n);
-  void set_scene_for_paint(size_t n);
+  void sync_checkboxes_with_params();
+  void replay_step();
+  void apply_pending_obstacle();
+  void update_view_outputs();
+  bool governed() const;
+  void apply_replay_commands();
 };
 #endif // MAINWINDOW_HPP
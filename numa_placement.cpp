@@ -0,0 +1,116 @@
+#include "numa_placement.h"
+#include <cstdint>
+#include <map>
+#include <sched.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+
+size_t page_size()
+{
+    static size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+}
+
+std::vector<int> allowed_cpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return cpus;
+    }
+
+    for (int cpu{0}; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool pin_thread_to_cpu(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+void release_pages(void* data, size_t bytes)
+{
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+    uintptr_t end = begin + bytes;
+    uintptr_t firstPage = (begin + page_size() - 1) / page_size() * page_size();
+    uintptr_t lastPage = end / page_size() * page_size();
+
+    if (lastPage > firstPage)
+    {
+        madvise(reinterpret_cast<void*>(firstPage), lastPage - firstPage, MADV_DONTNEED);
+    }
+}
+
+std::vector<int> page_nodes(const void* data, size_t bytes)
+{
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) / page_size() * page_size();
+    uintptr_t end = reinterpret_cast<uintptr_t>(data) + bytes;
+    std::vector<void*> pages;
+
+    for (uintptr_t page{begin}; page < end; page += page_size())
+    {
+        pages.push_back(reinterpret_cast<void*>(page));
+    }
+
+    std::vector<int> status(pages.size(), -1);
+    if (!pages.empty())
+    {
+        // With a null node list move_pages only reports where each page is.
+        long result = syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0);
+        if (result != 0)
+        {
+            status.assign(pages.size(), -1);
+        }
+    }
+
+    for (int& node : status)
+    {
+        node = node < 0 ? -1 : node;
+    }
+    return status;
+}
+
+std::string placement_summary(const std::string& name, const void* data, size_t bytes)
+{
+    std::vector<int> nodes = page_nodes(data, bytes);
+    std::map<int, size_t> counts;
+
+    for (int node : nodes)
+    {
+        counts[node]++;
+    }
+
+    std::stringstream out;
+    out << name << ": " << nodes.size() << " pages";
+    for (const auto& [node, count] : counts)
+    {
+        if (node < 0)
+        {
+            out << ", unknown " << count;
+        }
+        else
+        {
+            out << ", node" << node << " " << count;
+        }
+    }
+    return out.str();
+}
@@ -0,0 +1,26 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+#include <cstddef>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Thin wrappers over the Linux affinity and page placement syscalls, so no
+// libnuma is needed. All of them fail soft on kernels or containers that do
+// not support them.
+
+std::vector<int> allowed_cpus();
+bool pin_thread_to_cpu(pthread_t thread, int cpu);
+
+// Drops the whole pages inside [data, data + bytes) so the next write to each
+// page faults it in on the NUMA node of the writing thread. The contents of
+// those pages read back as zero afterwards.
+void release_pages(void* data, size_t bytes);
+
+// The NUMA node of every page in the range, or -1 where the kernel could not
+// tell (page not present, or move_pages unsupported).
+std::vector<int> page_nodes(const void* data, size_t bytes);
+
+// "name: N pages, node0 a, node1 b" for one field.
+std::string placement_summary(const std::string& name, const void* data, size_t bytes);
+#endif // NUMA_PLACEMENT_H
@@ -0,0 +1,175 @@
+#include "obstacle_sdf.h"
+#include <algorithm>
+#include <cmath>
+
+ShapeSdf ShapeSdf::circle()
+{
+    return ShapeSdf{};
+}
+
+ShapeSdf ShapeSdf::box(float halfWidth, float halfHeight)
+{
+    ShapeSdf shape;
+    shape.shapeKind = BOX;
+    shape.halfWidth = halfWidth;
+    shape.halfHeight = halfHeight;
+    return shape;
+}
+
+ShapeSdf ShapeSdf::ellipse(float halfWidth, float halfHeight)
+{
+    ShapeSdf shape = box(halfWidth, halfHeight);
+    shape.shapeKind = ELLIPSE;
+    return shape;
+}
+
+ShapeSdf ShapeSdf::polygon(const std::vector<float>& vertices)
+{
+    ShapeSdf shape;
+    shape.shapeKind = POLYGON;
+    shape.vertices = vertices;
+    shape.halfWidth = 0.0f;
+    shape.halfHeight = 0.0f;
+    for (size_t k{0}; k + 1 < vertices.size(); k += 2)
+    {
+        shape.halfWidth = std::max(shape.halfWidth, std::abs(vertices[k]));
+        shape.halfHeight = std::max(shape.halfHeight, std::abs(vertices[k + 1]));
+    }
+    return shape;
+}
+
+ShapeSdf ShapeSdf::precomputed(int resolution) const
+{
+    ShapeSdf shape = *this;
+    shape.shapeKind = GRID;
+
+    // One sample spacing of padding keeps the surface and its outside ramp
+    // inside the grid.
+    float extent = std::max(halfWidth, halfHeight);
+    shape.gridSize = std::max(resolution, 4);
+    shape.gridStep = 2.0f * extent / (shape.gridSize - 3);
+    shape.gridMinX = -extent - shape.gridStep;
+    shape.gridMinY = -extent - shape.gridStep;
+    shape.grid.resize(static_cast<size_t>(shape.gridSize) * shape.gridSize);
+    for (int i{0}; i < shape.gridSize; ++i)
+    {
+        for (int j{0}; j < shape.gridSize; ++j)
+        {
+            shape.grid[i * shape.gridSize + j] = distance(shape.gridMinX + i * shape.gridStep, shape.gridMinY + j * shape.gridStep);
+        }
+    }
+    return shape;
+}
+
+float ShapeSdf::distance(float x, float y) const
+{
+    switch (shapeKind)
+    {
+        case CIRCLE:
+            return std::sqrt(x * x + y * y) - 1.0f;
+        case BOX:
+        {
+            float qx = std::abs(x) - halfWidth;
+            float qy = std::abs(y) - halfHeight;
+            float outside = std::hypot(std::max(qx, 0.0f), std::max(qy, 0.0f));
+            return outside + std::min(std::max(qx, qy), 0.0f);
+        }
+        case ELLIPSE:
+        {
+            // Scaled-circle approximation: exact on the axes, and its sign
+            // (all a mask needs) is exact everywhere.
+            float k = std::sqrt((x * x) / (halfWidth * halfWidth) + (y * y) / (halfHeight * halfHeight));
+            return (k - 1.0f) * std::min(halfWidth, halfHeight);
+        }
+        case POLYGON:
+        {
+            size_t count = vertices.size() / 2;
+            float best = (x - vertices[0]) * (x - vertices[0]) + (y - vertices[1]) * (y - vertices[1]);
+            float sign = 1.0f;
+            for (size_t a{0}, b{count - 1}; a < count; b = a, ++a)
+            {
+                float ax = vertices[2 * a];
+                float ay = vertices[2 * a + 1];
+                float ex = vertices[2 * b] - ax;
+                float ey = vertices[2 * b + 1] - ay;
+                float wx = x - ax;
+                float wy = y - ay;
+                float t = std::clamp((wx * ex + wy * ey) / (ex * ex + ey * ey), 0.0f, 1.0f);
+                float dx = wx - ex * t;
+                float dy = wy - ey * t;
+                best = std::min(best, dx * dx + dy * dy);
+
+                // Crossing count along +x decides inside/outside.
+                bool above = y >= ay;
+                bool belowNext = y < vertices[2 * b + 1];
+                bool left = ex * wy > ey * wx;
+                if ((above && belowNext && left) || (!above && !belowNext && !left))
+                {
+                    sign = -sign;
+                }
+            }
+            return sign * std::sqrt(best);
+        }
+        case GRID:
+        {
+            float fx = (x - gridMinX) / gridStep;
+            float fy = (y - gridMinY) / gridStep;
+            float cx = std::clamp(fx, 0.0f, gridSize - 1.001f);
+            float cy = std::clamp(fy, 0.0f, gridSize - 1.001f);
+            int i = static_cast<int>(cx);
+            int j = static_cast<int>(cy);
+            float tx = cx - i;
+            float ty = cy - j;
+            const float* row0 = &grid[i * gridSize + j];
+            const float* row1 = row0 + gridSize;
+            float value = (1.0f - tx) * ((1.0f - ty) * row0[0] + ty * row0[1]) + tx * ((1.0f - ty) * row1[0] + ty * row1[1]);
+            // Outside the grid the distance only grows.
+            return value + std::hypot(fx - cx, fy - cy) * gridStep;
+        }
+    }
+    return 1.0f;
+}
+
+const ShapeSdf& builtin_shape_sdf(int shape)
+{
+    static const ShapeSdf shapes[]{
+        ShapeSdf::circle(),
+        ShapeSdf::box(1.0f, 1.0f),
+        ShapeSdf::polygon({0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 1.0f}),
+        ShapeSdf::ellipse(1.5f, 1.0f)
+    };
+    return shapes[std::clamp(shape, 0, 3)];
+}
+
+void stamp_shape_sdf(Fluid& f, const ShapeSdf& shape, float x, float y, float radius, float vx, float vy,
+                     bool fractional, float insideSmoke, const int region[4], const std::vector<float>& baseSolid)
+{
+    size_t n = f.numY;
+    float scale = 1.0f / radius;
+    for (int i{region[0]}; i <= region[1]; i++)
+    {
+        for (int j{region[2]}; j <= region[3]; j++)
+        {
+            float dx = (i + 0.5f) * f.h - x;
+            float dy = (j + 0.5f) * f.h - y;
+            float d = shape.distance(dx * scale, dy * scale) * radius;
+            float base = baseSolid.empty() ? 1.0f : baseSolid[i * n + j];
+
+            float open = d < 0.0f ? 0.0f : 1.0f;
+            if (fractional)
+            {
+                open = std::clamp(0.5f + d / f.h, 0.0f, 1.0f);
+            }
+            f.s[i * n + j] = std::min(base, open);
+
+            if (d < 0.0f)
+            {
+                f.m[i * n + j] = insideSmoke;
+                f.u[i * n + j] = vx;
+                f.u[(i + 1) * n + j] = vx;
+                f.v[i * n + j] = vy;
+                f.v[i * n + j + 1] = vy;
+            }
+        }
+    }
+}
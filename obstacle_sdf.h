@@ -0,0 +1,54 @@
+#ifndef OBSTACLE_SDF_H
+#define OBSTACLE_SDF_H
+#include <vector>
+#include "fluid.h"
+
+// Obstacle shape as a signed distance field in shape units (the obstacle
+// radius scales it to world units); negative inside. Shapes are analytic, or
+// sampled onto a small grid once with precomputed() so that arbitrary
+// polygons cost one bilinear lookup per cell.
+class ShapeSdf
+{
+public:
+    enum Kind { CIRCLE, BOX, ELLIPSE, POLYGON, GRID };
+
+    static ShapeSdf circle();
+    static ShapeSdf box(float halfWidth, float halfHeight);
+    static ShapeSdf ellipse(float halfWidth, float halfHeight);
+    // Vertices as x0, y0, x1, y1, ... in either winding order.
+    static ShapeSdf polygon(const std::vector<float>& vertices);
+
+    ShapeSdf precomputed(int resolution = 64) const;
+
+    float distance(float x, float y) const;
+    float half_width() const { return halfWidth; }
+    float half_height() const { return halfHeight; }
+    Kind kind() const { return shapeKind; }
+    // The polygon this shape was made from, kept through precomputed(); empty
+    // for analytic shapes.
+    const std::vector<float>& polygon_vertices() const { return vertices; }
+
+private:
+    Kind shapeKind{CIRCLE};
+    float halfWidth{1.0f};
+    float halfHeight{1.0f};
+    std::vector<float> vertices;
+
+    int gridSize{0};
+    float gridMinX{0.0f};
+    float gridMinY{0.0f};
+    float gridStep{1.0f};
+    std::vector<float> grid;
+};
+
+// The SDF equivalents of shapes 0-3: circle, square, triangle and oval.
+const ShapeSdf& builtin_shape_sdf(int shape);
+
+// Stamps shape, scaled by radius and centred on (x, y), into the cells of
+// region {i0, i1, j0, j1}. Cells start from baseSolid (1 if empty). With
+// fractional set, s ramps from 0 to 1 across the half-cell either side of the
+// surface instead of switching at it. Faces of cells whose centre is inside
+// get the obstacle velocity and the cells themselves get insideSmoke.
+void stamp_shape_sdf(Fluid& f, const ShapeSdf& shape, float x, float y, float radius, float vx, float vy,
+                     bool fractional, float insideSmoke, const int region[4], const std::vector<float>& baseSolid);
+#endif // OBSTACLE_SDF_H
@@ -0,0 +1,174 @@
+#include "obstacle_set.h"
+#include <algorithm>
+#include <cmath>
+
+int ObstacleSet::add_shape(const ShapeSdf& shape)
+{
+    shapes.push_back(shape);
+    return static_cast<int>(shapes.size()) - 1;
+}
+
+int ObstacleSet::add(int shape, float x, float y, float radius)
+{
+    MovingObstacle obstacle;
+    obstacle.shape = shape;
+    obstacle.x = x;
+    obstacle.y = y;
+    obstacle.radius = radius;
+    obstacles.push_back(obstacle);
+    visited.push_back(0);
+    return static_cast<int>(obstacles.size()) - 1;
+}
+
+void ObstacleSet::move(int id, float x, float y, float dt)
+{
+    MovingObstacle& obstacle = obstacles[id];
+    obstacle.vx = (x - obstacle.x) / dt;
+    obstacle.vy = (y - obstacle.y) / dt;
+    obstacle.x = x;
+    obstacle.y = y;
+    obstacle.moved = true;
+}
+
+void ObstacleSet::remove(int id)
+{
+    obstacles[id].active = false;
+    obstacles[id].moved = true;
+}
+
+void ObstacleSet::clear()
+{
+    *this = ObstacleSet{};
+}
+
+void ObstacleSet::bounds(const Fluid& f, const MovingObstacle& obstacle, int box[4]) const
+{
+    const ShapeSdf& shape = shapes[obstacle.shape];
+    float halfX = obstacle.radius * shape.half_width();
+    float halfY = obstacle.radius * shape.half_height();
+    // One spare cell each way covers the fractional ramp and float rounding.
+    box[0] = std::max(1, static_cast<int>(std::floor((obstacle.x - halfX) / f.h - 0.5f)) - 1);
+    box[1] = std::min(f.numX - 2, static_cast<int>(std::ceil((obstacle.x + halfX) / f.h - 0.5f)) + 1);
+    box[2] = std::max(1, static_cast<int>(std::floor((obstacle.y - halfY) / f.h - 0.5f)) - 1);
+    box[3] = std::min(f.numY - 2, static_cast<int>(std::ceil((obstacle.y + halfY) / f.h - 0.5f)) + 1);
+}
+
+void ObstacleSet::link(int id, bool insert)
+{
+    const int* box = obstacles[id].box;
+    if (box[0] > box[1] || box[2] > box[3])
+    {
+        return;
+    }
+    for (int bi{box[0] / bucketSize}; bi <= box[1] / bucketSize; ++bi)
+    {
+        for (int bj{box[2] / bucketSize}; bj <= box[3] / bucketSize; ++bj)
+        {
+            std::vector<int>& bucket = buckets[bi * bucketsY + bj];
+            if (insert)
+            {
+                bucket.push_back(id);
+            }
+            else
+            {
+                bucket.erase(std::find(bucket.begin(), bucket.end(), id));
+            }
+        }
+    }
+}
+
+const std::vector<std::array<int, 4>>& ObstacleSet::update(Fluid& f, const std::vector<float>& baseSolid, bool fractional)
+{
+    // A new grid invalidates every box: stamp everything afresh.
+    if (f.numX != gridX || f.numY != gridY)
+    {
+        gridX = f.numX;
+        gridY = f.numY;
+        bucketsX = gridX / bucketSize + 1;
+        bucketsY = gridY / bucketSize + 1;
+        buckets.assign(static_cast<size_t>(bucketsX) * bucketsY, {});
+        for (MovingObstacle& obstacle : obstacles)
+        {
+            obstacle.box[0] = 0;
+            obstacle.box[1] = -1;
+            obstacle.moved = true;
+        }
+    }
+
+    dirty.clear();
+    for (size_t id{0}; id < obstacles.size(); ++id)
+    {
+        MovingObstacle& obstacle = obstacles[id];
+        if (!obstacle.moved)
+        {
+            continue;
+        }
+        obstacle.moved = false;
+
+        if (obstacle.box[0] <= obstacle.box[1] && obstacle.box[2] <= obstacle.box[3])
+        {
+            dirty.push_back({obstacle.box[0], obstacle.box[1], obstacle.box[2], obstacle.box[3]});
+            link(id, false);
+        }
+        obstacle.box[0] = 0;
+        obstacle.box[1] = -1;
+        if (obstacle.active)
+        {
+            bounds(f, obstacle, obstacle.box);
+            link(id, true);
+            dirty.push_back({obstacle.box[0], obstacle.box[1], obstacle.box[2], obstacle.box[3]});
+        }
+    }
+
+    size_t n = f.numY;
+    redrawnCells = 0;
+    for (const std::array<int, 4>& region : dirty)
+    {
+        for (int i{region[0]}; i <= region[1]; i++)
+        {
+            for (int j{region[2]}; j <= region[3]; j++)
+            {
+                f.s[i * n + j] = baseSolid.empty() ? 1.0f : baseSolid[i * n + j];
+            }
+        }
+        redrawnCells += std::max(0, region[1] - region[0] + 1) * std::max(0, region[3] - region[2] + 1);
+    }
+    for (const std::array<int, 4>& region : dirty)
+    {
+        stamp_region(f, region.data(), fractional);
+    }
+    return dirty;
+}
+
+void ObstacleSet::stamp_region(Fluid& f, const int region[4], bool fractional)
+{
+    if (f.numX != gridX || f.numY != gridY || region[0] > region[1] || region[2] > region[3])
+    {
+        return;
+    }
+
+    pass++;
+    for (int bi{region[0] / bucketSize}; bi <= region[1] / bucketSize; ++bi)
+    {
+        for (int bj{region[2] / bucketSize}; bj <= region[3] / bucketSize; ++bj)
+        {
+            for (int id : buckets[bi * bucketsY + bj])
+            {
+                if (visited[id] == pass)
+                {
+                    continue;
+                }
+                visited[id] = pass;
+
+                const MovingObstacle& obstacle = obstacles[id];
+                int clip[4]{std::max(region[0], obstacle.box[0]), std::min(region[1], obstacle.box[1]),
+                            std::max(region[2], obstacle.box[2]), std::min(region[3], obstacle.box[3])};
+                if (clip[0] <= clip[1] && clip[2] <= clip[3])
+                {
+                    stamp_shape_sdf(f, shapes[obstacle.shape], obstacle.x, obstacle.y, obstacle.radius,
+                                    obstacle.vx, obstacle.vy, fractional, 1.0f, clip, f.s);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef OBSTACLE_SET_H
+#define OBSTACLE_SET_H
+#include <array>
+#include <vector>
+#include "fluid.h"
+#include "obstacle_sdf.h"
+
+struct MovingObstacle {
+    int shape{0}; // index from ObstacleSet::add_shape
+    float x{0.0f};
+    float y{0.0f};
+    float radius{0.05f};
+    float vx{0.0f};
+    float vy{0.0f};
+    bool active{true};
+    bool moved{true};
+    int box[4]{0, -1, 0, -1}; // cells it was last stamped into, inclusive
+};
+
+// Any number of independently moving obstacles. Their cell boxes are kept in a
+// uniform hash of bucketSize x bucketSize cell tiles, so update() only redraws
+// the boxes of obstacles that moved and only restamps the obstacles found in
+// those tiles. Each stamp writes the obstacle's velocity onto the u/v faces of
+// the cells it covers.
+class ObstacleSet
+{
+public:
+    static constexpr int bucketSize{8};
+
+    int add_shape(const ShapeSdf& shape);
+    int add(int shape, float x, float y, float radius);
+    // Velocity is taken from the displacement over dt.
+    void move(int id, float x, float y, float dt);
+    void remove(int id);
+    void clear();
+
+    size_t size() const { return obstacles.size(); }
+    const MovingObstacle& obstacle(int id) const { return obstacles[id]; }
+
+    // Restores the boxes of moved obstacles from baseSolid (1 if empty) and
+    // stamps every obstacle overlapping them. Returns the redrawn boxes.
+    const std::vector<std::array<int, 4>>& update(Fluid& f, const std::vector<float>& baseSolid, bool fractional);
+
+    // Stamps the obstacles overlapping region over whatever s holds there, for
+    // callers that have just redrawn the region themselves.
+    void stamp_region(Fluid& f, const int region[4], bool fractional);
+
+    size_t last_redrawn_cells() const { return redrawnCells; }
+
+private:
+    void bounds(const Fluid& f, const MovingObstacle& obstacle, int box[4]) const;
+    void link(int id, bool insert);
+
+    std::vector<ShapeSdf> shapes;
+    std::vector<MovingObstacle> obstacles;
+    std::vector<std::vector<int>> buckets;
+    std::vector<unsigned> visited; // per obstacle, stamp_region pass that last saw it
+    unsigned pass{0};
+    int gridX{0};
+    int gridY{0};
+    int bucketsX{0};
+    int bucketsY{0};
+    std::vector<std::array<int, 4>> dirty;
+    size_t redrawnCells{0};
+};
+#endif // OBSTACLE_SET_H
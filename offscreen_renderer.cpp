@@ -0,0 +1,124 @@
+#include "offscreen_renderer.hpp"
+
+OffscreenRenderer::~OffscreenRenderer()
+{
+    if (context.isValid() && context.makeCurrent(&surface))
+    {
+        glDeleteTextures(1, &gridTexture);
+        glDeleteBuffers(1, &quadEBO);
+        glDeleteBuffers(1, &quadVBO);
+        glDeleteVertexArrays(1, &quadVAO);
+        fbo.reset();
+        program.removeAllShaders();
+        context.doneCurrent();
+    }
+}
+
+bool OffscreenRenderer::create(int width, int height, std::string& error)
+{
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!surface.isValid() || !context.create() || !context.makeCurrent(&surface))
+    {
+        error = "cannot create an offscreen OpenGL context";
+        return false;
+    }
+    initializeOpenGLFunctions();
+
+    fbo = std::make_unique<QOpenGLFramebufferObject>(width, height, QOpenGLFramebufferObject::NoAttachment);
+    if (!fbo->isValid())
+    {
+        error = "cannot create a " + std::to_string(width) + "x" + std::to_string(height) + " framebuffer";
+        return false;
+    }
+
+    if (!program.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/pass_through.vert") ||
+        !program.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/simple.frag") ||
+        !program.link())
+    {
+        error = program.log().toStdString();
+        return false;
+    }
+
+    // The view's unit quad, stretched over the whole framebuffer. The grid
+    // texture is stored column by column, so s runs along y and t along x.
+    float quadVertices[]
+    {
+        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+        1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
+        1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
+        -1.0f,  1.0f, 0.0f, 1.0f, 0.0f
+    };
+    unsigned int quadIndices[]
+    {
+        0, 1, 2,
+        0, 2, 3
+    };
+
+    glGenVertexArrays(1, &quadVAO);
+    glGenBuffers(1, &quadVBO);
+    glGenBuffers(1, &quadEBO);
+    glBindVertexArray(quadVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quadIndices), quadIndices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+
+    glGenTextures(1, &gridTexture);
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    const float identity[16]{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    program.bind();
+    glUniformMatrix4fv(program.uniformLocation("projection"), 1, GL_FALSE, identity);
+    glUniformMatrix4fv(program.uniformLocation("viewSquare"), 1, GL_FALSE, identity);
+    program.setUniformValue("objectType", 2);
+    program.setUniformValue("gridTexture", 0);
+    return true;
+}
+
+void OffscreenRenderer::render(const Fluid& f, const ColourOptions& options, int frameNr, ImageFrame& frame)
+{
+    context.makeCurrent(&surface);
+    fbo->bind();
+    glViewport(0, 0, fbo->width(), fbo->height());
+    glDisable(GL_DEPTH_TEST);
+
+    colour_fluid(f, options, gridPixels);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (gridTextureX != f.numY || gridTextureY != f.numX)
+    {
+        gridTextureX = f.numY;
+        gridTextureY = f.numX;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, gridTextureX, gridTextureY, 0, GL_RGBA, GL_UNSIGNED_BYTE, gridPixels.data());
+    }
+    else
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gridTextureX, gridTextureY, GL_RGBA, GL_UNSIGNED_BYTE, gridPixels.data());
+    }
+
+    program.bind();
+    glBindVertexArray(quadVAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+
+    frame.frameNr = frameNr;
+    frame.width = fbo->width();
+    frame.height = fbo->height();
+    frame.layout = ImageFrame::BOTTOM_UP;
+    frame.pixels.resize(static_cast<size_t>(frame.width) * frame.height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, frame.width, frame.height, GL_RGBA, GL_UNSIGNED_BYTE, frame.pixels.data());
+    fbo->release();
+}
@@ -0,0 +1,45 @@
+#ifndef OFFSCREEN_RENDERER_HPP
+#define OFFSCREEN_RENDERER_HPP
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+#include <memory>
+#include <string>
+#include <vector>
+#include "fluid.h"
+#include "colour_map.h"
+#include "image_sequence.h"
+
+// Draws the grid into a framebuffer object on an offscreen surface, so frames
+// can be exported without a window or the view's timer. It uses the view's
+// shaders and texture layout, and runs on Mesa's llvmpipe where there is no
+// GPU (QT_QPA_PLATFORM=offscreen on a server).
+class OffscreenRenderer : protected QOpenGLExtraFunctions
+{
+public:
+  OffscreenRenderer() = default;
+  ~OffscreenRenderer();
+
+  OffscreenRenderer(const OffscreenRenderer&) = delete;
+  OffscreenRenderer& operator=(const OffscreenRenderer&) = delete;
+
+  bool create(int width, int height, std::string& error);
+  // Renders f and reads the picture back into frame (BOTTOM_UP rows).
+  void render(const Fluid& f, const ColourOptions& options, int frameNr, ImageFrame& frame);
+
+private:
+  QOffscreenSurface surface;
+  QOpenGLContext context;
+  std::unique_ptr<QOpenGLFramebufferObject> fbo;
+  QOpenGLShaderProgram program;
+  unsigned int quadVAO{0}, quadVBO{0}, quadEBO{0};
+  unsigned int gridTexture{0};
+  int gridTextureX{0};
+  int gridTextureY{0};
+  std::vector<Rgba8> gridPixels;
+};
+
+#endif
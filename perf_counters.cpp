@@ -0,0 +1,154 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+
+const char* counterNames[PERF_COUNTER_COUNT]{
+    "cycles", "instructions", "branches", "branch_misses", "cache_references", "cache_misses"};
+
+const uint64_t counterConfigs[PERF_COUNTER_COUNT]{
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES};
+
+int open_counter(PerfCounter counter, int groupFd)
+{
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counterConfigs[counter];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid 0, cpu -1: this thread, on whichever CPU it runs.
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+std::string paranoid_level()
+{
+    std::ifstream in("/proc/sys/kernel/perf_event_paranoid");
+    std::string level;
+    return std::getline(in, level) ? level : "unknown";
+}
+
+struct ThreadGroup {
+    bool tried{false};
+    std::string failure;
+    int fds[PERF_COUNTER_COUNT]{-1, -1, -1, -1, -1, -1};
+    int position[PERF_COUNTER_COUNT]{-1, -1, -1, -1, -1, -1}; // in a group read
+    int numOpen{0};
+
+    ~ThreadGroup()
+    {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    bool open(std::string& error)
+    {
+        if (!tried)
+        {
+            tried = true;
+            fds[PERF_CYCLES] = open_counter(PERF_CYCLES, -1);
+            if (fds[PERF_CYCLES] < 0)
+            {
+                int code = errno;
+                failure = std::string("perf_event_open: ") + std::strerror(code);
+                if (code == EACCES || code == EPERM)
+                {
+                    failure += " (kernel.perf_event_paranoid is " + paranoid_level() + ")";
+                }
+                else if (code == ENOENT || code == EOPNOTSUPP || code == ENODEV)
+                {
+                    failure += " (no hardware counters, e.g. in a virtual machine)";
+                }
+                else if (code == ENOSYS)
+                {
+                    failure += " (not supported by this kernel)";
+                }
+            }
+            else
+            {
+                position[PERF_CYCLES] = numOpen++;
+                for (int k{PERF_CYCLES + 1}; k < PERF_COUNTER_COUNT; ++k)
+                {
+                    fds[k] = open_counter(static_cast<PerfCounter>(k), fds[PERF_CYCLES]);
+                    if (fds[k] >= 0)
+                    {
+                        position[k] = numOpen++;
+                    }
+                }
+            }
+        }
+        error = failure;
+        return numOpen > 0;
+    }
+};
+
+thread_local ThreadGroup threadGroup;
+
+}
+
+const char* perf_counter_name(PerfCounter counter)
+{
+    return counter < PERF_COUNTER_COUNT ? counterNames[counter] : "unknown";
+}
+
+bool PerfCounters::enable(std::string& error)
+{
+    if (!threadGroup.open(error))
+    {
+        return false;
+    }
+    for (int k{0}; k < PERF_COUNTER_COUNT; ++k)
+    {
+        opened[k] = threadGroup.position[k] >= 0;
+    }
+    on.store(true, std::memory_order_release);
+    return true;
+}
+
+void PerfCounters::disable()
+{
+    on.store(false, std::memory_order_release);
+}
+
+bool PerfCounters::sample(PerfSample& sample) const
+{
+    std::string error;
+    if (!threadGroup.open(error))
+    {
+        return false;
+    }
+
+    // nr, time enabled, time running, then one value per counter in the group
+    uint64_t data[3 + PERF_COUNTER_COUNT];
+    if (read(threadGroup.fds[PERF_CYCLES], data, sizeof(data)) < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+    {
+        return false;
+    }
+    double scale = data[2] > 0 ? static_cast<double>(data[1]) / data[2] : 0.0;
+    for (int k{0}; k < PERF_COUNTER_COUNT; ++k)
+    {
+        int position = threadGroup.position[k];
+        sample.values[k] = position >= 0 && position < static_cast<int>(data[0]) ? data[3 + position] * scale : 0.0;
+    }
+    return true;
+}
+
+PerfCounters& perf_counters()
+{
+    static PerfCounters counters;
+    return counters;
+}
@@ -0,0 +1,48 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+#include <atomic>
+#include <string>
+
+// Hardware counters of the calling thread through Linux perf_event_open, user
+// space only. Each thread opens its own group, led by cycles, the first time
+// it samples, so that all of a group's counters cover the same instructions.
+// Counters the CPU or the hypervisor does not expose are left out of the group.
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCHES,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_REFERENCES, // last-level cache
+    PERF_CACHE_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+const char* perf_counter_name(PerfCounter counter);
+
+// Counter values since the group was opened, scaled up for any time the
+// kernel multiplexed the group off the PMU.
+struct PerfSample {
+    double values[PERF_COUNTER_COUNT]{};
+};
+
+class PerfCounters
+{
+public:
+    // Opens the calling thread's group to check counters work at all, e.g.
+    // not refused by kernel.perf_event_paranoid or missing in a VM.
+    bool enable(std::string& error);
+    void disable();
+    bool enabled() const { return on.load(std::memory_order_acquire); }
+    // Whether the enabling thread could open this counter.
+    bool available(PerfCounter counter) const { return opened[counter]; }
+
+    // False if the calling thread's group could not be opened or read.
+    bool sample(PerfSample& sample) const;
+
+private:
+    std::atomic<bool> on{false};
+    bool opened[PERF_COUNTER_COUNT]{};
+};
+
+PerfCounters& perf_counters();
+#endif // PERF_COUNTERS_H
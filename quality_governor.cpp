@@ -0,0 +1,97 @@
+#include "quality_governor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+
+// Dead band around the target: no change between these fractions of it.
+constexpr double overBudget{1.1};
+constexpr double underBudget{0.75};
+
+}
+
+std::string QualityDecision::describe() const
+{
+    char line[160];
+    std::snprintf(line, sizeof(line), "frame %d: %s %d -> %d (mean step %.2f ms)", frameNr,
+                  kind == ITERATIONS ? "pressure iterations" : "grid resolution", from, to, stepMs);
+    return line;
+}
+
+QualityGovernor::QualityGovernor(const QualitySettings& settings)
+    : config(settings)
+{
+}
+
+bool QualityGovernor::observe(double stepMs, SimulationParameters& params)
+{
+    windowMs += stepMs;
+    windowSteps++;
+    if (windowSteps < config.window)
+    {
+        return false;
+    }
+
+    lastMeanMs = windowMs / windowSteps;
+    windowMs = 0.0;
+    windowSteps = 0;
+
+    int iters = params.numIters;
+    int target = iters;
+    if (lastMeanMs > config.targetStepMs * overBudget)
+    {
+        // The solve is nearly all of a step, so cost scales with iterations.
+        target = static_cast<int>(std::floor(iters * config.targetStepMs / lastMeanMs));
+    }
+    else if (lastMeanMs < config.targetStepMs * underBudget)
+    {
+        target = iters + std::max(1, iters / 4);
+    }
+    target = std::clamp(target, config.minIters, config.maxIters);
+
+    pressure = 0;
+    if (lastMeanMs > config.targetStepMs * overBudget && target == config.minIters)
+    {
+        pressure = -1;
+    }
+    else if (lastMeanMs < config.targetStepMs * underBudget && target == config.maxIters)
+    {
+        pressure = 1;
+    }
+
+    if (target == iters)
+    {
+        return false;
+    }
+    params.numIters = target;
+    history.push_back({QualityDecision::ITERATIONS, params.frameNr, iters, target, lastMeanMs});
+    return true;
+}
+
+int QualityGovernor::next_resolution(int current, int frameNr)
+{
+    if (pressure == 0 || lastMeanMs <= 0.0)
+    {
+        return current;
+    }
+
+    // Step cost goes with the cell count, the square of the resolution.
+    // Growth is capped at a quarter per scene, like the iterations.
+    double scale = std::sqrt(config.targetStepMs / lastMeanMs);
+    int next = static_cast<int>(current * std::min(scale, 1.25));
+    next = std::clamp(next, config.minResolution, config.maxResolution);
+    if (next != current)
+    {
+        history.push_back({QualityDecision::RESOLUTION, frameNr, current, next, lastMeanMs});
+    }
+    return next;
+}
+
+void QualityGovernor::reset()
+{
+    windowMs = 0.0;
+    windowSteps = 0;
+    pressure = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef QUALITY_GOVERNOR_H
+#define QUALITY_GOVERNOR_H
+#include <string>
+#include <vector>
+#include "scene.h"
+
+struct QualitySettings {
+    double targetStepMs{15.0};
+    int minIters{10};
+    int maxIters{100};
+    int minResolution{40};
+    int maxResolution{200};
+    int window{15}; // steps averaged per decision
+};
+
+struct QualityDecision {
+    enum Kind { ITERATIONS, RESOLUTION };
+
+    Kind kind{ITERATIONS};
+    int frameNr{0};
+    int from{0};
+    int to{0};
+    double stepMs{0.0}; // the averaged cost behind it
+
+    std::string describe() const;
+};
+
+// Holds the solver step near a frame-time target. Every window of steps it
+// compares the mean step cost with the target and rescales the pressure
+// iterations, which dominate the step; growth is gradual and there is a dead
+// band, so it settles instead of oscillating. When the iterations are pinned
+// at a limit and still miss, it proposes a new grid resolution for the next
+// scene set-up, since a live grid cannot be resized.
+class QualityGovernor
+{
+public:
+    explicit QualityGovernor(const QualitySettings& settings = QualitySettings{});
+
+    // Feeds one step's cost. Returns true when it changed params.numIters;
+    // the decision is then last_decision().
+    bool observe(double stepMs, SimulationParameters& params);
+
+    // Resolution to build the next scene at, given the current grid's.
+    int next_resolution(int current, int frameNr);
+
+    // Forgets the samples of the previous grid.
+    void reset();
+
+    const QualitySettings& settings() const { return config; }
+    const std::vector<QualityDecision>& decisions() const { return history; }
+    const QualityDecision& last_decision() const { return history.back(); }
+    double mean_step_ms() const { return lastMeanMs; }
+
+private:
+    QualitySettings config;
+    std::vector<QualityDecision> history;
+    double windowMs{0.0};
+    int windowSteps{0};
+    double lastMeanMs{0.0};
+    int pressure{0}; // -1 over budget at minIters, +1 headroom at maxIters
+};
+#endif // QUALITY_GOVERNOR_H
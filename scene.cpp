@@ -0,0 +1,350 @@
+#include "scene.h"
+#include <algorithm>
+#include <cmath>
+
+void setup_scene(SimulationParameters& params, TaskScheduler* scheduler)
+{
+    params.overRelaxation = 1.9;
+    params.dt = 1.0 / 60.0;
+    params.numIters = 40;
+    int res{100};
+
+    if (params.sceneNr == 0)
+    {
+        res = 50;
+    }
+
+    if (params.resolution > 0)
+    {
+        res = params.resolution;
+    }
+
+    double domainHeight{1.0};
+    double simHeight{1.0};
+    double simWidth{1.0};
+    double domainWidth{domainHeight / simHeight * simWidth};
+    double h{domainHeight / res};
+    int numX{static_cast<int>(std::floor(2 * domainWidth / h))};
+    int numY{static_cast<int>(std::floor(domainHeight / h))};
+    double density{1000.0};
+
+    delete params.fluid;
+    params.fluid = new Fluid(density, numX, numY, h);
+    params.baseSolid.clear();
+    params.obstacleBoxValid = false;
+    params.fluid->scheduler = scheduler;
+    params.fluid->distribute_pages();
+    size_t n = params.fluid->numY;
+
+    if (params.sceneNr == 0)
+    {
+        set_scene_for_wind_tunnel(params, n);
+    }
+    else if (params.sceneNr == 1)
+    {
+        set_scene_for_pressure_tank(params, n);
+    }
+    else if (params.sceneNr == 2)
+    {
+        set_scene_for_paint(params, n);
+    }
+}
+
+void set_scene_for_wind_tunnel(SimulationParameters& params, size_t n)
+{
+    for (int i{0}; i < params.fluid->numX; ++i)
+    {
+        for (int j{0}; j < params.fluid->numY; ++j)
+        {
+            double s = 1.0;
+            if (i == 0 || i == params.fluid->numX - 1 || j == 0)
+            {
+                s = 0.0;
+            }
+            params.fluid->s[i * n + j] = s;
+        }
+    }
+
+    params.gravity = -9.81;
+    params.showPressure = true;
+    params.showSmoke = false;
+}
+
+void set_scene_for_pressure_tank(SimulationParameters& params, size_t n)
+{
+    double inVel = 2.0;
+    for (int i{0}; i < params.fluid->numX; ++i)
+    {
+        for (int j{0}; j < params.fluid->numY; ++j)
+        {
+            double s = 1.0;
+            if (i == 0 || j == 0 || j == params.fluid->numY - 1)
+            {
+                s = 0.0;
+            }
+            params.fluid->s[i * n + j] = s;
+
+            if (i == 1)
+            {
+                params.fluid->u[i * n + j] = inVel;
+            }
+        }
+    }
+
+    double pipeH = 0.1 * params.fluid->numY;
+    int minJ = static_cast<int>(std::floor(0.5 * params.fluid->numY - 0.5 * pipeH));
+    int maxJ = static_cast<int>(std::floor(0.5 * params.fluid->numY + 0.5 * pipeH));
+
+    for (int j{minJ}; j < maxJ; ++j)
+    {
+        params.fluid->m[j] = 0.0;
+    }
+
+    set_obstacle(params, 1.0, 0.5, true);
+    params.gravity = 0.0;
+    params.showPressure = false;
+    params.showSmoke = true;
+}
+
+void set_scene_for_paint(SimulationParameters& params, size_t)
+{
+    params.gravity = 0.0;
+    params.overRelaxation = 1.0;
+    params.showPressure = false;
+    params.showSmoke = true;
+}
+
+namespace
+{
+
+using ObstacleStamp = void (*)(SimulationParameters&, Fluid*, int, int, size_t, float, float, double, float, float);
+
+constexpr ObstacleStamp obstacleStamps[]{
+    set_obstacle_for_circle,
+    set_obstacle_for_square,
+    set_obstacle_for_triangle,
+    set_obstacle_for_oval
+};
+
+// Inclusive cell range {i0, i1, j0, j1} that the shape test can mark solid,
+// clamped to the cells set_obstacle is allowed to touch.
+void obstacle_bounds(const SimulationParameters& params, float x, float y, double halfX, double halfY, int box[4])
+{
+    const Fluid* f = params.fluid;
+    // One spare cell each way covers float rounding in the shape tests.
+    box[0] = std::max(1, static_cast<int>(std::floor((x - halfX) / f->h - 0.5)) - 1);
+    box[1] = std::min(f->numX - 3, static_cast<int>(std::ceil((x + halfX) / f->h - 0.5)) + 1);
+    box[2] = std::max(1, static_cast<int>(std::floor((y - halfY) / f->h - 0.5)) - 1);
+    box[3] = std::min(f->numY - 3, static_cast<int>(std::ceil((y + halfY) / f->h - 0.5)) + 1);
+}
+
+// Redraws the draggable obstacle over region: cells go back to baseSolid,
+// then get the shape stamp and any moving obstacles that overlap them.
+void draw_obstacle(SimulationParameters& params, const ShapeSdf* sdf, const int region[4])
+{
+    Fluid* f = params.fluid;
+    size_t n = f->numY;
+    float x = params.obstacleX;
+    float y = params.obstacleY;
+    double r = params.obstacleRadius;
+    float vx = params.obstacleVelocity[0];
+    float vy = params.obstacleVelocity[1];
+
+    if (sdf != nullptr)
+    {
+        float insideSmoke = params.sceneNr == 2 ? 0.5 + 0.5 * std::sin(0.1 * params.frameNr) : 1.0;
+        stamp_shape_sdf(*f, *sdf, x, y, r, vx, vy, params.smoothObstacles, insideSmoke, region, params.baseSolid);
+    }
+    else
+    {
+        ObstacleStamp stamp = params.shape >= 0 ? obstacleStamps[params.shape] : nullptr;
+        for (int i{region[0]}; i <= region[1]; i++)
+        {
+            for (int j{region[2]}; j <= region[3]; j++)
+            {
+                f->s[i * n + j] = params.baseSolid.empty() ? 1.0 : params.baseSolid[i * n + j];
+
+                if (stamp != nullptr)
+                {
+                    float dx = (i + 0.5) * f->h - x;
+                    float dy = (j + 0.5) * f->h - y;
+                    stamp(params, f, i, j, n, dx, dy, r, vx, vy);
+                }
+            }
+        }
+    }
+    params.obstacles.stamp_region(*f, region, params.smoothObstacles);
+}
+
+// Shapes past the four built-in tests, and smooth obstacles, go through
+// their signed distance fields.
+const ShapeSdf* obstacle_sdf(const SimulationParameters& params)
+{
+    if (!params.smoothObstacles && params.shape < 4)
+    {
+        return nullptr;
+    }
+    size_t custom = params.shape - 4;
+    return params.shape >= 4 && custom < params.customShapes.size() ? &params.customShapes[custom] : &builtin_shape_sdf(params.shape);
+}
+
+}
+
+void set_obstacle(SimulationParameters& params, float x, float y, bool reset)
+{
+    ScopedStageTimer timer(STAGE_SET_OBSTACLE);
+    float vx{0.0};
+    float vy{0.0};
+    if (!reset)
+    {
+        vx = (x - params.obstacleX) / params.dt;
+        vy = (y - params.obstacleY) / params.dt;
+    }
+    params.obstacleX = x;
+    params.obstacleY = y;
+    params.obstacleVelocity[0] = vx;
+    params.obstacleVelocity[1] = vy;
+
+    double r = params.obstacleRadius;
+    Fluid* f = params.fluid;
+
+    const ShapeSdf* sdf = obstacle_sdf(params);
+    double halfX = sdf != nullptr ? r * sdf->half_width() : params.shape == 3 ? 1.5 * r : r;
+    double halfY = sdf != nullptr ? r * sdf->half_height() : r;
+
+    // Only cells under the previous or the new obstacle can change. Without a
+    // previous box (a new grid) the whole interior is redrawn.
+    int box[4];
+    obstacle_bounds(params, x, y, halfX, halfY, box);
+    int region[4]{1, f->numX - 3, 1, f->numY - 3};
+    if (params.obstacleBoxValid)
+    {
+        const int* old = params.obstacleBox;
+        bool oldEmpty = old[0] > old[1] || old[2] > old[3];
+        bool newEmpty = box[0] > box[1] || box[2] > box[3];
+        region[0] = oldEmpty ? box[0] : newEmpty ? old[0] : std::min(old[0], box[0]);
+        region[1] = oldEmpty ? box[1] : newEmpty ? old[1] : std::max(old[1], box[1]);
+        region[2] = oldEmpty ? box[2] : newEmpty ? old[2] : std::min(old[2], box[2]);
+        region[3] = oldEmpty ? box[3] : newEmpty ? old[3] : std::max(old[3], box[3]);
+    }
+    draw_obstacle(params, sdf, region);
+
+    std::copy(box, box + 4, params.obstacleBox);
+    params.obstacleBoxValid = true;
+    params.showObstacle = true;
+}
+
+void update_obstacles(SimulationParameters& params)
+{
+    const std::vector<std::array<int, 4>>& redrawn = params.obstacles.update(*params.fluid, params.baseSolid, params.smoothObstacles);
+    if (!params.showObstacle || !params.obstacleBoxValid)
+    {
+        return;
+    }
+    const int* box = params.obstacleBox;
+    for (const std::array<int, 4>& region : redrawn)
+    {
+        int clip[4]{std::max(region[0], box[0]), std::min(region[1], box[1]),
+                    std::max(region[2], box[2]), std::min(region[3], box[3])};
+        if (clip[0] <= clip[1] && clip[2] <= clip[3])
+        {
+            draw_obstacle(params, obstacle_sdf(params), clip);
+        }
+    }
+}
+
+void set_obstacle_for_circle(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+{
+    if (dx * dx + dy * dy < r * r)
+    {
+        f->s[i * n + j] = 0.0;
+        if (params.sceneNr == 2)
+        {
+            f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
+        }
+        else
+        {
+            f->m[i * n + j] = 1.0;
+            f->u[i * n + j] = vx;
+            f->u[(i + 1) * n + j] = vx;
+            f->v[i * n + j] = vy;
+            f->v[i * n + j + 1] = vy;
+        }
+    }
+}
+
+void set_obstacle_for_square(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+{
+    if (std::abs(dx) < r && std::abs(dy) < r)
+    {
+        f->s[i * n + j] = 0.0;
+        if (params.sceneNr == 2)
+        {
+            f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
+        }
+        f->m[i * n + j] = 1.0;
+        f->u[i * n + j] = vx;
+        f->u[(i + 1) * n + j] = vx;
+        f->v[i * n + j] = vy;
+        f->v[i * n + j + 1] = vy;
+    }
+}
+
+void set_obstacle_for_triangle(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+{
+    if (std::abs(dx) < r && std::abs(dy) < r)
+    {
+        if ((dx >= 0 && dy >= 0 && dx - dy >= 0) || (dx >= 0 && dy <= 0 && dx + dy >= 0))
+        {
+            f->s[i * n + j] = 0.0;
+            if (params.sceneNr == 2)
+            {
+                f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
+            }
+
+
+            f->m[i * n + j] = 1.0;
+            f->u[i * n + j] = vx;
+            f->u[(i + 1) * n + j] = vx;
+            if (dx >= 0 && dy >= 0 && dx - dy >= 0)
+            {
+                f->v[i * n + j] = vy;
+                f->v[i * n + j + 1] = vy;
+            }
+            else
+            {
+                f->v[i * n + j] = -vy;
+                f->v[i * n + j + 1] = -vy;
+            }
+        }
+    }
+}
+
+void set_obstacle_for_oval(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy)
+{
+    double ovalRadiusX{r * 1.5};
+    double ovalRadiusY{r * 1.0};
+
+    if ((dx * dx) / (ovalRadiusX * ovalRadiusX) + (dy * dy) / (ovalRadiusY * ovalRadiusY) < 1)
+    {
+        f->s[i * n + j] = 0.0;
+        if (params.sceneNr == 2)
+        {
+            f->m[i * n + j] = 0.5 + 0.5 * std::sin(0.1 * params.frameNr);
+        }
+        f->m[i * n + j] = 1.0;
+        f->u[i * n + j] = vx;
+        f->u[(i + 1) * n + j] = vx;
+        f->v[i * n + j] = vy;
+        f->v[i * n + j + 1] = vy;
+    }
+}
+
+void simulate_step(SimulationParameters& params)
+{
+    ScopedStageTimer timer(STAGE_STEP);
+    params.fluid->overRelaxation = params.overRelaxation;
+    params.fluid->outputs = params.outputs.active();
+    params.fluid->simulate(params.dt, params.gravity, params.numIters);
+    params.frameNr++;
+}
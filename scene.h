@@ -0,0 +1,65 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include <cstddef>
+#include "fluid.h"
+#include "obstacle_sdf.h"
+#include "obstacle_set.h"
+#include "task_scheduler.h"
+
+struct SimulationParameters {
+    double gravity{-9.81};
+    double dt{1.0 / 120.0};
+    int numIters{100};
+    int frameNr{0};
+    double overRelaxation{1.9};
+    double obstacleX{0.0};
+    double obstacleY{0.0};
+    double obstacleRadius{0.085};
+    bool paused{false};
+    int sceneNr{1};
+    int resolution{0}; // 0 keeps the scene's own resolution
+    bool showObstacle{false};
+    bool showPressure{false};
+    bool showSmoke{true};
+    bool showStreamlines{false};
+    bool showArrows{false};
+    Fluid* fluid{nullptr};
+    std::vector<float> baseSolid; // s without the draggable obstacle; empty means all fluid
+    int obstacleBox[4]{0, -1, 0, -1}; // i0, i1, j0, j1 stamped by the last set_obstacle
+    bool obstacleBoxValid{false}; // false after a new grid: the next set_obstacle redraws it all
+    bool smoothObstacles{false}; // stamp SDF shapes with fractional s
+    std::vector<ShapeSdf> customShapes; // shape 4 onwards
+    float obstacleVelocity[2]{0.0, 0.0}; // of the last set_obstacle, for redraws
+    ObstacleSet obstacles; // independently moving obstacles besides the draggable one
+    OutputDemand outputs; // what the consumers read; simulate_step passes it to the fluid
+    int shape{0};
+    float offsetForObstacle[5][2]{
+        {0.01, 0.015}, // 0 is for Circle
+        {0.03, 0.015}, // 1 is for Square
+        {0.03, 0.015}, // 2 is for Triangle
+        {0.01, 0.015}, // 2 is for Oval
+        {0.0, 0.0} // 4 onwards are custom shapes
+    };
+};
+
+// Scene construction shared by the GUI and the headless tools. sceneNr 0 is
+// the tank, 1 the wind tunnel and 2 the paint scene. setup_scene replaces
+// params.fluid (deleting the previous one).
+void setup_scene(SimulationParameters& params, TaskScheduler* scheduler = nullptr);
+void set_scene_for_wind_tunnel(SimulationParameters& params, size_t n);
+void set_scene_for_pressure_tank(SimulationParameters& params, size_t n);
+void set_scene_for_paint(SimulationParameters& params, size_t n);
+
+void set_obstacle(SimulationParameters& params, float x, float y, bool reset);
+// Redraws the cells under params.obstacles that moved since the last call,
+// keeping the draggable obstacle on top where they overlap.
+void update_obstacles(SimulationParameters& params);
+void set_obstacle_for_circle(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
+void set_obstacle_for_square(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
+void set_obstacle_for_triangle(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
+void set_obstacle_for_oval(SimulationParameters& params, Fluid* f, int i, int j, size_t n, float dx, float dy, double r, float vx, float vy);
+
+// Steps params.fluid with the solver settings in params (dt, gravity,
+// numIters and overRelaxation) and the consumers' output demand.
+void simulate_step(SimulationParameters& params);
+#endif // SCENE_H
@@ -0,0 +1,465 @@
+#include "scene_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace
+{
+
+constexpr char sceneCacheMagic[8]{'E', 'F', 'S', 'S', 'C', 'E', 'N', 'E'};
+constexpr uint32_t sceneCacheVersion{1};
+
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t hash;
+    int32_t numX;
+    int32_t numY;
+};
+
+std::string trim(const std::string& text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+int index_of(const std::string& value, std::initializer_list<const char*> names)
+{
+    int index{0};
+    for (const char* name : names)
+    {
+        if (value == name)
+        {
+            return index;
+        }
+        index++;
+    }
+    return -1;
+}
+
+bool parse_number(const std::string& value, double& out)
+{
+    std::stringstream number(value);
+    return static_cast<bool>(number >> out) && number.eof();
+}
+
+bool parse_bool(const std::string& value, bool& out)
+{
+    int index = index_of(value, {"false", "true", "0", "1"});
+    out = index % 2 == 1;
+    return index >= 0;
+}
+
+bool parse_vertices(const std::string& value, std::vector<float>& vertices)
+{
+    vertices.clear();
+    std::stringstream list(value);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        std::stringstream pair(item);
+        float x{0.0f};
+        float y{0.0f};
+        if (!(pair >> x >> y))
+        {
+            return false;
+        }
+        vertices.push_back(x);
+        vertices.push_back(y);
+    }
+    return vertices.size() >= 6;
+}
+
+bool parse_entry(const std::string& section, const std::string& key, const std::string& value, SceneDescription& scene)
+{
+    double number{0.0};
+    bool isNumber = parse_number(value, number);
+
+    if (section == "scene")
+    {
+        if (key == "kind") { scene.sceneNr = index_of(value, {"tank", "windtunnel", "paint"}); return scene.sceneNr >= 0; }
+        if (key == "resolution") { scene.resolution = static_cast<int>(number); return isNumber && number >= 4; }
+        if (key == "width") { scene.width = number; return isNumber && number > 0.0; }
+        if (key == "height") { scene.height = number; return isNumber && number > 0.0; }
+        if (key == "density") { scene.density = number; return isNumber && number > 0.0; }
+        if (key == "smoothObstacles") { return parse_bool(value, scene.smoothObstacles); }
+    }
+    else if (section == "solver")
+    {
+        if (key == "gravity") { scene.gravity = number; return isNumber; }
+        if (key == "dt") { scene.dt = number; return isNumber && number > 0.0; }
+        if (key == "numIters") { scene.numIters = static_cast<int>(number); return isNumber && number >= 1; }
+        if (key == "overRelaxation") { scene.overRelaxation = number; return isNumber; }
+    }
+    else if (section == "boundary")
+    {
+        int side = index_of(key, {"left", "right", "bottom", "top"});
+        int type = index_of(value, {"solid", "open", "inflow"});
+        if (side >= 0)
+        {
+            scene.boundary[side] = type;
+            return type >= 0 && (type != BOUNDARY_INFLOW || side == SIDE_LEFT);
+        }
+    }
+    else if (section == "inflow")
+    {
+        if (key == "velocity") { scene.inflowVelocity = number; return isNumber; }
+        if (key == "smokeCentre") { scene.smokeCentre = number; return isNumber; }
+        if (key == "smokeWidth") { scene.smokeWidth = number; return isNumber && number >= 0.0; }
+    }
+    else if (section == "obstacle")
+    {
+        SceneObstacle& obstacle = scene.obstacles.back();
+        if (key == "shape") { obstacle.shape = index_of(value, {"circle", "square", "triangle", "oval", "polygon"}); return obstacle.shape >= 0; }
+        if (key == "vertices") { return parse_vertices(value, obstacle.vertices); }
+        if (key == "x") { obstacle.x = number; return isNumber; }
+        if (key == "y") { obstacle.y = number; return isNumber; }
+        if (key == "radius") { obstacle.radius = number; return isNumber && number > 0.0; }
+        if (key == "draggable") { return parse_bool(value, obstacle.draggable); }
+    }
+    else if (section == "view")
+    {
+        if (key == "showPressure") { return parse_bool(value, scene.showPressure); }
+        if (key == "showSmoke") { return parse_bool(value, scene.showSmoke); }
+    }
+    return false;
+}
+
+uint64_t fnv1a(const std::string& text, uint64_t hash = 14695981039346656037ull)
+{
+    for (unsigned char c : text)
+    {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void make_directories(const std::string& path)
+{
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+    {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+        if (slash == std::string::npos)
+        {
+            return;
+        }
+    }
+}
+
+// Creates the grid and copies the description's solver and view settings.
+void create_fluid(const SceneDescription& scene, SimulationParameters& params, TaskScheduler* scheduler)
+{
+    int res = params.resolution > 0 ? params.resolution : scene.resolution;
+    double h{scene.height / res};
+    int numX{static_cast<int>(std::floor(scene.width / h))};
+    int numY{static_cast<int>(std::floor(scene.height / h))};
+
+    delete params.fluid;
+    params.fluid = new Fluid(scene.density, numX, numY, h);
+    params.fluid->scheduler = scheduler;
+    params.fluid->distribute_pages();
+
+    params.sceneNr = scene.sceneNr;
+    params.gravity = scene.gravity;
+    params.dt = scene.dt;
+    params.numIters = scene.numIters;
+    params.overRelaxation = scene.overRelaxation;
+    params.showPressure = scene.showPressure;
+    params.showSmoke = scene.showSmoke;
+    params.showObstacle = false;
+    params.obstacleBoxValid = false;
+    params.smoothObstacles = scene.smoothObstacles;
+    params.customShapes.clear();
+}
+
+ShapeSdf obstacle_sdf(const SceneObstacle& obstacle)
+{
+    if (obstacle.shape == scenePolygonShape)
+    {
+        return ShapeSdf::polygon(obstacle.vertices).precomputed();
+    }
+    return builtin_shape_sdf(obstacle.shape);
+}
+
+void rasterise(const SceneDescription& scene, SimulationParameters& params)
+{
+    Fluid* f = params.fluid;
+    size_t n = f->numY;
+
+    for (int i{0}; i < f->numX; ++i)
+    {
+        for (int j{0}; j < f->numY; ++j)
+        {
+            bool solid = (i == 0 && scene.boundary[SIDE_LEFT] != BOUNDARY_OPEN)
+                         || (i == f->numX - 1 && scene.boundary[SIDE_RIGHT] == BOUNDARY_SOLID)
+                         || (j == 0 && scene.boundary[SIDE_BOTTOM] == BOUNDARY_SOLID)
+                         || (j == f->numY - 1 && scene.boundary[SIDE_TOP] == BOUNDARY_SOLID);
+            f->s[i * n + j] = solid ? 0.0 : 1.0;
+
+            if (i == 1 && scene.boundary[SIDE_LEFT] == BOUNDARY_INFLOW)
+            {
+                f->u[i * n + j] = scene.inflowVelocity;
+            }
+        }
+    }
+
+    if (scene.boundary[SIDE_LEFT] == BOUNDARY_INFLOW && scene.smokeWidth > 0.0)
+    {
+        double bandH = scene.smokeWidth * f->numY;
+        int minJ = static_cast<int>(std::floor(scene.smokeCentre * f->numY - 0.5 * bandH));
+        int maxJ = static_cast<int>(std::floor(scene.smokeCentre * f->numY + 0.5 * bandH));
+        for (int j{std::max(minJ, 0)}; j < std::min(maxJ, f->numY); ++j)
+        {
+            f->m[j] = 0.0;
+        }
+    }
+
+    for (const SceneObstacle& obstacle : scene.obstacles)
+    {
+        if (obstacle.draggable)
+        {
+            continue;
+        }
+        if (scene.smoothObstacles || obstacle.shape == scenePolygonShape)
+        {
+            int region[4]{1, f->numX - 2, 1, f->numY - 2};
+            stamp_shape_sdf(*f, obstacle_sdf(obstacle), obstacle.x, obstacle.y, obstacle.radius, 0.0, 0.0,
+                            scene.smoothObstacles, 1.0, region, f->s);
+            continue;
+        }
+        for (int i{1}; i < f->numX - 1; ++i)
+        {
+            for (int j{1}; j < f->numY - 1; ++j)
+            {
+                float dx = (i + 0.5) * f->h - obstacle.x;
+                float dy = (j + 0.5) * f->h - obstacle.y;
+                switch (obstacle.shape)
+                {
+                    case 0: set_obstacle_for_circle(params, f, i, j, n, dx, dy, obstacle.radius, 0.0, 0.0); break;
+                    case 1: set_obstacle_for_square(params, f, i, j, n, dx, dy, obstacle.radius, 0.0, 0.0); break;
+                    case 2: set_obstacle_for_triangle(params, f, i, j, n, dx, dy, obstacle.radius, 0.0, 0.0); break;
+                    default: set_obstacle_for_oval(params, f, i, j, n, dx, dy, obstacle.radius, 0.0, 0.0); break;
+                }
+            }
+        }
+    }
+}
+
+// The draggable obstacle is not part of the cached fields: set_obstacle
+// restores params.baseSolid around it whenever it moves.
+void place_draggable(const SceneDescription& scene, SimulationParameters& params)
+{
+    params.baseSolid = params.fluid->s;
+    for (const SceneObstacle& obstacle : scene.obstacles)
+    {
+        if (obstacle.draggable)
+        {
+            if (obstacle.shape == scenePolygonShape)
+            {
+                params.customShapes.push_back(obstacle_sdf(obstacle));
+            }
+            params.shape = obstacle.shape;
+            params.obstacleRadius = obstacle.radius;
+            set_obstacle(params, obstacle.x, obstacle.y, true);
+        }
+    }
+}
+
+bool read_cache(const std::string& path, uint64_t hash, Fluid& f)
+{
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    SceneCacheHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+              && std::memcmp(header.magic, sceneCacheMagic, sizeof(header.magic)) == 0
+              && header.version == sceneCacheVersion && header.hash == hash
+              && header.numX == f.numX && header.numY == f.numY;
+
+    // Read into scratch buffers so a truncated cache leaves the fields alone.
+    std::vector<float> fields[3];
+    for (std::vector<float>& field : fields)
+    {
+        field.resize(f.numCells);
+        ok = ok && std::fread(field.data(), sizeof(float), field.size(), file) == field.size();
+    }
+    std::fclose(file);
+
+    // Copied rather than swapped in, so the fields keep the page placement
+    // distribute_pages() gave them.
+    if (ok)
+    {
+        std::copy(fields[0].begin(), fields[0].end(), f.s.begin());
+        std::copy(fields[1].begin(), fields[1].end(), f.u.begin());
+        std::copy(fields[2].begin(), fields[2].end(), f.m.begin());
+    }
+    return ok;
+}
+
+void write_cache(const std::string& path, uint64_t hash, const Fluid& f)
+{
+    std::string temporary = path + ".tmp";
+    FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    SceneCacheHeader header{};
+    std::memcpy(header.magic, sceneCacheMagic, sizeof(header.magic));
+    header.version = sceneCacheVersion;
+    header.hash = hash;
+    header.numX = f.numX;
+    header.numY = f.numY;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const std::vector<float>* field : {&f.s, &f.u, &f.m})
+    {
+        ok = ok && std::fwrite(field->data(), sizeof(float), field->size(), file) == field->size();
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+    }
+}
+
+}
+
+bool parse_scene_description(std::istream& in, SceneDescription& scene, std::string& error)
+{
+    scene = SceneDescription{};
+    std::string section;
+    std::string line;
+    int lineNr{0};
+    while (std::getline(in, line))
+    {
+        lineNr++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+        {
+            continue;
+        }
+
+        if (line.front() == '[' && line.back() == ']')
+        {
+            section = trim(line.substr(1, line.size() - 2));
+            if (index_of(section, {"scene", "solver", "boundary", "inflow", "obstacle", "view"}) < 0)
+            {
+                error = "line " + std::to_string(lineNr) + ": unknown section [" + section + "]";
+                return false;
+            }
+            if (section == "obstacle")
+            {
+                scene.obstacles.emplace_back();
+            }
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        std::string key = trim(line.substr(0, eq));
+        std::string value = eq == std::string::npos ? "" : trim(line.substr(eq + 1));
+        if (section.empty() || eq == std::string::npos || !parse_entry(section, key, value, scene))
+        {
+            error = "line " + std::to_string(lineNr) + ": bad entry '" + line + "'"
+                    + (section.empty() ? "" : " in [" + section + "]");
+            return false;
+        }
+    }
+
+    int numDraggable{0};
+    for (const SceneObstacle& obstacle : scene.obstacles)
+    {
+        numDraggable += obstacle.draggable ? 1 : 0;
+        if ((obstacle.shape == scenePolygonShape) != !obstacle.vertices.empty())
+        {
+            error = "polygon obstacles need vertices, and only polygons take them";
+            return false;
+        }
+    }
+    if (numDraggable > 1)
+    {
+        error = "at most one obstacle can be draggable";
+        return false;
+    }
+    return true;
+}
+
+void build_scene(const SceneDescription& scene, SimulationParameters& params, TaskScheduler* scheduler)
+{
+    create_fluid(scene, params, scheduler);
+    rasterise(scene, params);
+    place_draggable(scene, params);
+}
+
+bool load_scene_file(const std::string& path, SimulationParameters& params, TaskScheduler* scheduler,
+                     const std::string& cacheDir, std::string& error, bool* fromCache)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+
+    SceneDescription scene;
+    if (!parse_scene_description(text, scene, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+
+    create_fluid(scene, params, scheduler);
+
+    uint64_t hash = fnv1a(text.str());
+    hash = fnv1a(std::to_string(params.resolution) + "/" + std::to_string(sceneCacheVersion), hash);
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+    std::string cachePath = cacheDir.empty() ? "" : cacheDir + "/" + name;
+
+    bool hit = !cachePath.empty() && read_cache(cachePath, hash, *params.fluid);
+    if (!hit)
+    {
+        rasterise(scene, params);
+        if (!cachePath.empty())
+        {
+            make_directories(cacheDir);
+            write_cache(cachePath, hash, *params.fluid);
+        }
+    }
+    if (fromCache != nullptr)
+    {
+        *fromCache = hit;
+    }
+
+    place_draggable(scene, params);
+    return true;
+}
+
+std::string default_scene_cache_dir()
+{
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg != nullptr && xdg[0] != '\0')
+    {
+        return std::string(xdg) + "/fluid-scenes";
+    }
+    const char* home = std::getenv("HOME");
+    return home != nullptr ? std::string(home) + "/.cache/fluid-scenes" : "";
+}
@@ -4,12 +4,16 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <QFile>
 #include <QDebug>
+#include <QPainter>
 #include <string>
 #define STB_IMAGE_IMPLEMENTATION
 #include <iostream>
 #include "mainwindow.hpp"
 #include "fluid.h"
+#include "colour_map.h"
+#include "stage_timers.h"
 #include <algorithm>
+#include <cmath>
 
 extern SimulationParameters params;
 MainWindow* mainW;
@@ -93,6 +97,31 @@ void SceneView::initializeGL()
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
+    projectionLoc = glGetUniformLocation(shaderProgram, "projection");
+    objectTypeLoc = glGetUniformLocation(shaderProgram, "objectType");
+    viewLoc = glGetUniformLocation(shaderProgram, "view");
+    viewSquareLoc = glGetUniformLocation(shaderProgram, "viewSquare");
+    colorLocForCircle = glGetUniformLocation(shaderProgram, "currentColorForCircle");
+    gridTextureLoc = glGetUniformLocation(shaderProgram, "gridTexture");
+
+    glGenTextures(1, &gridTexture);
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenBuffers(pixelBufferCount, pixelBuffers);
+
+    glGenVertexArrays(1, &flowVAO);
+    glGenBuffers(1, &flowVBO);
+    glBindVertexArray(flowVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, flowVBO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
     render_squares();
     render_circle_object();
     render_square_object();
@@ -103,58 +132,56 @@ void SceneView::initializeGL()
 
 void SceneView::paintGL()
 {
+    {
+        ScopedStageTimer timer(STAGE_PAINT);
+        draw();
+    }
+    if (showTimings)
+    {
+        paint_timings();
+    }
+}
+
+// p50 and p99 of every timed stage over the last frames, in the top left corner.
+void SceneView::paint_timings()
+{
+    QString text = stageTimersEnabled ? "stage          p50 us    p99 us" : "built without FLUID_ENABLE_TIMERS";
+    for (int k{0}; k < STAGE_COUNT && stageTimersEnabled; ++k)
+    {
+        StageHistogram h = stage_timers().histogram(static_cast<TimedStage>(k));
+        if (h.count() > 0)
+        {
+            text += QString("\n%1 %2 %3").arg(QString::fromLatin1(stage_name(static_cast<TimedStage>(k))), -12)
+                                         .arg(h.percentile_us(0.5), 9, 'f', 0)
+                                         .arg(h.percentile_us(0.99), 9, 'f', 0);
+        }
+    }
+
+    QPainter painter(this);
+    QFont font("Monospace");
+    font.setStyleHint(QFont::TypeWriter);
+    painter.setFont(font);
+    QRect box = painter.boundingRect(QRect(10, 10, width(), height()), Qt::AlignLeft | Qt::AlignTop, text);
+    painter.fillRect(box.adjusted(-6, -6, 6, 6), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(box, Qt::AlignLeft | Qt::AlignTop, text);
+}
+
+void SceneView::draw()
+{
+    // The timing overlay's QPainter leaves its own GL state behind.
+    glEnable(GL_DEPTH_TEST);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
     glUseProgram(shaderProgram);
 
     glm::mat4 projection = glm::mat4(1.0f);
     projection = glm::perspective(glm::radians(45.0f), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
-    unsigned int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-    objectTypeLoc = glGetUniformLocation(shaderProgram, "objectType");
     glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, &projection[0][0]);
-    colorLocForCircle = glGetUniformLocation(shaderProgram, "currentColorForCircle");
 
     if (params.fluid != nullptr)
     {
-        Fluid* f = params.fluid;
-        size_t n = f->numY;
-        float h = f->h;
-        float minP = f->p[0];
-        float maxP = f->p[0];
-
-        for (int i = 0; i < params.fluid->numCells; i++)
-        {
-            minP = std::min(minP, f->p[i]);
-            maxP = std::max(maxP, f->p[i]);
-        }
-        colourValues.resize(f->numX, std::vector<std::vector<double>>(f->numY, std::vector<double>(3, 0)));
-        for (int i{0}; i < f->numX; i++)
-        {
-            for (int j{0}; j < f->numY; j++)
-            {
-                if(params.showPressure)
-                {
-                    paint_show_pressure(f, i, j, n, minP, maxP);
-                }
-                else if (params.showSmoke)
-                {
-                    paint_show_smoke(f, i, j, n, minP, maxP);
-                }
-                else if (f->s[i*n + j] == 0.0)
-                {
-                    colour[0] = 0;
-                    colour[1] = 0;
-                    colour[2] = 0;
-                    colourValues[i][j] = colour;
-                }
-
-                x = std::floor(c_x(i * h));
-                r = colour[0];
-                g = colour[1];
-                b = colour[2];
-                colourValues[i][j] = colour;
-            }
-        }
+        upload_grid();
 
         if (params.showObstacle)
         {
@@ -190,6 +217,10 @@ void SceneView::paintGL()
         draw_oval_to_screen();
     }
 
+    if (params.fluid != nullptr && (params.showStreamlines || params.showArrows))
+    {
+        draw_flow_lines();
+    }
     paint_squares();
     glBindVertexArray(0);
 }
@@ -202,6 +233,118 @@ void SceneView::resizeGL(int width, int height)
 void SceneView::teardownGL()
 {
   makeCurrent();
+  if (pixelBuffers[0] == 0)
+  {
+      doneCurrent();
+      return;
+  }
+  for (int k{0}; k < pixelBufferCount; ++k)
+  {
+      if (pixelFences[k] != nullptr)
+      {
+          glDeleteSync(pixelFences[k]);
+          pixelFences[k] = nullptr;
+      }
+  }
+  glDeleteBuffers(pixelBufferCount, pixelBuffers);
+  glDeleteBuffers(1, &flowVBO);
+  glDeleteVertexArrays(1, &flowVAO);
+  doneCurrent();
+}
+
+// Runs after each step, outside paintGL: the colour pass writes straight into
+// the next buffer of the ring while the copies queued from the others may
+// still be in flight. Its fence only blocks if the GPU is a whole ring behind.
+void SceneView::colour_frame()
+{
+    if (params.fluid == nullptr)
+    {
+        return;
+    }
+
+    const Fluid& f = *params.fluid;
+    ColourOptions options;
+    options.showPressure = params.showPressure;
+    options.showSmoke = params.showSmoke;
+    options.smokeInColour = params.sceneNr == 2;
+    readyNumX = f.numX;
+    readyNumY = f.numY;
+    readySlot = -1;
+    pixelsReady = false;
+
+    // Before initializeGL there is no ring yet.
+    if (pixelBuffers[0] == 0)
+    {
+        colour_fluid(f, options, gridPixels);
+        pixelsReady = true;
+        return;
+    }
+
+    makeCurrent();
+    size_t bytes = static_cast<size_t>(f.numCells) * sizeof(Rgba8);
+    int slot = pixelFrame++ % pixelBufferCount;
+    if (pixelFences[slot] != nullptr)
+    {
+        glClientWaitSync(pixelFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(pixelFences[slot]);
+        pixelFences[slot] = nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[slot]);
+    if (pixelBufferBytes[slot] != bytes)
+    {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        pixelBufferBytes[slot] = bytes;
+    }
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped != nullptr)
+    {
+        colour_fluid(f, options, static_cast<Rgba8*>(mapped));
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        readySlot = slot;
+    }
+    else
+    {
+        // No mapping available: paintGL uploads from memory instead.
+        colour_fluid(f, options, gridPixels);
+        pixelsReady = true;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    doneCurrent();
+}
+
+// Uploads the frame colour_frame() left ready. Without one (a repaint between
+// steps) the texture still holds the last frame.
+void SceneView::upload_grid()
+{
+    if (readySlot < 0 && !pixelsReady)
+    {
+        return;
+    }
+
+    // Texel rows are grid columns: the texture is numY wide and numX high.
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    if (gridTextureX != readyNumY || gridTextureY != readyNumX)
+    {
+        gridTextureX = readyNumY;
+        gridTextureY = readyNumX;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, gridTextureX, gridTextureY, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    if (readySlot >= 0)
+    {
+        // Sourced from the bound buffer, so this only queues the copy.
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[readySlot]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gridTextureX, gridTextureY, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pixelFences[readySlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readySlot = -1;
+        return;
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gridTextureX, gridTextureY, GL_RGBA, GL_UNSIGNED_BYTE, gridPixels.data());
+    pixelsReady = false;
 }
 
 void SceneView::print_context_information()
@@ -227,34 +370,70 @@ void SceneView::paint_squares()
 {
     if (params.fluid != nullptr)
     {
-        size_t numXValue = params.fluid->numX;
-        size_t numYValue = params.fluid->numY;
+        // The whole grid is one textured quad, numX by numY cells of squareSize.
+        glm::mat4 viewSquare = glm::mat4(1.0f);
+        viewSquare = glm::translate(viewSquare, glm::vec3(0.0f, 0.0f, -3.0f));
+        viewSquare = glm::scale(viewSquare, glm::vec3(params.fluid->numX * squareSize, params.fluid->numY * squareSize, 1.0f));
+        glUniformMatrix4fv(viewSquareLoc, 1, GL_FALSE, glm::value_ptr(viewSquare));
+        glUniform1i(objectTypeLoc, 2);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gridTexture);
+        glUniform1i(gridTextureLoc, 0);
+        glBindVertexArray(squareVAO);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    }
+}
 
-        for (int i{0}; i < numXValue; ++i)
-        {
-            for (int j{0}; j < numYValue; ++j)
-            {
-                glm::mat4 viewSquare = glm::mat4(1.0f);
-                float xPos = (i - (0.5f) * (numXValue - 1)) * squareSize;
-                float yPos = (j - (0.5f) * (numYValue - 1)) * squareSize;
-                viewSquare = glm::translate(viewSquare, glm::vec3(xPos, yPos, -3.0f));
-                unsigned int viewLocSquare = glGetUniformLocation(shaderProgram, "viewSquare");
-                glUniformMatrix4fv(viewLocSquare, 1, GL_FALSE, glm::value_ptr(viewSquare));
-                unsigned int colorLocForSquares = glGetUniformLocation(shaderProgram, "currentColorForSquares");
-                glUniform3f(colorLocForSquares, colourValues[i][j][0] / 255.0f, colourValues[i][j][1] / 255.0f, colourValues[i][j][2] / 255.0f);
-                glUniform1i(objectTypeLoc, 2);
-                glBindVertexArray(squareVAO);
-                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-            }
-        }
+void SceneView::draw_flow_lines()
+{
+    // On-screen size of a cell: the quad is squareSize per cell at z = -3
+    // under a 45 degree vertical field of view.
+    float visibleHeight = 2.0f * 3.0f * std::tan(glm::radians(22.5f));
+    float pixelsPerCell = height() * squareSize / visibleHeight;
+
+    FlowLineSettings settings;
+    settings.streamlines = params.showStreamlines;
+    settings.arrows = params.showArrows;
+    Fluid* f = params.fluid;
+    flowLines.trace(*f, f->scheduler, pixelsPerCell, settings);
+    const std::vector<float>& vertices = flowLines.vertices();
+    if (vertices.empty())
+    {
+        return;
+    }
+
+    size_t bytes = vertices.size() * sizeof(float);
+    glBindBuffer(GL_ARRAY_BUFFER, flowVBO);
+    if (bytes > flowVBOBytes)
+    {
+        flowVBOBytes = bytes + bytes / 2;
+        glBufferData(GL_ARRAY_BUFFER, flowVBOBytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Drawn in front of the grid quad, in the same space as paint_squares.
+    glm::mat4 view = glm::mat4(1.0f);
+    view = glm::translate(view, glm::vec3(0.0f, 0.0f, -2.99f));
+    view = glm::scale(view, glm::vec3(f->numX * squareSize, f->numY * squareSize, 1.0f));
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    if (params.showPressure)
+    {
+        glUniform3f(colorLocForCircle, 1.0f, 1.0f, 1.0f);
+    }
+    else
+    {
+        glUniform3f(colorLocForCircle, 201 / 255.0f, 36 / 255.0f, 201 / 255.0f);
     }
+    glUniform1i(objectTypeLoc, 0);
+    glBindVertexArray(flowVAO);
+    glDrawArrays(GL_LINES, 0, static_cast<int>(vertices.size() / 2));
 }
 
 void SceneView::draw_circle_to_screen()
 {
     glm::mat4 view = glm::mat4(1.0f);
     view = glm::translate(view, glm::vec3(blueCircleX, blueCircleY, -3.0f));
-    viewLoc = glGetUniformLocation(shaderProgram, "view");
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
     glUniform3f(colorLocForCircle, ballColour[0] / 255.0f, ballColour[1] / 255.0f, ballColour[2] / 255.0f);
     glUniform1i(objectTypeLoc, 0);
@@ -266,7 +445,6 @@ void SceneView::draw_square_to_screen()
 {
     glm::mat4 view = glm::mat4(1.0f);
     view = glm::translate(view, glm::vec3(blueCircleX, blueCircleY, -3.0f));
-    viewLoc = glGetUniformLocation(shaderProgram, "view");
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
     glUniform3f(colorLocForCircle, ballColour[0] / 255.0f, ballColour[1] / 255.0f, ballColour[2] / 255.0f);
     glUniform1i(objectTypeLoc, 0);
@@ -282,7 +460,6 @@ void SceneView::draw_triangle_to_screen()
 {
     glm::mat4 view = glm::mat4(1.0f);
     view = glm::translate(view, glm::vec3(blueCircleX, blueCircleY, -3.0f));
-    viewLoc = glGetUniformLocation(shaderProgram, "view");
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
     glUniform3f(colorLocForCircle, ballColour[0] / 255.0f, ballColour[1] / 255.0f, ballColour[2] / 255.0f);
     glUniform1i(objectTypeLoc, 0);
@@ -298,7 +475,6 @@ void SceneView::draw_oval_to_screen()
 {
     glm::mat4 view = glm::mat4(1.0f);
     view = glm::translate(view, glm::vec3(blueCircleX, blueCircleY, -3.0f));
-    viewLoc = glGetUniformLocation(shaderProgram, "view");
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
     glUniform3f(colorLocForCircle, ballColour[0] / 255.0f, ballColour[1] / 255.0f, ballColour[2] / 255.0f);
     glUniform1i(objectTypeLoc, 0);
@@ -312,33 +488,16 @@ float SceneView::c_x(float x)
     return x * cScale;
 }
 
-std::vector<double> SceneView::get_sci_color(double val, double minVal, double maxVal)
-{
-    val = std::min(std::max(val, minVal), maxVal - 0.0001);
-    double d{maxVal - minVal};
-    val = (d == 0.0) ? 0.5 : (val - minVal) / d;
-    double m{0.25};
-    int num{static_cast<int>(val / m)};
-    double s{(val - num * m) / m};
-    double r, g, b;
-
-    switch (num) {
-        case 0: r = 0.0; g = s; b = 1.0; break;
-        case 1: r = 0.0; g = 1.0; b = 1.0 - s; break;
-        case 2: r = s; g = 1.0; b = 0.0; break;
-        case 3: r = 1.0; g = 1.0 - s; b = 0.0; break;
-    }
-    return {static_cast<double>(255 * r), static_cast<double>(255 * g), static_cast<double>(255 * b), 255};
-}
-
 void SceneView::render_squares()
 {
+    // Unit quad; paint_squares scales it to the grid. The grid texture is
+    // stored column by column, so s runs along y and t along x.
     float squareVertices[]
     {
-        -0.01f, -0.01f, 0.0f,
-        0.01f, -0.01f, 0.0f,
-        0.01f,  0.01f, 0.0f,
-        -0.01f,  0.01f, 0.0f
+        -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
+        0.5f, -0.5f, 0.0f, 0.0f, 1.0f,
+        0.5f,  0.5f, 0.0f, 1.0f, 1.0f,
+        -0.5f,  0.5f, 0.0f, 1.0f, 0.0f
     };
 
     unsigned int squareIndices[]
@@ -353,10 +512,8 @@ void SceneView::render_squares()
     glBindVertexArray(squareVAO);
     glBindBuffer(GL_ARRAY_BUFFER, squareVBO);
 
-    float scaler{1.22};
     if (params.sceneNr == 0)
     {
-        scaler *= 2;
         squareSize = 0.0240 * 2;
     }
     else if (params.sceneNr == 2 || params.sceneNr == 1){
@@ -364,20 +521,16 @@ void SceneView::render_squares()
     }
     else
     {
-        scaler /= 2;
         squareSize = 0.0243 / 2;
     }
 
-    for (int i{0}; i < 12; ++i)
-    {
-        squareVertices[i] *= scaler;
-    }
-
     glBufferData(GL_ARRAY_BUFFER, sizeof(squareVertices), squareVertices, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, squareEBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(squareIndices), squareIndices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
@@ -516,43 +669,9 @@ void SceneView::render_oval_object()
     glEnableVertexAttribArray(1);
 }
 
-void SceneView::paint_show_pressure(Fluid* f, int i, int j, size_t n, float minP, float maxP)
-{
-    float p = f->p[i*n + j];
-    float s = f->m[i*n + j];
-    std::vector<double> sciColor = get_sci_color(p, minP, maxP);
-    for (int k{0}; k < 4; ++k)
-    {
-        colour[k] = static_cast<double>(sciColor[k]);
-    }
-    if (params.showSmoke)
-    {
-        colour[0] = std::max(0.0, colour[0] - 255*s);
-        colour[1] = std::max(0.0, colour[1] - 255*s);
-        colour[2] = std::max(0.0, colour[2] - 255*s);
-    }
-    colourValues[i][j] = colour;
-}
-
-void SceneView::paint_show_smoke(Fluid *f, int i, int j, size_t n, float minP, float maxP)
-{
-    float s = f->m[i*n + j];
-    colour[0] = 255*s;
-    colour[1] = 255*s;
-    colour[2] = 255*s;
-    if (params.sceneNr == 2)
-    {
-        std::vector<double> sciColor = get_sci_color(s, 0.0, 1.0);
-        for (int i = 0; i < 4; ++i)
-        {
-            colour[i] = static_cast<double>(sciColor[i]) * 255;
-        }
-    }
-    colourValues[i][j] = colour;
-}
-
 void SceneView::update_scene()
 {
+    colour_frame();
     update();
 }
 
@@ -569,7 +688,7 @@ void SceneView::mouseMoveEvent(QMouseEvent *event)
         zeroX = (mouseX / screenWidth) * 2;
         zeroY = (mouseY / screenHeight);
 
-        mainW->set_obstacle(zeroX + params.offsetForObstacle[params.shape][0],zeroY + params.offsetForObstacle[params.shape][1],false);
+        mainW->set_obstacle(zeroX + params.offsetForObstacle[std::min(params.shape, 4)][0],zeroY + params.offsetForObstacle[std::min(params.shape, 4)][1],false);
 
 
         blueCircleX = (((mouseX - 40) / 1120) * 4.34 - 2.17);
@@ -10,6 +10,8 @@
 #include <QMouseEvent>
 #include "mainwindow.hpp"
 #include "fluid.h"
+#include "colour_map.h"
+#include "flow_lines.h"
 
 
 class SceneView : public QOpenGLWidget, protected QOpenGLExtraFunctions
@@ -26,8 +28,11 @@ public:
   float zeroX;
   float zeroY;
   bool activated_by_moving_mouse {false};
+  bool showTimings{false};
 
   void render_squares();
+  // Colours the current fluid into the next buffer of the ring, then
+  // schedules a repaint that only uploads and draws it.
   void update_scene();
 
 protected:
@@ -47,11 +52,15 @@ private:
   unsigned int SquareObjectVBO, SquareObjectVAO, SquareObjectEBO;
   unsigned int TriangleObjectVBO, TriangleObjectVAO, TriangleObjectEBO;
   unsigned int OvalObjectVBO{0}, OvalObjectVAO{0}, OvalObjectEBO{0};
-  unsigned int objectTypeLoc;
-  unsigned int viewLoc;
-  unsigned int colorLocForCircle;
-  unsigned int colorLocForSquares;
-  unsigned int texture;
+  int projectionLoc{-1};
+  int objectTypeLoc{-1};
+  int viewLoc{-1};
+  int viewSquareLoc{-1};
+  int colorLocForCircle{-1};
+  int gridTextureLoc{-1};
+  unsigned int gridTexture{0};
+  int gridTextureX{0};
+  int gridTextureY{0};
 
   const int numSegments{100};
   int ballColour[3];
@@ -62,8 +71,22 @@ private:
   float r, g, b;
   float x,y;
 
-  std::vector<double> colour{255, 255, 255, 255};
-  std::vector<std::vector<std::vector<double>>> colourValues;
+  std::vector<Rgba8> gridPixels; // upload source when buffers cannot be mapped
+
+  // Ring of pixel unpack buffers the grid colours stream through.
+  static constexpr int pixelBufferCount{3};
+  unsigned int pixelBuffers[pixelBufferCount]{};
+  size_t pixelBufferBytes[pixelBufferCount]{};
+  GLsync pixelFences[pixelBufferCount]{};
+  int pixelFrame{0};
+  int readySlot{-1}; // coloured ring buffer the next paint uploads, -1 if none
+  bool pixelsReady{false}; // gridPixels holds a frame to upload instead
+  int readyNumX{0};
+  int readyNumY{0};
+  // Velocity overlay; the vertex buffer is kept and only grows.
+  FlowLines flowLines;
+  unsigned int flowVAO{0}, flowVBO{0};
+  size_t flowVBOBytes{0};
   std::vector<glm::vec3> cellColors;
   std::string vertexShaderCode;
   std::string fragmentShaderCode;
@@ -73,6 +96,10 @@ private:
   void print_context_information();
   void draw();
   void paint_squares();
+  void colour_frame();
+  void upload_grid();
+  void draw_flow_lines();
+  void paint_timings();
   void draw_circle_to_screen();
   void draw_square_to_screen();
   void draw_triangle_to_screen();
@@ -81,11 +108,8 @@ private:
   void render_square_object();
   void render_triangle_object();
   void render_oval_object();
-  void paint_show_pressure(Fluid* f, int i, int j, size_t n, float minP, float maxP);
-  void paint_show_smoke(Fluid* f, int i, int j, size_t n, float minP, float maxP);
   float c_x(float);
 
-  static std::vector<double> get_sci_color(double val, double minVal, double maxVal);
   std::string read_shader_code_from_resource_file(QString filepath);
   QImage read_texture_from_resource_file(QString filepath);
 };
@@ -3,7 +3,7 @@ out vec4 finalColor;
 in vec2 TexCoord;
 
 uniform int objectType; // Add this line to get the objectType uniform
-uniform vec3 currentColorForSquares;
+uniform sampler2D gridTexture;
 uniform vec3 currentColorForCircle;
 
 void main() {
@@ -17,6 +17,7 @@ void main() {
     }
     else if (objectType == 2)
     {
-        finalColor = vec4(currentColorForSquares, 1.0);
+        // The whole grid, one texel per cell
+        finalColor = texture(gridTexture, TexCoord);
     }
 }
@@ -0,0 +1,253 @@
+#include "shm_frame_ring.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr size_t pageBytes{4096};
+
+size_t align_up(size_t value)
+{
+    return (value + pageBytes - 1) / pageBytes * pageBytes;
+}
+
+size_t slot_data_offset()
+{
+    return sizeof(ShmSlotHeader);
+}
+
+}
+
+int64_t monotonic_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+ShmFramePublisher::~ShmFramePublisher()
+{
+    close();
+}
+
+bool ShmFramePublisher::open(const std::string& name, size_t capacityCells, int numSlots, std::string& error)
+{
+    close();
+    if (numSlots < 2 || capacityCells == 0)
+    {
+        error = "a frame ring needs at least two slots and a non-empty grid";
+        return false;
+    }
+
+    size_t slotBytes = align_up(slot_data_offset() + shmRingNumFields * capacityCells * sizeof(float));
+    size_t totalBytes = pageBytes + numSlots * slotBytes;
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        error = "cannot create shared memory " + name + ": " + std::strerror(errno);
+        return false;
+    }
+    if (ftruncate(fd, totalBytes) != 0)
+    {
+        error = "cannot size shared memory " + name + ": " + std::strerror(errno);
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    void* memory = mmap(nullptr, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+        error = "cannot map shared memory " + name + ": " + std::strerror(errno);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // A fresh object is zero filled, so every slot starts at sequence 0 (never
+    // written). The magic goes in last so readers never see a partial header.
+    header = new (memory) ShmRingHeader{};
+    header->version = shmRingVersion;
+    header->numSlots = numSlots;
+    header->slotBytes = slotBytes;
+    header->capacityCells = capacityCells;
+    for (int k{0}; k < numSlots; ++k)
+    {
+        new (static_cast<char*>(memory) + pageBytes + k * slotBytes) ShmSlotHeader{};
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, shmRingMagic, sizeof(header->magic));
+
+    this->name = name;
+    mappedBytes = totalBytes;
+    nextFrame = 0;
+    return true;
+}
+
+void ShmFramePublisher::close()
+{
+    if (header == nullptr)
+    {
+        return;
+    }
+    header->closed.store(1, std::memory_order_release);
+    munmap(header, mappedBytes);
+    shm_unlink(name.c_str());
+    header = nullptr;
+    mappedBytes = 0;
+}
+
+bool ShmFramePublisher::publish(const Fluid& f, int frameNr)
+{
+    const float* fields[shmRingNumFields]{f.u.data(), f.v.data(), f.p.data(), f.m.data()};
+    return publish(fields, f.numX, f.numY, frameNr);
+}
+
+bool ShmFramePublisher::publish(const float* const fields[shmRingNumFields], int numX, int numY, int frameNr)
+{
+    size_t numCells = static_cast<size_t>(numX) * numY;
+    if (header == nullptr || numCells > header->capacityCells)
+    {
+        return false;
+    }
+
+    uint64_t frame = nextFrame++;
+    char* base = reinterpret_cast<char*>(header) + pageBytes + (frame % header->numSlots) * header->slotBytes;
+    ShmSlotHeader* slot = reinterpret_cast<ShmSlotHeader*>(base);
+    float* data = reinterpret_cast<float*>(base + slot_data_offset());
+
+    slot->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frameNr = frameNr;
+    slot->numX = numX;
+    slot->numY = numY;
+    for (int k{0}; k < shmRingNumFields; ++k)
+    {
+        std::memcpy(data + k * numCells, fields[k], numCells * sizeof(float));
+    }
+    slot->publishNs = monotonic_ns();
+
+    slot->sequence.store(2 * frame + 2, std::memory_order_release);
+    header->published.store(frame + 1, std::memory_order_release);
+    return true;
+}
+
+ShmFrameReader::~ShmFrameReader()
+{
+    close();
+}
+
+bool ShmFrameReader::open(const std::string& name, std::string& error)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        error = "cannot open shared memory " + name + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < pageBytes)
+    {
+        ::close(fd);
+        error = name + " is not a frame ring";
+        return false;
+    }
+
+    void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+        error = "cannot map shared memory " + name + ": " + std::strerror(errno);
+        return false;
+    }
+
+    header = static_cast<const ShmRingHeader*>(memory);
+    mappedBytes = info.st_size;
+    if (std::memcmp(header->magic, shmRingMagic, sizeof(header->magic)) != 0 || header->version != shmRingVersion
+        || pageBytes + header->numSlots * header->slotBytes > mappedBytes)
+    {
+        close();
+        error = name + " is not a frame ring or is still being created";
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+void ShmFrameReader::close()
+{
+    if (header != nullptr)
+    {
+        munmap(const_cast<ShmRingHeader*>(header), mappedBytes);
+        header = nullptr;
+        mappedBytes = 0;
+    }
+}
+
+uint64_t ShmFrameReader::published() const
+{
+    return header != nullptr ? header->published.load(std::memory_order_acquire) : 0;
+}
+
+bool ShmFrameReader::publisher_closed() const
+{
+    return header == nullptr || header->closed.load(std::memory_order_acquire) != 0;
+}
+
+const ShmSlotHeader* ShmFrameReader::slot(uint64_t frame) const
+{
+    const char* base = reinterpret_cast<const char*>(header) + pageBytes + (frame % header->numSlots) * header->slotBytes;
+    return reinterpret_cast<const ShmSlotHeader*>(base);
+}
+
+bool ShmFrameReader::acquire_latest(ShmFrameView& view) const
+{
+    uint64_t count = published();
+    if (count == 0)
+    {
+        return false;
+    }
+
+    uint64_t frame = count - 1;
+    const ShmSlotHeader* latest = slot(frame);
+    uint64_t sequence = latest->sequence.load(std::memory_order_acquire);
+    if (sequence != 2 * frame + 2)
+    {
+        // Already being overwritten by a newer frame; the caller polls again.
+        return false;
+    }
+
+    view.sequence = sequence;
+    view.frameNr = latest->frameNr;
+    view.numX = latest->numX;
+    view.numY = latest->numY;
+    view.publishNs = latest->publishNs;
+
+    size_t numCells = static_cast<size_t>(view.numX) * view.numY;
+    const float* data = reinterpret_cast<const float*>(reinterpret_cast<const char*>(latest) + slot_data_offset());
+    for (int k{0}; k < shmRingNumFields; ++k)
+    {
+        view.fields[k] = data + k * numCells;
+    }
+    return still_valid(view) && numCells <= header->capacityCells;
+}
+
+bool ShmFrameReader::still_valid(const ShmFrameView& view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t frame = view.sequence / 2 - 1;
+    return slot(frame)->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
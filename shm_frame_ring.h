@@ -0,0 +1,111 @@
+#ifndef SHM_FRAME_RING_H
+#define SHM_FRAME_RING_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "fluid.h"
+
+// POSIX shared-memory ring of u, v, p and m frames. The object starts with a
+// ShmRingHeader page followed by numSlots page-aligned slots, each a
+// ShmSlotHeader and then the four fields back to back. Frame k goes to slot
+// k % numSlots and is guarded by a sequence lock: the slot's sequence is
+// 2k + 1 while it is written and 2k + 2 once it is complete. The publisher
+// never waits for readers; a reader that is overtaken sees the sequence
+// change and retries.
+constexpr char shmRingMagic[8]{'E', 'F', 'S', 'R', 'I', 'N', 'G', '\0'};
+constexpr uint32_t shmRingVersion{1};
+constexpr int shmRingNumFields{4};
+
+enum ShmField { SHM_U, SHM_V, SHM_P, SHM_M };
+
+struct ShmRingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numSlots;
+    uint64_t slotBytes;
+    uint64_t capacityCells;
+    std::atomic<uint64_t> published;
+    std::atomic<uint32_t> closed;
+};
+
+struct alignas(64) ShmSlotHeader {
+    std::atomic<uint64_t> sequence;
+    int32_t frameNr;
+    int32_t numX;
+    int32_t numY;
+    int64_t publishNs;
+};
+
+// CLOCK_MONOTONIC in nanoseconds; comparable across processes on one host.
+int64_t monotonic_ns();
+
+class ShmFramePublisher
+{
+public:
+    ShmFramePublisher() = default;
+    ~ShmFramePublisher();
+
+    ShmFramePublisher(const ShmFramePublisher&) = delete;
+    ShmFramePublisher& operator=(const ShmFramePublisher&) = delete;
+
+    // name is a POSIX shm name such as "/fluid_frames". An existing object
+    // of that name is replaced.
+    bool open(const std::string& name, size_t capacityCells, int numSlots, std::string& error);
+    // Marks the ring closed so attached readers re-open, then unlinks it.
+    void close();
+
+    // Returns false if the ring is not open or the grid exceeds its capacity.
+    bool publish(const Fluid& f, int frameNr);
+    bool publish(const float* const fields[shmRingNumFields], int numX, int numY, int frameNr);
+
+    bool is_open() const { return header != nullptr; }
+    size_t capacity_cells() const { return header != nullptr ? header->capacityCells : 0; }
+
+private:
+    std::string name;
+    ShmRingHeader* header{nullptr};
+    size_t mappedBytes{0};
+    uint64_t nextFrame{0};
+};
+
+// Pointers into a published slot. They stay readable until the ring wraps
+// back to the slot, so consumers check still_valid() after using them.
+struct ShmFrameView {
+    uint64_t sequence{0};
+    int frameNr{0};
+    int numX{0};
+    int numY{0};
+    int64_t publishNs{0};
+    const float* fields[shmRingNumFields]{};
+};
+
+class ShmFrameReader
+{
+public:
+    ShmFrameReader() = default;
+    ~ShmFrameReader();
+
+    ShmFrameReader(const ShmFrameReader&) = delete;
+    ShmFrameReader& operator=(const ShmFrameReader&) = delete;
+
+    bool open(const std::string& name, std::string& error);
+    void close();
+
+    // Number of frames published so far; a cheap change check for polling.
+    uint64_t published() const;
+    // True once the publisher has closed or replaced the ring.
+    bool publisher_closed() const;
+
+    // Fills view with the newest complete frame without copying it.
+    bool acquire_latest(ShmFrameView& view) const;
+    // True if the slot behind view has not been overwritten since acquire.
+    bool still_valid(const ShmFrameView& view) const;
+
+private:
+    const ShmSlotHeader* slot(uint64_t frame) const;
+
+    const ShmRingHeader* header{nullptr};
+    size_t mappedBytes{0};
+};
+#endif // SHM_FRAME_RING_H
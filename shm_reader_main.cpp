@@ -0,0 +1,219 @@
+#include "shm_frame_ring.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+struct Options {
+    std::string name{"/fluid_frames"};
+    int frames{0}; // 0 reads until the publisher goes away
+    bool bench{false};
+    int resolution{100};
+    int slots{4};
+    int periodUs{2000};
+};
+
+void print_usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [NAME] [--frames N]\n"
+              << "       " << program << " --bench [--res N] [--frames N] [--slots N] [--period-us N]\n";
+}
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int k{1}; k < argc; ++k)
+    {
+        bool hasValue = k + 1 < argc;
+        if (std::strcmp(argv[k], "--frames") == 0 && hasValue) { options.frames = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--bench") == 0) { options.bench = true; }
+        else if (std::strcmp(argv[k], "--res") == 0 && hasValue) { options.resolution = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--slots") == 0 && hasValue) { options.slots = std::atoi(argv[++k]); }
+        else if (std::strcmp(argv[k], "--period-us") == 0 && hasValue) { options.periodUs = std::atoi(argv[++k]); }
+        else if (argv[k][0] == '/') { options.name = argv[k]; }
+        else
+        {
+            return false;
+        }
+    }
+    return options.frames >= 0 && options.resolution > 0 && options.slots >= 2;
+}
+
+// Reduces a frame in place, which is all a dashboard needs from it.
+void summarise(const ShmFrameView& view, float& maxSpeed, float& smokeMass)
+{
+    size_t numCells = static_cast<size_t>(view.numX) * view.numY;
+    maxSpeed = 0.0f;
+    smokeMass = 0.0f;
+    for (size_t c{0}; c < numCells; ++c)
+    {
+        float u = view.fields[SHM_U][c];
+        float v = view.fields[SHM_V][c];
+        maxSpeed = std::max(maxSpeed, std::sqrt(u * u + v * v));
+        smokeMass += view.fields[SHM_M][c];
+    }
+}
+
+bool wait_for_ring(ShmFrameReader& reader, const std::string& name)
+{
+    std::string error;
+    for (int attempt{0}; attempt < 500; ++attempt)
+    {
+        if (reader.open(name, error))
+        {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::cerr << error << "\n";
+    return false;
+}
+
+int read_frames(const Options& options)
+{
+    ShmFrameReader reader;
+    if (!wait_for_ring(reader, options.name))
+    {
+        return 1;
+    }
+
+    uint64_t seen{0};
+    int frames{0};
+    while (options.frames == 0 || frames < options.frames)
+    {
+        if (reader.publisher_closed())
+        {
+            // The publisher replaced the ring (for a larger grid) or exited.
+            if (!wait_for_ring(reader, options.name))
+            {
+                return 0;
+            }
+            seen = 0;
+        }
+
+        ShmFrameView view;
+        if (reader.published() == seen || !reader.acquire_latest(view))
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+
+        float maxSpeed{0.0f};
+        float smokeMass{0.0f};
+        summarise(view, maxSpeed, smokeMass);
+        if (!reader.still_valid(view))
+        {
+            continue;
+        }
+
+        seen = view.sequence / 2;
+        frames++;
+        std::cout << "frame=" << view.frameNr << " grid=" << view.numX << "x" << view.numY
+                  << " maxSpeed=" << maxSpeed << " smokeMass=" << smokeMass
+                  << " latencyUs=" << (monotonic_ns() - view.publishNs) / 1000.0 << std::endl;
+    }
+    return 0;
+}
+
+// Forks a publisher of synthetic frames and measures, in the parent, the time
+// from a frame being published to a polling reader seeing it.
+int run_bench(Options options)
+{
+    options.name = "/fluid_frames_bench_" + std::to_string(getpid());
+    int frames = options.frames > 0 ? options.frames : 2000;
+    int numX = 2 * options.resolution + 2;
+    int numY = options.resolution + 2;
+    size_t numCells = static_cast<size_t>(numX) * numY;
+
+    std::string error;
+    ShmFramePublisher publisher;
+    if (!publisher.open(options.name, numCells, options.slots, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        std::vector<float> field(numCells, 0.5f);
+        const float* fields[shmRingNumFields]{field.data(), field.data(), field.data(), field.data()};
+        double publishUs{0.0};
+        for (int frame{0}; frame < frames; ++frame)
+        {
+            int64_t start = monotonic_ns();
+            publisher.publish(fields, numX, numY, frame);
+            publishUs += (monotonic_ns() - start) / 1000.0;
+            std::this_thread::sleep_for(std::chrono::microseconds(options.periodUs));
+        }
+        std::cout << "publishUs=" << publishUs / frames << std::endl;
+        _exit(0);
+    }
+
+    ShmFrameReader reader;
+    if (!reader.open(options.name, error))
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(frames);
+    uint64_t seen{0};
+    int status{0};
+    while (latencies.size() < static_cast<size_t>(frames) && waitpid(child, &status, WNOHANG) == 0)
+    {
+        uint64_t count = reader.published();
+        ShmFrameView view;
+        if (count == seen || !reader.acquire_latest(view))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        int64_t observed = monotonic_ns();
+        float maxSpeed{0.0f};
+        float smokeMass{0.0f};
+        summarise(view, maxSpeed, smokeMass);
+        if (reader.still_valid(view))
+        {
+            latencies.push_back((observed - view.publishNs) / 1000.0);
+        }
+        seen = view.sequence / 2;
+    }
+    waitpid(child, &status, 0);
+    publisher.close();
+
+    if (latencies.empty())
+    {
+        std::cerr << "no frames observed\n";
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "grid=" << numX << "x" << numY << " frames=" << latencies.size()
+              << " latencyUs p50=" << latencies[latencies.size() / 2]
+              << " p99=" << latencies[latencies.size() * 99 / 100]
+              << " max=" << latencies.back() << "\n";
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    return options.bench ? run_bench(options) : read_frames(options);
+}
@@ -0,0 +1,224 @@
+#include "stage_timers.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+const char* stageNames[STAGE_COUNT]{
+    "integrate", "solve", "extrapolate", "advect_vel", "outputs", "step", "set_obstacle", "colour", "paint"};
+
+// Four buckets per power of two: the exponent, then the two bits below the
+// leading one.
+int bucket_of(uint64_t ns)
+{
+    if (ns < 4)
+    {
+        return static_cast<int>(ns);
+    }
+    int exponent{0};
+    while ((ns >> (exponent + 1)) != 0)
+    {
+        exponent++;
+    }
+    int bucket = 4 * (exponent - 1) + static_cast<int>((ns >> (exponent - 2)) & 3);
+    return std::min(bucket, StageHistogram::numBuckets - 1);
+}
+
+// Assumed for the bandwidth estimate; true of current x86 and most ARM cores.
+constexpr double cacheLineBytes{64.0};
+
+double bucket_top_ns(int bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket + 1;
+    }
+    int exponent = bucket / 4 + 1;
+    int fraction = bucket % 4;
+    return std::ldexp(1.0 + (fraction + 1) / 4.0, exponent);
+}
+
+}
+
+const char* stage_name(TimedStage stage)
+{
+    return stage < STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+void StageHistogram::add(uint64_t ns)
+{
+    if (numSamples == windowSize)
+    {
+        uint64_t oldest = samples[next];
+        buckets[bucket_of(oldest)]--;
+        windowNs -= oldest;
+    }
+    else
+    {
+        numSamples++;
+    }
+    samples[next] = ns;
+    buckets[bucket_of(ns)]++;
+    windowNs += ns;
+    next = (next + 1) % windowSize;
+}
+
+double StageHistogram::mean_us() const
+{
+    return numSamples > 0 ? windowNs / 1000.0 / numSamples : 0.0;
+}
+
+double StageHistogram::percentile_us(double q) const
+{
+    if (numSamples == 0)
+    {
+        return 0.0;
+    }
+    int rank = std::max(1, static_cast<int>(std::ceil(q * numSamples)));
+    int seen{0};
+    for (int bucket{0}; bucket < numBuckets; ++bucket)
+    {
+        seen += buckets[bucket];
+        if (seen >= rank)
+        {
+            return std::min(bucket_top_ns(bucket) / 1000.0, max_us());
+        }
+    }
+    return max_us();
+}
+
+double StageHistogram::max_us() const
+{
+    uint64_t longest{0};
+    for (int k{0}; k < numSamples; ++k)
+    {
+        longest = std::max(longest, samples[k]);
+    }
+    return longest / 1000.0;
+}
+
+double StageCounts::ipc() const
+{
+    return values[PERF_CYCLES] > 0.0 ? values[PERF_INSTRUCTIONS] / values[PERF_CYCLES] : 0.0;
+}
+
+double StageCounts::branch_miss_rate() const
+{
+    return values[PERF_BRANCHES] > 0.0 ? values[PERF_BRANCH_MISSES] / values[PERF_BRANCHES] : 0.0;
+}
+
+double StageCounts::cache_miss_rate() const
+{
+    return values[PERF_CACHE_REFERENCES] > 0.0 ? values[PERF_CACHE_MISSES] / values[PERF_CACHE_REFERENCES] : 0.0;
+}
+
+double StageCounts::gb_per_s() const
+{
+    return ns > 0 ? values[PERF_CACHE_MISSES] * cacheLineBytes / ns : 0.0;
+}
+
+void StageTimers::record(TimedStage stage, uint64_t ns)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    histograms[stage].add(ns);
+}
+
+StageHistogram StageTimers::histogram(TimedStage stage) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return histograms[stage];
+}
+
+void StageTimers::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (StageHistogram& histogram : histograms)
+    {
+        histogram = StageHistogram{};
+    }
+    for (StageCounts& counts : stageCounts)
+    {
+        counts = StageCounts{};
+    }
+}
+
+void StageTimers::write_csv(std::ostream& out) const
+{
+    out << "stage,samples,mean_us,p50_us,p90_us,p99_us,max_us\n";
+    for (int k{0}; k < STAGE_COUNT; ++k)
+    {
+        StageHistogram h = histogram(static_cast<TimedStage>(k));
+        if (h.count() == 0)
+        {
+            continue;
+        }
+        out << stageNames[k] << "," << h.count() << "," << h.mean_us() << "," << h.percentile_us(0.5) << ","
+            << h.percentile_us(0.9) << "," << h.percentile_us(0.99) << "," << h.max_us() << "\n";
+    }
+}
+
+void StageTimers::add_counts(TimedStage stage, uint64_t ns, const PerfSample& begin, const PerfSample& end)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    StageCounts& counts = stageCounts[stage];
+    counts.ns += ns;
+    for (int k{0}; k < PERF_COUNTER_COUNT; ++k)
+    {
+        counts.values[k] += std::max(0.0, end.values[k] - begin.values[k]);
+    }
+}
+
+StageCounts StageTimers::counts(TimedStage stage) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stageCounts[stage];
+}
+
+void StageTimers::write_counters_csv(std::ostream& out) const
+{
+    const PerfCounters& perf = perf_counters();
+    out << "stage,ms";
+    for (int k{0}; k < PERF_COUNTER_COUNT; ++k)
+    {
+        out << "," << perf_counter_name(static_cast<PerfCounter>(k));
+    }
+    out << ",ipc,branch_miss_pct,cache_miss_pct,gb_per_s\n";
+
+    for (int stage{0}; stage < STAGE_COUNT; ++stage)
+    {
+        StageCounts c = counts(static_cast<TimedStage>(stage));
+        if (c.ns == 0)
+        {
+            continue;
+        }
+        out << stageNames[stage] << "," << c.ns / 1e6;
+        for (int k{0}; k < PERF_COUNTER_COUNT; ++k)
+        {
+            out << ",";
+            if (perf.available(static_cast<PerfCounter>(k)))
+            {
+                out << static_cast<uint64_t>(c.values[k]);
+            }
+        }
+        // A ratio is only written when the counters it needs are there.
+        auto derived = [&](bool known, double value) {
+            out << ",";
+            if (known)
+            {
+                out << value;
+            }
+        };
+        derived(perf.available(PERF_INSTRUCTIONS), c.ipc());
+        derived(perf.available(PERF_BRANCHES) && perf.available(PERF_BRANCH_MISSES), 100.0 * c.branch_miss_rate());
+        derived(perf.available(PERF_CACHE_REFERENCES) && perf.available(PERF_CACHE_MISSES), 100.0 * c.cache_miss_rate());
+        derived(perf.available(PERF_CACHE_MISSES), c.gb_per_s());
+        out << "\n";
+    }
+}
+
+StageTimers& stage_timers()
+{
+    static StageTimers timers;
+    return timers;
+}
@@ -0,0 +1,158 @@
+#ifndef STAGE_TIMERS_H
+#define STAGE_TIMERS_H
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include "perf_counters.h"
+#include "trace_events.h"
+
+#ifdef FLUID_ENABLE_TIMERS
+constexpr bool stageTimersEnabled{true};
+#else
+constexpr bool stageTimersEnabled{false};
+#endif
+
+// The timed parts of a frame. With the task scheduler a split stage's time
+// is the sum over its blocks, i.e. CPU time rather than wall time.
+enum TimedStage {
+    STAGE_INTEGRATE,
+    STAGE_SOLVE,
+    STAGE_EXTRAPOLATE,
+    STAGE_ADVECT_VEL,
+    STAGE_OUTPUTS,      // smoke advection, vorticity and statistics
+    STAGE_STEP,         // all of simulate_step
+    STAGE_SET_OBSTACLE,
+    STAGE_COLOUR,
+    STAGE_PAINT,        // SceneView::paintGL
+    STAGE_COUNT
+};
+
+const char* stage_name(TimedStage stage);
+
+// Durations of the last windowSize samples, bucketed four buckets per octave
+// so that percentiles cost a walk over the buckets, not a sort.
+class StageHistogram
+{
+public:
+    static constexpr int windowSize{512};
+    static constexpr int numBuckets{4 * 42};
+
+    void add(uint64_t ns);
+    int count() const { return numSamples; }
+    double mean_us() const;
+    // Upper edge of the bucket holding quantile q, in microseconds, capped at
+    // the largest sample.
+    double percentile_us(double q) const;
+    double max_us() const;
+
+private:
+    uint64_t samples[windowSize]{};
+    int next{0};
+    int numSamples{0};
+    uint64_t windowNs{0};
+    int buckets[numBuckets]{};
+};
+
+// Hardware counter deltas of one stage, summed over its scopes and, with the
+// task scheduler, over its blocks on every worker.
+struct StageCounts {
+    uint64_t ns{0};
+    double values[PERF_COUNTER_COUNT]{};
+
+    double ipc() const;
+    double branch_miss_rate() const;
+    double cache_miss_rate() const;
+    // Last-level misses times the line size over the stage's time: roughly the
+    // DRAM traffic of one busy thread, as ns is summed over threads.
+    double gb_per_s() const;
+};
+
+// Process-wide histograms, one per stage, safe to feed from any thread.
+class StageTimers
+{
+public:
+    void record(TimedStage stage, uint64_t ns);
+    StageHistogram histogram(TimedStage stage) const;
+    void clear();
+    // stage,samples,mean_us,p50_us,p90_us,p99_us,max_us for every stage sampled.
+    void write_csv(std::ostream& out) const;
+
+    void add_counts(TimedStage stage, uint64_t ns, const PerfSample& begin, const PerfSample& end);
+    StageCounts counts(TimedStage stage) const;
+    // stage,ms, one column per counter, then ipc,branch_miss_pct,cache_miss_pct,
+    // gb_per_s; counters the CPU does not expose are left empty.
+    void write_counters_csv(std::ostream& out) const;
+
+private:
+    mutable std::mutex mutex;
+    StageHistogram histograms[STAGE_COUNT];
+    StageCounts stageCounts[STAGE_COUNT];
+};
+
+StageTimers& stage_timers();
+
+// Times its scope with steady_clock, then records the duration as one sample
+// or adds it to a per-block slot that is recorded later. While a trace is
+// running the scope also goes on the timeline, and with perf_counters()
+// enabled its counter deltas go to the stage's totals. Without
+// FLUID_ENABLE_TIMERS it compiles to nothing.
+class ScopedStageTimer
+{
+public:
+    explicit ScopedStageTimer(TimedStage stage) : stage(stage)
+    {
+        begin();
+    }
+
+    ScopedStageTimer(TimedStage stage, uint64_t& slot) : stage(stage), slot(&slot)
+    {
+        begin();
+    }
+
+    ~ScopedStageTimer()
+    {
+        if constexpr (stageTimersEnabled)
+        {
+            auto end = std::chrono::steady_clock::now();
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            if (trace_recorder().active())
+            {
+                trace_recorder().complete(stage_name(stage), start, end);
+            }
+            PerfSample endCounts;
+            if (counting && perf_counters().sample(endCounts))
+            {
+                stage_timers().add_counts(stage, ns, startCounts, endCounts);
+            }
+            if (slot != nullptr)
+            {
+                *slot += ns;
+            }
+            else
+            {
+                stage_timers().record(stage, ns);
+            }
+        }
+    }
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    void begin()
+    {
+        if constexpr (stageTimersEnabled)
+        {
+            counting = perf_counters().enabled() && perf_counters().sample(startCounts);
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    TimedStage stage{STAGE_COUNT};
+    uint64_t* slot{nullptr};
+    std::chrono::steady_clock::time_point start;
+    bool counting{false};
+    PerfSample startCounts;
+};
+#endif // STAGE_TIMERS_H
@@ -0,0 +1,214 @@
+#include "task_scheduler.h"
+#include "numa_placement.h"
+#include "trace_events.h"
+#include <algorithm>
+#include <string>
+
+TaskGraph::TaskId TaskGraph::add_task(std::function<void()> work, int preferredWorker)
+{
+    Task task;
+    task.work = std::move(work);
+    task.preferredWorker = preferredWorker;
+    this->tasks.push_back(std::move(task));
+    return this->tasks.size() - 1;
+}
+
+void TaskGraph::add_dependency(TaskId before, TaskId after)
+{
+    this->tasks[before].successors.push_back(after);
+    this->tasks[after].numDependencies++;
+}
+
+void TaskGraph::clear()
+{
+    this->tasks.clear();
+}
+
+size_t TaskGraph::size() const
+{
+    return this->tasks.size();
+}
+
+TaskScheduler::TaskScheduler(size_t numThreads)
+{
+    numThreads = std::max<size_t>(numThreads, 1);
+
+    for (size_t i{0}; i < numThreads; ++i)
+    {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i{1}; i < numThreads; ++i)
+    {
+        threads.emplace_back(&TaskScheduler::worker_loop, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+size_t TaskScheduler::num_threads() const
+{
+    return workers.size();
+}
+
+void TaskScheduler::run(TaskGraph& graph)
+{
+    std::lock_guard<std::mutex> runLock(runMutex);
+    size_t numTasks = graph.tasks.size();
+
+    if (numTasks == 0)
+    {
+        return;
+    }
+
+    pending.reset(new std::atomic<int>[numTasks]);
+    for (size_t i{0}; i < numTasks; ++i)
+    {
+        pending[i].store(graph.tasks[i].numDependencies, std::memory_order_relaxed);
+    }
+    current = &graph;
+    remaining.store(numTasks);
+
+    size_t nextWorker{0};
+    for (size_t i{0}; i < numTasks; ++i)
+    {
+        if (graph.tasks[i].numDependencies == 0)
+        {
+            push(i, worker_for(i, nextWorker));
+            nextWorker = (nextWorker + 1) % workers.size();
+        }
+    }
+
+    while (remaining.load() > 0)
+    {
+        TaskGraph::TaskId id;
+        if (try_pop(0, id))
+        {
+            execute(id, 0);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return remaining.load() == 0 || queuedCount.load() > 0; });
+    }
+
+    current = nullptr;
+}
+
+bool TaskScheduler::pin_threads()
+{
+    std::vector<int> cpus = allowed_cpus();
+
+    if (cpus.empty())
+    {
+        return false;
+    }
+
+    bool ok = pin_thread_to_cpu(pthread_self(), cpus[0]);
+    for (size_t k{0}; k < threads.size(); ++k)
+    {
+        ok = pin_thread_to_cpu(threads[k].native_handle(), cpus[(k + 1) % cpus.size()]) && ok;
+    }
+    return ok;
+}
+
+size_t TaskScheduler::worker_for(TaskGraph::TaskId id, size_t fallback) const
+{
+    int preferred = current->tasks[id].preferredWorker;
+    return preferred >= 0 ? static_cast<size_t>(preferred) % workers.size() : fallback;
+}
+
+void TaskScheduler::worker_loop(size_t self)
+{
+    trace_recorder().set_thread_name("solver worker " + std::to_string(self));
+    while (true)
+    {
+        TaskGraph::TaskId id;
+        if (try_pop(self, id))
+        {
+            execute(id, self);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queuedCount.load() > 0; });
+
+        if (stopping)
+        {
+            return;
+        }
+    }
+}
+
+void TaskScheduler::push(TaskGraph::TaskId id, size_t worker)
+{
+    {
+        std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+        workers[worker]->queue.push_back(id);
+    }
+    queuedCount++;
+
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_one();
+}
+
+bool TaskScheduler::try_pop(size_t self, TaskGraph::TaskId& id)
+{
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.queue.empty())
+        {
+            id = own.queue.back();
+            own.queue.pop_back();
+            queuedCount--;
+            return true;
+        }
+    }
+
+    for (size_t k{1}; k < workers.size(); ++k)
+    {
+        Worker& victim = *workers[(self + k) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.queue.empty())
+        {
+            id = victim.queue.front();
+            victim.queue.pop_front();
+            queuedCount--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::execute(TaskGraph::TaskId id, size_t self)
+{
+    TaskGraph::Task& task = current->tasks[id];
+    task.work();
+
+    for (TaskGraph::TaskId successor : task.successors)
+    {
+        if (pending[successor].fetch_sub(1) == 1)
+        {
+            push(successor, worker_for(successor, self));
+        }
+    }
+
+    if (remaining.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_all();
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small dependency graph of tasks. A task becomes ready once every task it
+// depends on has finished. Graphs are built once and can be run many times.
+class TaskGraph
+{
+public:
+    using TaskId = size_t;
+
+    // preferredWorker queues the task on that worker when it becomes ready so
+    // repeated runs keep touching the same memory from the same thread; it is
+    // a hint, idle workers may still steal it.
+    TaskId add_task(std::function<void()> work, int preferredWorker = -1);
+    void add_dependency(TaskId before, TaskId after);
+    void clear();
+    size_t size() const;
+
+private:
+    friend class TaskScheduler;
+
+    struct Task {
+        std::function<void()> work;
+        std::vector<TaskId> successors;
+        int numDependencies{0};
+        int preferredWorker{-1};
+    };
+
+    std::vector<Task> tasks;
+};
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops its
+// own work at the back and steals from the front of the other deques when it
+// runs dry. The thread calling run() takes part as worker 0, so a scheduler
+// with one thread runs the graph inline. run() must not be called from inside
+// a task.
+class TaskScheduler
+{
+public:
+    explicit TaskScheduler(size_t numThreads = std::thread::hardware_concurrency());
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    size_t num_threads() const;
+    void run(TaskGraph& graph);
+
+    // Pins worker k (the calling thread being worker 0) to the k-th CPU the
+    // process may run on. Returns false if any affinity call failed.
+    bool pin_threads();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<TaskGraph::TaskId> queue;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queuedCount{0};
+    std::atomic<size_t> remaining{0};
+    bool stopping{false};
+
+    std::mutex runMutex;
+    TaskGraph* current{nullptr};
+    std::unique_ptr<std::atomic<int>[]> pending;
+
+    void worker_loop(size_t self);
+    void push(TaskGraph::TaskId id, size_t worker);
+    size_t worker_for(TaskGraph::TaskId id, size_t fallback) const;
+    bool try_pop(size_t self, TaskGraph::TaskId& id);
+    void execute(TaskGraph::TaskId id, size_t self);
+};
+#endif // TASK_SCHEDULER_H
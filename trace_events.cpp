@@ -0,0 +1,179 @@
+#include "trace_events.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+constexpr auto drainInterval = std::chrono::milliseconds(20);
+
+// Ring of the calling thread; buffers live as long as the recorder, so a
+// thread that exits leaves its last events to be drained.
+thread_local void* threadBuffer{nullptr};
+
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    stop();
+}
+
+bool TraceRecorder::start(const std::string& path, std::string& error)
+{
+    stop();
+    out.open(path, std::ios::trunc);
+    if (!out)
+    {
+        error = "cannot create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for (std::unique_ptr<ThreadBuffer>& buffer : buffers)
+        {
+            // Events of an earlier trace are not part of this one.
+            buffer->tail.store(buffer->head.load());
+            buffer->nameWritten = false;
+        }
+    }
+    origin = Clock::now();
+    firstEvent = true;
+    written = 0;
+    stopping = false;
+    running = true;
+    writer = std::thread(&TraceRecorder::writer_loop, this);
+    return true;
+}
+
+void TraceRecorder::stop()
+{
+    if (!writer.joinable())
+    {
+        return;
+    }
+
+    running = false;
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    // Events recorded after the writer's last pass, or before its first.
+    drain();
+
+    out << "\n]}\n";
+    out.close();
+}
+
+void TraceRecorder::complete(const char* name, Clock::time_point begin, Clock::time_point end)
+{
+    if (!active() || begin < origin)
+    {
+        return;
+    }
+
+    ThreadBuffer& buffer = buffer_for_this_thread();
+    if (!buffer.events)
+    {
+        // Allocated on a thread's first event, so naming a thread costs nothing.
+        buffer.events = std::make_unique<Event[]>(ringSize);
+    }
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    if (head - buffer.tail.load(std::memory_order_acquire) == ringSize)
+    {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event& event = buffer.events[head & (ringSize - 1)];
+    event.name = name;
+    event.beginNs = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - origin).count();
+    event.endNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - origin).count();
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void TraceRecorder::set_thread_name(const std::string& name)
+{
+    ThreadBuffer& buffer = buffer_for_this_thread();
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffer.name = name;
+    buffer.nameWritten = false;
+}
+
+size_t TraceRecorder::events_dropped() const
+{
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    size_t dropped{0};
+    for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+    {
+        dropped += buffer->dropped.load();
+    }
+    return dropped;
+}
+
+TraceRecorder::ThreadBuffer& TraceRecorder::buffer_for_this_thread()
+{
+    if (threadBuffer == nullptr)
+    {
+        auto buffer = std::make_unique<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        buffer->tid = static_cast<int>(buffers.size()) + 1;
+        buffer->name = "thread " + std::to_string(buffer->tid);
+        threadBuffer = buffer.get();
+        buffers.push_back(std::move(buffer));
+    }
+    return *static_cast<ThreadBuffer*>(threadBuffer);
+}
+
+void TraceRecorder::writer_loop()
+{
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    while (!stopping)
+    {
+        wake.wait_for(lock, drainInterval, [this] { return stopping; });
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+void TraceRecorder::drain()
+{
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    char line[256];
+    for (std::unique_ptr<ThreadBuffer>& buffer : buffers)
+    {
+        if (!buffer->nameWritten)
+        {
+            out << (firstEvent ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                << buffer->tid << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+            firstEvent = false;
+            buffer->nameWritten = true;
+        }
+
+        uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        for (; tail < head; ++tail)
+        {
+            const Event& event = buffer->events[tail & (ringSize - 1)];
+            std::snprintf(line, sizeof(line),
+                          "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                          firstEvent ? "\n" : ",\n", event.name, buffer->tid, event.beginNs / 1000.0,
+                          (event.endNs - event.beginNs) / 1000.0);
+            out << line;
+            firstEvent = false;
+            written++;
+        }
+        buffer->tail.store(tail, std::memory_order_release);
+    }
+    out.flush();
+}
+
+TraceRecorder& trace_recorder()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
@@ -0,0 +1,114 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A timeline of named spans in Chrome's trace-event JSON, for chrome://tracing
+// or Perfetto. Each thread appends complete ("X") events to its own
+// single-producer ring without taking a lock; a writer thread drains the rings
+// every few milliseconds and streams them to the file. A full ring drops
+// events rather than block the thread producing them. There is one recorder
+// per process, trace_recorder().
+class TraceRecorder
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t ringSize{1u << 14}; // events per thread
+
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool start(const std::string& path, std::string& error);
+    void stop();
+    bool active() const { return running.load(std::memory_order_acquire); }
+
+    // name must outlive the trace: a string literal or a stage name.
+    void complete(const char* name, Clock::time_point begin, Clock::time_point end);
+    // Labels the calling thread's track, e.g. "gui" or "solver worker 2".
+    void set_thread_name(const std::string& name);
+
+    size_t events_written() const { return written.load(); }
+    size_t events_dropped() const;
+
+private:
+    friend TraceRecorder& trace_recorder();
+    TraceRecorder() = default;
+
+    struct Event {
+        const char* name;
+        int64_t beginNs;
+        int64_t endNs;
+    };
+
+    struct ThreadBuffer {
+        int tid{0};
+        std::string name;
+        bool nameWritten{false};
+        std::unique_ptr<Event[]> events;
+        std::atomic<uint64_t> head{0}; // advanced by the owning thread
+        std::atomic<uint64_t> tail{0}; // advanced by the writer
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    ThreadBuffer& buffer_for_this_thread();
+    void writer_loop();
+    void drain();
+
+    std::atomic<bool> running{false};
+    Clock::time_point origin;
+    std::atomic<size_t> written{0};
+
+    mutable std::mutex buffersMutex; // guards the list and thread names, not the rings
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    std::ofstream out;
+    bool firstEvent{true};
+    std::thread writer;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping{false};
+};
+
+TraceRecorder& trace_recorder();
+
+// Records its scope as one event while a trace is running.
+class ScopedTraceEvent
+{
+public:
+    explicit ScopedTraceEvent(const char* name) : name(name)
+    {
+        if (trace_recorder().active())
+        {
+            begin = TraceRecorder::Clock::now();
+            armed = true;
+        }
+    }
+
+    ~ScopedTraceEvent()
+    {
+        if (armed)
+        {
+            trace_recorder().complete(name, begin, TraceRecorder::Clock::now());
+        }
+    }
+
+    ScopedTraceEvent(const ScopedTraceEvent&) = delete;
+    ScopedTraceEvent& operator=(const ScopedTraceEvent&) = delete;
+
+private:
+    const char* name;
+    TraceRecorder::Clock::time_point begin;
+    bool armed{false};
+};
+#endif // TRACE_EVENTS_H